@@ -7,13 +7,39 @@
 
 #include "queue_connections.h"
 
+// epoll_event.data.ptr of the descriptors that are not client connections
+#define EPOLL_TAG_LISTENER ((void *)1)
+#define EPOLL_TAG_TIMERFD ((void *)2)
+#define EPOLL_TAG_INBOX ((void *)3) // eventfd of the balancer inbox of the thread
+#define EPOLL_TAG_IO ((void *)4)    // eventfd of the I/O completions of the thread
+
 void handleEpollFacade(int socketServerFd);// facade for one epollFd per thread
-void handleEpoll(int socketServerFd, int epollFd);
-void acceptEpollConnection(int epollFd, int socketServerFd, int events);
+void handleEpoll(int socketServerFd, int epollFd, int maxConnections, int worker, bool ownListener);
+void acceptEpollConnection(int epollFd, int socketServerFd, int events, struct QueueConnectionsType *queueConnections);
+void handleEpollConnection(int epollFd,
+                           struct QueueConnectionsType *queueConnections,
+                           struct QueueConnectionElementType *connection);
+void resumeEpollTransfers(int epollFd, struct QueueConnectionsType *queueConnections);
+bool handOffEpollConnection(int epollFd,
+                            struct QueueConnectionsType *queueConnections,
+                            struct QueueConnectionElementType *connection,
+                            int target);
+void receiveEpollHandoffs(int epollFd, struct QueueConnectionsType *queueConnections);
+void processEpollRequests(struct QueueConnectionsType *queueConnections, struct QueueConnectionElementType *connection);
+bool probeEpollRequestFile(struct QueueConnectionsType *queueConnections, struct QueueConnectionElementType *connection);
+bool probeEpollOutputFile(struct QueueConnectionsType *queueConnections, struct QueueConnectionElementType *connection);
+void receiveEpollIoCompletions(int epollFd, struct QueueConnectionsType *queueConnections);
+void drainEpollConnections(int epollFd,
+                           int socketServerFd,
+                           bool ownListener,
+                           struct QueueConnectionsType *queueConnections);
+
+int createEpollTimerFd(int epollFd);
+void armEpollTimerFd(int timerFd, int timeout);
 
-struct epoll_event buildEpollEvent(int events, int fd);
-void addEpollClient(int epollFd, int clientFd, int events);
-void modEpollClient(int epollFd, int clientFd, int events);
+struct epoll_event buildEpollEvent(int events, void *ptr);
+void addEpollClient(int epollFd, int clientFd, int events, void *ptr);
+void modEpollClient(int epollFd, int clientFd, int events, void *ptr);
 void closeEpollClient(int epollFd, int clientFd);
 
 #endif // ACCEPT_CLIENT_EPOLL_H
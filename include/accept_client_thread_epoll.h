@@ -1,8 +1,10 @@
 #ifndef ACCEPT_CLIENT_THREAD_EPOLL_H
 #define ACCEPT_CLIENT_THREAD_EPOLL_H
 
+#include <pthread.h> // for pthread_t
 
 void acceptClientsThreadEpoll(int socketServerFd);
 void *workThreadEpoll(void *threadDataArg);
+void pinThreadToCpu(pthread_t thread, int cpu);
 
 #endif // ACCEPT_CLIENT_THREAD_EPOLL_H
@@ -0,0 +1,90 @@
+#ifndef ACCEPT_CLIENT_URING_H
+#define ACCEPT_CLIENT_URING_H
+
+#include <stdbool.h> // for bool
+
+#include "../lib/uring/uring.h"
+#include "queue_connections.h"
+
+#define URING_ENTRIES 4096
+#define URING_BUFFER_GROUP_ID 0
+#define URING_BUFFER_ENTRIES 1024 // power of 2
+#define URING_BUFFER_SIZE BUFFER_REQUEST_SIZE
+#define URING_SPLICE_CHUNK_SIZE 65536 // default pipe capacity
+#define URING_MAX_PIPES 256
+#define URING_SPILL_PAUSE_SIZE (4 * BUFFER_REQUEST_SIZE) // received beyond the request buffer, then the recv is paused
+#define URING_BACKLOG_CHUNK_SIZE 256 // operations prepared while the submission queue is full
+
+enum UringOperation {
+    URING_OPERATION_ACCEPT = 1,
+    URING_OPERATION_RECV,
+    URING_OPERATION_SEND,
+    URING_OPERATION_SPLICE_IN,  // file -> pipe
+    URING_OPERATION_SPLICE_OUT, // pipe -> socket
+    URING_OPERATION_CANCEL,     // of the multishot accept, when the thread drains
+};
+
+// user_data: operation (8 bits) | slot generation (24 bits) | connection slot (32 bits)
+#define URING_USER_DATA(operation, generation, slot)                                                                   \
+    (((unsigned long long)(operation) << 56) | (((unsigned long long)(generation) & 0xFFFFFF) << 32)                 \
+     | (unsigned int)(slot))
+#define URING_USER_DATA_OPERATION(userData) ((int)((userData) >> 56))
+#define URING_USER_DATA_GENERATION(userData) ((unsigned int)(((userData) >> 32) & 0xFFFFFF))
+#define URING_USER_DATA_SLOT(userData) ((int)((userData)&0xFFFFFFFF))
+
+// I/O state of a connection slot that survives the keep-alive reset and the reuse of the slot
+struct UringSlotState {
+    unsigned int generation; // discards the completions of a previous client of the same slot
+    bool recvArmed;          // multishot recv in flight
+    bool recvPaused;         // cancelled until the spilled bytes fit in the request buffer
+    bool outputInFlight;     // send or splice in flight, the connection cannot be freed yet
+    bool closing;
+    int pipeFds[2];
+    size_t pipeBytes; // bytes spliced into the pipe, not yet sent
+    char *spill;      // received bytes that did not fit in the request buffer, NULL when there are none
+    size_t spillLength;
+};
+
+struct UringWorker {
+    struct Uring ring;
+    struct UringBufferRing bufferRing;
+    struct QueueConnectionsType *queueConnections;
+    int socketServerFd;
+    struct UringSlotState *slots; // indexed by the slot of the connection, grows with the connections queue
+    int slotsCount;
+    int freePipes[URING_MAX_PIPES][2];
+    int freePipesCount;
+    struct io_uring_sqe *backlog; // prepared while the submission queue was full, submitted in order later
+    int backlogCount;
+    int backlogSize;
+};
+
+bool isUringSupported();
+void handleUring(int socketServerFd, int maxConnections, bool ownListener);
+void drainUringConnections(struct UringWorker *worker, bool ownListener);
+void handleUringCompletion(struct UringWorker *worker, unsigned long long userData, int result, unsigned int flags);
+void acceptUringConnection(struct UringWorker *worker, int clientFd);
+void handleUringRecv(struct UringWorker *worker, struct QueueConnectionElementType *connection, char *data, size_t length);
+void processUringRequest(struct UringWorker *worker, struct QueueConnectionElementType *connection);
+void refillUringRequestBuffer(struct UringWorker *worker, struct QueueConnectionElementType *connection);
+void makeUringCannedResponse(struct UringWorker *worker, struct QueueConnectionElementType *connection, char *response);
+void handleUringOutput(struct UringWorker *worker,
+                       struct QueueConnectionElementType *connection,
+                       int operation,
+                       size_t bytes);
+void closeUringConnection(struct UringWorker *worker, struct QueueConnectionElementType *connection);
+bool growUringSlots(struct UringWorker *worker, int slot);
+
+bool acquireUringPipe(struct UringWorker *worker, struct UringSlotState *slotState);
+void releaseUringPipe(struct UringWorker *worker, struct UringSlotState *slotState);
+
+struct io_uring_sqe *getUringSqe(struct UringWorker *worker);
+void flushUringBacklog(struct UringWorker *worker);
+void prepareUringAccept(struct UringWorker *worker);
+void prepareUringCancelAccept(struct UringWorker *worker);
+void prepareUringRecv(struct UringWorker *worker, struct QueueConnectionElementType *connection);
+void prepareUringCancelRecv(struct UringWorker *worker, struct QueueConnectionElementType *connection);
+void prepareUringSend(struct UringWorker *worker, struct QueueConnectionElementType *connection);
+void prepareUringSplice(struct UringWorker *worker, struct QueueConnectionElementType *connection, int operation);
+
+#endif // ACCEPT_CLIENT_URING_H
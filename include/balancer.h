@@ -0,0 +1,50 @@
+#ifndef BALANCER_H
+#define BALANCER_H
+
+#include <netinet/in.h> // for struct sockaddr_in
+#include <stdatomic.h>  // for _Atomic
+#include <stdbool.h>    // for bool
+
+#define BALANCER_NO_WORKER -1
+
+// a connection moved to another thread, only its descriptor and address: it is moved between two requests
+struct HandoffType {
+    struct HandoffType *next;
+    int clientFd;
+    bool idle;          // kept alive after a response, else it was just accepted
+    bool clientCounted; // already counted in the connections of its client address
+    struct sockaddr_in peerAddress;
+};
+
+/**
+ * Inbox of a worker thread, in its own cache line: any thread pushes the connections it hands off
+ * to the lock-free stack and wakes up the owner with the eventfd, the owner takes the whole stack at once.
+ */
+struct WorkerInboxType {
+    _Alignas(64) _Atomic(struct HandoffType *) head;
+    atomic_int load;  // connections of the worker, published by the owner once per iteration
+    atomic_int thief; // idle worker that asked for connections, BALANCER_NO_WORKER if none
+    int eventFd;
+};
+
+// inboxes of the epoll threads, count 0 without --balance
+struct BalancerType {
+    struct WorkerInboxType *inboxes;
+    int count;
+    int capacity; // max connections of a thread
+};
+
+extern struct BalancerType BALANCER;
+
+void initBalancer(int workers, int capacity);
+void freeBalancer();
+int getBalancerEventFd(int worker);
+int getWorkerLoad(int worker);
+void publishWorkerLoad(int worker, int load);
+int pickHandoffTarget(int worker, int load);
+bool pushHandoff(int target, int clientFd, struct sockaddr_in *peerAddress, bool idle, bool clientCounted);
+struct HandoffType *takeHandoffs(int worker);
+bool requestSteal(int worker, int load);
+int takeStealRequest(int worker);
+
+#endif // BALANCER_H
@@ -0,0 +1,35 @@
+#ifndef BANDWIDTH_H
+#define BANDWIDTH_H
+
+#include <stdatomic.h> // for _Atomic
+#include <stdbool.h>   // for bool
+#include <stddef.h>    // for size_t
+
+#define BANDWIDTH_TOTAL_BURST_MS 100 // sent at full speed by the process after an idle period (--limit-rate-total)
+
+/**
+ * Output rate limits, as a virtual schedule (GCRA): every limit has the time when its bytes sent so far
+ * would be done at its rate, a send is allowed while that time is less than the burst ahead of now.
+ * The schedule of a connection is in its cold part, the one of the process is shared by the threads.
+ */
+struct BandwidthLimitsType {
+    unsigned long long connectionRate;    // bytes per second of a connection, 0 unlimited
+    unsigned long long connectionBurstUs; // the first bytes of a response, in microseconds at the rate
+    unsigned long long totalRate;         // bytes per second of the process, 0 unlimited
+    unsigned long long totalBurstUs;
+    _Alignas(64) _Atomic unsigned long long totalNextUs;
+    bool enabled;
+};
+
+extern struct BandwidthLimitsType BANDWIDTH;
+
+void initBandwidthLimits(unsigned long long connectionRate,
+                         unsigned long long connectionBurst,
+                         unsigned long long totalRate);
+size_t getBandwidthAllowance(unsigned long long connectionNextUs,
+                             unsigned long long nowUs,
+                             size_t quantum,
+                             unsigned long long *waitUs);
+void chargeBandwidth(unsigned long long *connectionNextUs, size_t bytes, unsigned long long nowUs);
+
+#endif // BANDWIDTH_H
@@ -0,0 +1,13 @@
+#ifndef BUSY_POLL_H
+#define BUSY_POLL_H
+
+#include <stdbool.h>   // for bool
+#include <sys/epoll.h> // for struct epoll_event
+
+#include "../lib/uring/uring.h"
+
+void setBusyPollSocket(int socketFd);
+int busyPollEpoll(int epollFd, struct epoll_event *events, int maxEvents, int timeout);
+bool busyPollUring(struct Uring *ring);
+
+#endif // BUSY_POLL_H
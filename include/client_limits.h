@@ -0,0 +1,55 @@
+#ifndef CLIENT_LIMITS_H
+#define CLIENT_LIMITS_H
+
+#include <netinet/in.h> // for in_addr_t
+#include <pthread.h>    // for pthread_spinlock_t
+#include <stdbool.h>    // for bool
+#include <stdint.h>     // for uint32_t
+
+#define CLIENT_LIMITS_SHARD_BITS 6
+#define CLIENT_LIMITS_SHARDS (1 << CLIENT_LIMITS_SHARD_BITS)
+#define CLIENT_LIMITS_NONE UINT32_MAX
+#define CLIENT_LIMITS_EVICT_SCAN 8 // LRU entries checked for one without connections before evicting the last one
+
+// 32 bytes, linked by index in the entries of the shard
+struct ClientEntryType {
+    unsigned long long refillMs;
+    in_addr_t address; // binary peer address, the key
+    uint32_t next;     // hash chain
+    uint32_t lruPrev;  // towards the most recently used
+    uint32_t lruNext;  // towards the least recently used
+    uint32_t tokens;   // thousandths of a request
+    int connections;
+};
+
+/**
+ * A fixed number of clients per shard, the least recently used one is replaced by a new client,
+ * so a scan from millions of addresses cannot grow the table. The critical sections are a few loads,
+ * one spinlock per shard is enough for the threads of the process.
+ */
+struct ClientShardType {
+    _Alignas(64) pthread_spinlock_t lock;
+    uint32_t *buckets; // heads of the hash chains, as many as entries
+    struct ClientEntryType *entries;
+    uint32_t count;
+    uint32_t capacity; // power of 2
+    uint32_t lruHead;  // most recently used
+    uint32_t lruTail;  // least recently used
+};
+
+struct ClientLimitsType {
+    struct ClientShardType shards[CLIENT_LIMITS_SHARDS];
+    int requestsPerSecond; // token bucket of the requests, 0 disabled
+    int connections;       // concurrent connections, 0 disabled
+    bool enabled;
+};
+
+extern struct ClientLimitsType CLIENT_LIMITS;
+
+void initClientLimits(int requestsPerSecond, int connections, uint32_t entries);
+void freeClientLimits();
+bool acquireClientConnection(in_addr_t address);
+void releaseClientConnection(in_addr_t address);
+bool takeClientRequest(in_addr_t address);
+
+#endif // CLIENT_LIMITS_H
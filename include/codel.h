@@ -0,0 +1,30 @@
+#ifndef CODEL_H
+#define CODEL_H
+
+#include <stdbool.h> // for bool
+
+/**
+ * Admission controller of a thread, after CoDel (Nichols & Jacobson, "Controlling Queue Delay"):
+ * the sojourn is the time from accept to the first byte of the first response. When the minimum
+ * sojourn stays above the target for a whole interval the new connections are rejected, at a
+ * rate that grows with the square root of the rejections, until a sojourn is below the target again.
+ */
+struct CodelType {
+    unsigned long long target;   // microseconds, 0 disabled
+    unsigned long long interval; // microseconds
+    unsigned long long firstAboveTime; // end of the interval above the target, 0 below the target
+    unsigned long long lastSample;
+    unsigned long long dropNext; // next rejection while shedding
+    unsigned int count;          // rejections of the current shedding period
+    unsigned int lastCount;
+    bool overloaded; // the sojourn stayed above the target a whole interval
+    bool dropping;
+};
+
+unsigned long long monotonicMicroseconds();
+
+void initCodel(struct CodelType *codel, unsigned long long targetUs, unsigned long long intervalUs);
+void sampleCodel(struct CodelType *codel, unsigned long long sojournUs, unsigned long long nowUs);
+bool shedCodel(struct CodelType *codel, unsigned long long nowUs);
+
+#endif // CODEL_H
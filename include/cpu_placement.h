@@ -0,0 +1,15 @@
+#ifndef CPU_PLACEMENT_H
+#define CPU_PLACEMENT_H
+
+#include <sched.h> // for cpu_set_t
+
+#define CPU_PLACEMENT_CGROUP_ROOT "/sys/fs/cgroup"
+#define CPU_PLACEMENT_PATH_MAX 4096
+#define CPU_PLACEMENT_LIST_MAX 1024
+
+int getServerCpus(cpu_set_t *cpuSet);
+int getCgroupCpuLimit();
+int getServerThreads();
+void setLocalMemoryPolicy();
+
+#endif // CPU_PLACEMENT_H
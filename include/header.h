@@ -1,15 +1,74 @@
 #ifndef HEADER_H
 #define HEADER_H
 
-struct Header {
-    char *name;
-    char *value;
-    struct Header *next;
+#include <stdbool.h> // for bool
+#include <stddef.h>  // for size_t
+#include <stdint.h>  // for uint16_t
+
+#define REQUEST_HEADERS_MAX 32 // more headers in a request is a bad request
+#define HEADER_HASH_BITS 6     // slots of the perfect hash of the well-known names
+#define HEADER_HASH_MULTIPLIER 0x9E3784C1U
+
+// well-known request headers, the others are only found by name
+enum HeaderId {
+    HEADER_UNKNOWN,
+    HEADER_ACCEPT,
+    HEADER_ACCEPT_CHARSET,
+    HEADER_ACCEPT_ENCODING,
+    HEADER_ACCEPT_LANGUAGE,
+    HEADER_AUTHORIZATION,
+    HEADER_CACHE_CONTROL,
+    HEADER_CONNECTION,
+    HEADER_CONTENT_LENGTH,
+    HEADER_CONTENT_TYPE,
+    HEADER_COOKIE,
+    HEADER_EXPECT,
+    HEADER_HOST,
+    HEADER_IF_MODIFIED_SINCE,
+    HEADER_IF_NONE_MATCH,
+    HEADER_IF_RANGE,
+    HEADER_KEEP_ALIVE,
+    HEADER_ORIGIN,
+    HEADER_PRAGMA,
+    HEADER_RANGE,
+    HEADER_REFERER,
+    HEADER_TE,
+    HEADER_TRANSFER_ENCODING,
+    HEADER_UPGRADE,
+    HEADER_USER_AGENT,
+    HEADER_X_FORWARDED_FOR,
+    HEADER_IDS,
+};
+
+// bytes of a request, from its first byte
+struct RequestViewType {
+    uint16_t offset;
+    uint16_t length;
+};
+
+// a request header, its name and value are NUL terminated in the request
+struct HeaderViewType {
+    struct RequestViewType name;  // lower case
+    struct RequestViewType value; // without the whitespace around it
+    uint8_t id;                   // enum HeaderId
+};
+
+/**
+ * The headers of a request in the order they came, inline in the parser: nothing is allocated.
+ * The first header of every well-known name is also indexed by its id, the unknown names are
+ * found by walking the headers.
+ */
+struct HeaderTableType {
+    int count;
+    uint8_t known[HEADER_IDS]; // index + 1 in headers of the first header with the id, 0 if there is none
+    struct HeaderViewType headers[REQUEST_HEADERS_MAX];
 };
 
-struct Header *addHeader(struct Header *header, char *name, char *value);
-char *getHeader(struct Header *header, char *name);
-void freeHeader(struct Header *header);
-void printHeaders(struct Header *header);
+enum HeaderId getHeaderId(const char *name, size_t length);
+void initHeaderTable(struct HeaderTableType *table);
+bool addHeader(struct HeaderTableType *table, struct RequestViewType name, struct RequestViewType value, enum HeaderId id);
+char *getHeaderById(struct HeaderTableType *table, char *data, enum HeaderId id);
+char *getHeader(struct HeaderTableType *table, char *data, const char *name);
+void printHeaders(struct HeaderTableType *table, char *data);
 
-#endif // HEADER_H
\ No newline at end of file
+#endif // HEADER_H
@@ -1,6 +1,9 @@
 #ifndef HELPER_H
 #define HELPER_H
 
+#include <netinet/in.h> // for struct sockaddr_in
+#include <sched.h>      // for cpu_set_t
+#include <stdbool.h>    // for bool
 #include <stddef.h> // for size_t
 #include <time.h>
 
@@ -15,6 +18,7 @@
 
 int makeSocketNonBlocking(int fd);
 char *timeToDatetimeString(time_t time, char *format);
+char *peerAddressToString(struct sockaddr_in *address, char *ip);
 
 void strCopySafe(char *dest, char *src);
 char *toLower(char *str, size_t len);
@@ -23,6 +27,8 @@ char *toUpper(char *str, size_t len);
 int makeDirectory(const char *file_path, mode_t mode);
 
 char *readAll(int fd, char *buffer, size_t bufferSize);
-size_t sendAll(int fd, char *buffer, size_t count);
+bool readFileString(const char *path, char *buffer, size_t bufferSize);
+int parseCpuList(const char *list, cpu_set_t *cpuSet);
+int getCpuOfSet(cpu_set_t *cpuSet, int index);
 
 #endif // HELPER_H
\ No newline at end of file
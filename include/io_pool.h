@@ -0,0 +1,62 @@
+#ifndef IO_POOL_H
+#define IO_POOL_H
+
+#include <pthread.h>   // for pthread_t
+#include <stdatomic.h> // for _Atomic
+#include <stdbool.h>   // for bool
+#include <stddef.h>    // for size_t
+#include <sys/types.h> // for off_t
+
+// a blocking filesystem operation done for an event loop: the lookup of a path, the read of a file range, or a gzip cache
+struct IoJobType {
+    struct IoJobType *next;
+    struct IoCompletionsType *completions; // of the event loop that submitted it, NULL if no one waits for the job
+    int fd;        // duplicated descriptor of the file range to read ahead, closed by the job; -1 to open the path
+    off_t offset;
+    size_t length;
+    int slot;             // connection of the event loop
+    unsigned int ticket;  // the job of the connection, the slot may be reused meanwhile
+    bool gzip;            // compress the path to the .gz that follows its null terminator
+    char path[];
+};
+
+/**
+ * Completed jobs of an event loop: the I/O threads push them to the lock-free stack and wake up the loop
+ * with the eventfd, the loop takes the whole stack at once.
+ */
+struct IoCompletionsType {
+    _Alignas(64) _Atomic(struct IoJobType *) head;
+    atomic_int pending; // submitted and not taken back yet
+    int eventFd;
+};
+
+// threads of --io-threads, count 0 disabled
+struct IoPoolType {
+    pthread_t *threads;
+    int count;
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    struct IoJobType *head; // FIFO of the jobs waiting for a thread
+    struct IoJobType *tail;
+    bool stopping;
+};
+
+extern struct IoPoolType IO_POOL;
+
+void initIoPool(int threads);
+void freeIoPool();
+void initIoCompletions(struct IoCompletionsType *completions);
+void freeIoCompletions(struct IoCompletionsType *completions);
+bool submitIoOpen(struct IoCompletionsType *completions, const char *path, int slot, unsigned int ticket);
+bool submitIoReadahead(struct IoCompletionsType *completions,
+                       int fd,
+                       off_t offset,
+                       size_t length,
+                       int slot,
+                       unsigned int ticket);
+bool submitIoGzip(const char *path, const char *gzipPath);
+struct IoJobType *takeIoCompletions(struct IoCompletionsType *completions);
+bool probeFileOpen(const char *path, int *fd);
+bool probeFileRange(int fd, off_t offset);
+
+#endif // IO_POOL_H
@@ -0,0 +1,20 @@
+#ifndef KEEP_ALIVE_H
+#define KEEP_ALIVE_H
+
+#include <stdbool.h> // for bool
+
+#include "queue_connections.h"
+
+#define KEEP_ALIVE_MIN_TIMEOUT 1 // seconds, the idle timeout when the connections table is almost full
+
+// tokens of the Connection header, case insensitive and separated by commas
+enum ConnectionToken {
+    CONNECTION_TOKEN_CLOSE = 1 << 0,
+    CONNECTION_TOKEN_KEEP_ALIVE = 1 << 1,
+};
+
+int parseConnectionHeader(const char *value);
+int getKeepAliveTimeout(struct QueueConnectionsType *queueConnections);
+void applyKeepAlivePolicy(struct QueueConnectionsType *queueConnections, struct QueueConnectionElementType *connection);
+
+#endif // KEEP_ALIVE_H
@@ -0,0 +1,52 @@
+#ifndef LOOP_STATS_H
+#define LOOP_STATS_H
+
+#include <stdatomic.h> // for atomic_ullong
+#include <stdbool.h>   // for bool
+
+#define LOOP_STATS_BUCKETS 24       // powers of 2 of microseconds, the last one from 4 seconds
+#define LOOP_STATS_MAX_THREADS 1024 // threads of a process that can register their stats
+#define LOOP_STATS_PATH_MAX 128     // of the request path kept for the stall reports
+
+/**
+ * Histogram of durations written only by its thread (relaxed load and store, no atomic read-modify-write)
+ * and read at any time by the dump: a bucket read while it is written is at most one count behind.
+ */
+struct LoopHistogramType {
+    atomic_ullong buckets[LOOP_STATS_BUCKETS]; // bucket b: < 2^b microseconds
+    atomic_ullong count;
+    atomic_ullong maxUs;
+};
+
+// lag of the event loop of a thread (--stall-budget)
+struct LoopStatsType {
+    _Alignas(64) struct LoopHistogramType iterations; // from the return of epoll_wait to the next call
+    struct LoopHistogramType events;                  // one run of the state machine of a connection
+    atomic_ullong stalls;                             // iterations over the budget
+    long threadId;
+    // the slowest event of the current iteration, the culprit of an iteration over the budget
+    unsigned long long slowestUs;
+    int slowestFd; // -1 no event of a connection
+    int slowestState;
+    char slowestPath[LOOP_STATS_PATH_MAX];
+    char path[LOOP_STATS_PATH_MAX]; // of the last request processed by the running event
+};
+
+struct LoopStatsRegistryType {
+    struct LoopStatsType *threads[LOOP_STATS_MAX_THREADS];
+    atomic_int count;
+    unsigned long long budgetUs; // 0 disabled
+};
+
+extern struct LoopStatsRegistryType LOOP_STATS;
+
+void initLoopStats(unsigned long long budgetUs);
+void freeLoopStats();
+struct LoopStatsType *registerLoopStats(long threadId);
+void startLoopEvent(struct LoopStatsType *stats, const char *path);
+void noteLoopPath(struct LoopStatsType *stats, const char *path);
+void recordLoopEvent(struct LoopStatsType *stats, unsigned long long startUs, int fd, int state);
+void recordLoopIteration(struct LoopStatsType *stats, unsigned long long startUs, int events);
+void dumpLoopStats();
+
+#endif // LOOP_STATS_H
@@ -14,8 +14,49 @@
 #include "../lib/logger/logger.h" // for struct Logger
 
 #define OPTIONS_PATH_MAX 4096
+#define OPTIONS_CPUS_MAX 256
 
 
+// long options without short option
+enum LongOptions {
+    OPTION_REUSEPORT = 256,
+    OPTION_INCOMING_CPU,
+    OPTION_IO_BACKEND,
+    OPTION_DEFER_ACCEPT,
+    OPTION_FASTOPEN,
+    OPTION_TIMERFD,
+    OPTION_MAX_CONNECTIONS,
+    OPTION_NOTSENT_LOWAT,
+    OPTION_BALANCE,
+    OPTION_CODEL_TARGET,
+    OPTION_CLIENT_RATE,
+    OPTION_CLIENT_CONNECTIONS,
+    OPTION_LIMIT_RATE,
+    OPTION_LIMIT_RATE_AFTER,
+    OPTION_LIMIT_RATE_TOTAL,
+    OPTION_KEEP_ALIVE_TIMEOUT,
+    OPTION_KEEP_ALIVE_REQUESTS,
+    OPTION_IO_THREADS,
+    OPTION_WORKERS,
+    OPTION_WORKER_PINNING,
+    OPTION_UPGRADE_SOCKET,
+    OPTION_THREADS,
+    OPTION_CPUS,
+    OPTION_STALL_BUDGET,
+    OPTION_BUSY_POLL,
+};
+
+enum IoBackend {
+    IO_BACKEND_EPOLL,
+    IO_BACKEND_URING,
+};
+
+enum WorkerPinning {
+    WORKER_PINNING_NONE,
+    WORKER_PINNING_CPU,
+    WORKER_PINNING_NUMA,
+};
+
 static const char *usageTemplate =
     "Usage: %s [ options ]\n\n"
     "  -a, --address ADDR        Bind to local address (by default localhost)\n"
@@ -23,6 +64,31 @@ static const char *usageTemplate =
     "  -d, --html-dir DIR        Open html and assets from specified directory (by default <public> directory)\n"
     "  -l, --logger              Active logs for send messages to log file (by default logs send to stderr)\n"
     "  --logger-path             Absolute path to directory (by default /var/log/ub-server/)\n"
+    "  --reuseport               One SO_REUSEPORT listening socket and epoll per thread, pinned to a CPU\n"
+    "  --incoming-cpu            With --reuseport, steer connections to the thread of the CPU that received them\n"
+    "  --io-backend BACKEND      epoll or io_uring (by default epoll, io_uring falls back to epoll if not supported)\n"
+    "  --defer-accept SECONDS    TCP_DEFER_ACCEPT, wake up accept only when the request data arrives (by default off)\n"
+    "  --fastopen QUEUE          TCP_FASTOPEN with the given queue of pending requests (by default off)\n"
+    "  --timerfd                 Wake up the epoll loop for the connection deadlines with a timerfd\n"
+    "  --max-connections N       Max concurrent connections of the process (by default 65536)\n"
+    "  --notsent-lowat BYTES     TCP_NOTSENT_LOWAT, unsent bytes kept in the socket of a large response (by default off)\n"
+    "  --balance                 Hand off and steal connections between the epoll threads of different load\n"
+    "  --codel-target MS         Reject new connections with 503 when accept to first byte stays above MS (by default off)\n"
+    "  --client-rate REQS        Max requests per second of a client address, answered with 429 (by default off)\n"
+    "  --client-connections N    Max concurrent connections of a client address, answered with 429 (by default off)\n"
+    "  --limit-rate BYTES        Max bytes per second sent to a connection (epoll, by default off)\n"
+    "  --limit-rate-after BYTES  First bytes of each response sent at full speed with --limit-rate (by default 0)\n"
+    "  --limit-rate-total BYTES  Max bytes per second sent by the server (epoll, by default off)\n"
+    "  --keep-alive-timeout SEC  Idle timeout of a keep-alive connection, shorter when the thread is busy (by default 60)\n"
+    "  --keep-alive-requests N   Max responses of a keep-alive connection, 0 unlimited (by default 1000)\n"
+    "  --io-threads N            Threads that open and read the files not in the caches (epoll, by default off)\n"
+    "  --workers N               Prefork N worker processes supervised by a master (by default off, one process)\n"
+    "  --worker-pinning MODE     none, cpu or numa: affinity of every worker to its CPUs or to a NUMA node (by default none)\n"
+    "  --upgrade-socket PATH     Unix socket where the server hands its listener over to a new binary (by default off)\n"
+    "  --threads N               Epoll threads (by default one per allowed CPU, within the cgroup CPU quota)\n"
+    "  --cpus LIST               Pin the threads to these CPUs, as 0-3,8 (by default not pinned)\n"
+    "  --stall-budget US         Report the epoll loop iterations and events longer than US microseconds (by default off)\n"
+    "  --busy-poll US            Spin US microseconds for new events before every blocking wait (by default off)\n"
     "  -h, --help                Print this usage information\n";
 
 static struct option longOptions[] = {
@@ -31,6 +97,31 @@ static struct option longOptions[] = {
     {"html-dir", required_argument, NULL, 'd'},
     {"logger", no_argument, NULL, 'l'},
     {"logger-path", required_argument, NULL, 't'},
+    {"reuseport", no_argument, NULL, OPTION_REUSEPORT},
+    {"incoming-cpu", no_argument, NULL, OPTION_INCOMING_CPU},
+    {"io-backend", required_argument, NULL, OPTION_IO_BACKEND},
+    {"defer-accept", required_argument, NULL, OPTION_DEFER_ACCEPT},
+    {"fastopen", required_argument, NULL, OPTION_FASTOPEN},
+    {"timerfd", no_argument, NULL, OPTION_TIMERFD},
+    {"max-connections", required_argument, NULL, OPTION_MAX_CONNECTIONS},
+    {"notsent-lowat", required_argument, NULL, OPTION_NOTSENT_LOWAT},
+    {"balance", no_argument, NULL, OPTION_BALANCE},
+    {"codel-target", required_argument, NULL, OPTION_CODEL_TARGET},
+    {"client-rate", required_argument, NULL, OPTION_CLIENT_RATE},
+    {"client-connections", required_argument, NULL, OPTION_CLIENT_CONNECTIONS},
+    {"limit-rate", required_argument, NULL, OPTION_LIMIT_RATE},
+    {"limit-rate-after", required_argument, NULL, OPTION_LIMIT_RATE_AFTER},
+    {"limit-rate-total", required_argument, NULL, OPTION_LIMIT_RATE_TOTAL},
+    {"keep-alive-timeout", required_argument, NULL, OPTION_KEEP_ALIVE_TIMEOUT},
+    {"keep-alive-requests", required_argument, NULL, OPTION_KEEP_ALIVE_REQUESTS},
+    {"io-threads", required_argument, NULL, OPTION_IO_THREADS},
+    {"workers", required_argument, NULL, OPTION_WORKERS},
+    {"worker-pinning", required_argument, NULL, OPTION_WORKER_PINNING},
+    {"upgrade-socket", required_argument, NULL, OPTION_UPGRADE_SOCKET},
+    {"threads", required_argument, NULL, OPTION_THREADS},
+    {"cpus", required_argument, NULL, OPTION_CPUS},
+    {"stall-budget", required_argument, NULL, OPTION_STALL_BUDGET},
+    {"busy-poll", required_argument, NULL, OPTION_BUSY_POLL},
     {"help", no_argument, NULL, 'h'},
     {NULL, 0, NULL, 0},
 };
@@ -45,6 +136,31 @@ struct Options {
     uint16_t port;
     char htmlDir[OPTIONS_PATH_MAX];
     bool TCPKeepAlive;
+    bool reusePort;   // SO_REUSEPORT sharded listeners, one per thread
+    bool incomingCpu; // SO_INCOMING_CPU + reuseport CBPF steering
+    enum IoBackend ioBackend;
+    int deferAcceptSeconds; // 0 disabled
+    int fastOpenQueue;      // 0 disabled
+    bool timerFd;           // deadlines armed in a timerfd instead of the epoll_wait timeout
+    int maxConnections;     // per process, split between the threads
+    int notSentLowat;       // 0 disabled
+    bool balance;           // hand off connections between the epoll threads
+    int codelTarget;        // milliseconds, 0 disabled
+    int clientRate;         // requests per second of a client address, 0 disabled
+    int clientConnections;  // concurrent connections of a client address, 0 disabled
+    unsigned long long limitRate;      // bytes per second of a connection, 0 disabled
+    unsigned long long limitRateAfter; // bytes of a response before --limit-rate applies
+    unsigned long long limitRateTotal; // bytes per second of the process, 0 disabled
+    int keepAliveTimeout;   // seconds, the idle timeout while the thread has room
+    int keepAliveRequests;  // responses of a connection, 0 unlimited
+    int ioThreads;          // blocking filesystem operations of the epoll threads, 0 disabled
+    int workers;            // processes forked by the master, 0 single process
+    enum WorkerPinning workerPinning;
+    char upgradeSocket[OPTIONS_PATH_MAX]; // empty disabled
+    int threads;            // epoll threads of the process (of all the workers), 0 automatic
+    char cpus[OPTIONS_CPUS_MAX]; // CPU list of the threads, empty not pinned
+    unsigned long long stallBudget; // microseconds of an epoll loop iteration, 0 disabled
+    int busyPoll;                   // microseconds of spin before the blocking wait, 0 disabled
 };
 
 extern struct Options OPTIONS;
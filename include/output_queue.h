@@ -0,0 +1,46 @@
+#ifndef OUTPUT_QUEUE_H
+#define OUTPUT_QUEUE_H
+
+#include <stdbool.h>   // for bool
+#include <stddef.h>    // for size_t
+#include <sys/types.h> // for off_t
+
+#define OUTPUT_QUEUE_SEGMENTS 16 // headers and body of up to 8 pipelined responses
+
+enum OutputSegmentKind {
+    OUTPUT_SEGMENT_MEMORY, // static template, pooled headers buffer or cached body, not owned by the queue
+    OUTPUT_SEGMENT_FILE,   // range of a file, sent with sendfile, the queue closes the fd
+};
+
+struct OutputSegmentType {
+    enum OutputSegmentKind kind;
+    int fd;           // OUTPUT_SEGMENT_FILE
+    const char *data; // OUTPUT_SEGMENT_MEMORY
+    off_t offset;     // next byte to send, in data or in the file
+    size_t length;    // bytes left
+};
+
+// ring of segments of a connection, flushed in order with sendmsg and sendfile
+struct OutputQueueType {
+    struct OutputSegmentType segments[OUTPUT_QUEUE_SEGMENTS];
+    unsigned int head;
+    unsigned int count;
+};
+
+enum OutputFlushResult {
+    OUTPUT_FLUSH_DONE,  // the queue is empty
+    OUTPUT_FLUSH_AGAIN, // the socket is full, wait for EPOLLOUT
+    OUTPUT_FLUSH_QUANTUM, // the quantum is used, the socket may still be writable
+    OUTPUT_FLUSH_ERROR, // the client is gone
+};
+
+void clearOutputQueue(struct OutputQueueType *outputQueue);
+bool isOutputQueueEmpty(struct OutputQueueType *outputQueue);
+unsigned int getOutputQueueRoom(struct OutputQueueType *outputQueue);
+size_t getOutputQueueLength(struct OutputQueueType *outputQueue);
+struct OutputSegmentType *getOutputQueueFile(struct OutputQueueType *outputQueue);
+bool pushOutputMemory(struct OutputQueueType *outputQueue, const char *data, size_t length);
+bool pushOutputFile(struct OutputQueueType *outputQueue, int fd, off_t offset, size_t length);
+enum OutputFlushResult flushOutputQueue(struct OutputQueueType *outputQueue, int fd, size_t quantum, size_t *bytesSent);
+
+#endif // OUTPUT_QUEUE_H
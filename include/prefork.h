@@ -0,0 +1,32 @@
+#ifndef PREFORK_H
+#define PREFORK_H
+
+#include <stdbool.h>   // for bool
+#include <sys/types.h> // for pid_t
+#include <time.h>      // for time_t
+
+#define PREFORK_MASTER -1 // index of the master, or of the single process without --workers
+
+// a worker process, respawned by the master when it exits
+struct PreforkWorkerType {
+    pid_t pid; // 0 while it waits to be respawned
+    time_t startedAt;
+    time_t respawnAt;
+    int failures; // exits in a row before PREFORK_MIN_UPTIME, they delay the next respawn
+};
+
+struct PreforkType {
+    struct PreforkWorkerType *workers; // of the master
+    int count;                         // --workers, 0 single process
+    int index;                         // of this process, PREFORK_MASTER in the master
+    int threads;                       // epoll threads of a worker
+    int firstCpu;                      // of the threads of this process without --worker-pinning
+    bool pinned;                       // the affinity of the process is the CPUs of its threads
+};
+
+extern struct PreforkType PREFORK;
+
+void runPrefork(int socketServerFd);
+int getThreadCpu(int thread);
+
+#endif // PREFORK_H
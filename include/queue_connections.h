@@ -2,11 +2,19 @@
 #define QUEUE_CONNECTIONS_H
 
 #include <stdbool.h> // for bool
+#include <netinet/in.h> // for struct sockaddr_in
 #include <stddef.h>  // for size_t
-#include <time.h>    // for time_t
 
+#include "../lib/pool/pool.h"
+#include "codel.h"
 #include "http_status_code.h"
+#include "io_pool.h"
+#include "loop_stats.h"
+#include "output_queue.h"
+#include "request_parser.h"
 #include "server.h"
+#include "timing_wheel.h"
+#include "transfer_scheduler.h"
 
 typedef enum Method { METHOD_GET,
                       METHOD_POST,
@@ -21,12 +29,15 @@ static const char *methodsList[] = {"GET", "POST", "PUT", "PATCH", "DELETE", "HE
 
 enum stateConnection {
     STATE_CONNECTION_RECV,          // receive data
-    STATE_CONNECTION_SEND_HEADERS,  // send headers
-    STATE_CONNECTION_SEND_BODY,     // send body with sendfile
+    STATE_CONNECTION_SEND_HEADERS,  // process the request and make the response
+    STATE_CONNECTION_SEND_BODY,     // send the response (epoll: output queue, io_uring: splice of the body)
     STATE_CONNECTION_DONE,          // done
+    STATE_CONNECTION_WAIT_IO,       // an I/O thread warms the caches for the request or the response (epoll)
     STATE_CONNECTION_DONE_FOR_CLOSE
 };
 
+static const char *stateConnectionList[] = {"RECV", "SEND_HEADERS", "SEND_BODY", "DONE", "WAIT_IO", "DONE_FOR_CLOSE"};
+
 enum contentEncoding {
     CONTENT_ENCODING_NONE,
     CONTENT_ENCODING_GZIP,
@@ -34,56 +45,118 @@ enum contentEncoding {
     CONTENT_ENCODING_BROTLI
 };
 
-struct QueueConnectionElementType {
-    time_t priorityTime;
-    int clientFd; // file descriptor
-    enum stateConnection state;
-    char *requestBuffer;
-    size_t requestBufferLength;
-    size_t requestBufferOffset;
-    bool keepAlive;
-    char *responseBufferHeaders;
-    size_t responseBufferHeadersLength;
-    size_t responseBufferHeadersOffset;
-    int bodyFd;
-    size_t bodyLength;
-    off_t bodyOffset;
-    enum contentEncoding contentEncoding;
+// cold part of a connection: metadata of the current request, used to parse, answer and log it
+struct ConnectionRequestType {
     char scheme[6];          // http or https
     char protocolVersion[9]; // HTTP/1.1
+    bool keepAlive;
     enum Method method;
-    char *path;
-    char *absolutePath;
-    struct Header *requestHeaders;
-    char *requestBody;
-    char ip[INET6_ADDRSTRLEN]; // IPv4 or IPv6
     enum HTTP_STATUS_CODE responseStatusCode;
+    enum contentEncoding contentEncoding;
+    char *requestData;  // the request in the request buffer, until the buffer is compacted after its response
+    char *path;         // view of the request data, NULL for a bad request
+    char *absolutePath;
+    char *requestBody;  // view of the request data, not NUL terminated
+    size_t requestBodyLength;
+    struct RequestParserType *parser; // of the first request of the buffer not answered yet, pooled with the buffer
+    struct sockaddr_in peerAddress; // captured once by accept, binary form
+    struct OutputQueueType *output; // response segments not sent yet (epoll), pooled while a response is queued
+    unsigned long long acceptedUs;  // admission time, 0 once the first response byte is sampled
+    bool clientCounted;             // counted in the connections of its client address (--client-connections)
+    unsigned long long paceUs;      // bandwidth schedule of the response (--limit-rate), 0 when it starts
+    bool paced;                     // bulk response, it waits for the bandwidth limits
+    bool ioWarmed;                  // the I/O threads warmed the caches, the next probe is skipped
+    bool clientAdmitted;            // the request took its --client-rate token, not taken again if it is processed again
+    int requestFd;                  // file of the request opened by the probe (--io-threads), -1 if makeResponse opens it
+    enum stateConnection ioResumeState; // state after STATE_CONNECTION_WAIT_IO
+    unsigned int ioTicket;              // job of the I/O threads the connection waits for
+    unsigned int requests;          // answered on this connection (--keep-alive-requests)
+    int keepAliveTimeout;           // seconds of the keep-alive of the response, 0 closes the connection
+};
+
+/**
+ * Hot part of a connection, the fields of the event loop (80 bytes). The deadline is the timer with the
+ * same handle as the slot in the timing wheel, and the cold part is in a parallel chunk of the slab.
+ */
+struct QueueConnectionElementType {
+    struct ConnectionRequestType *request; // cold part, never NULL
+    char *requestBuffer;                   // from the requestBuffers pool, NULL while idle
+    char *responseBufferHeaders;           // from the responseBuffers pool
+    size_t bodyLength;
+    off_t bodyOffset;
+    int clientFd; // file descriptor, -1 if the slot is free
+    int slot;     // stable index in the connections slab, and handle of its timer
+    int bodyFd;
+    enum stateConnection state;
+    unsigned int requestBufferLength;
+    unsigned int requestBufferOffset; // bytes in the request buffer
+    unsigned int requestBufferStart;  // of the requests not answered yet, the answered ones stay until sent
+    unsigned int responseBufferHeadersLength;
+    unsigned int responseBufferHeadersOffset;
+    bool transferScheduled; // in the transfer scheduler, resumed by the event loop instead of EPOLLOUT
 };
+
+#define QUEUE_CONNECTIONS_CHUNK_BITS 10
+#define QUEUE_CONNECTIONS_CHUNK_SIZE (1 << QUEUE_CONNECTIONS_CHUNK_BITS) // connections allocated at once
+
+/**
+ * Growable slab of connections: chunks of QUEUE_CONNECTIONS_CHUNK_SIZE connections allocated on demand,
+ * so a connection never moves and its pointer is stored in epoll_event.data.ptr.
+ * The deadlines are timers of the timing wheel indexed by the slot of the connection.
+ */
 struct QueueConnectionsType {
     int currentSize;
-    int capacity;
-    int indexQueue[MAX_EPOLL_EVENTS];
-    struct QueueConnectionElementType connections[MAX_EPOLL_EVENTS];
+    int capacity; // max connections of the thread
+    struct QueueConnectionElementType **chunks;
+    struct ConnectionRequestType **requestChunks; // cold parts, same chunk and index as the hot parts
+    int chunksCount;
+    int *freeSlots; // stack of free slots, as many as the allocated slots
+    int freeSlotsCount;
+    struct TimingWheelType timingWheel;
+    struct TransferSchedulerType transfers;
+    int worker; // index of the thread in the balancer, -1 without --balance
+    struct CodelType admission;
+    struct IoCompletionsType *ioCompletions; // NULL without --io-threads
+    unsigned int ioTickets;
+    bool draining; // SIGQUIT or upgrade: no new connections, no keep-alive
+    struct LoopStatsType *loopStats; // NULL without --stall-budget
+    // I/O buffers, attached to a connection only while a request is read or a response is sent
+    struct Pool requestBuffers;  // BUFFER_REQUEST_SIZE
+    struct Pool responseBuffers; // BUFFER_RESPONSE_SIZE
+    struct Pool parsers;         // with the request buffers
+    struct Pool outputQueues;    // epoll
 };
 
-struct QueueConnectionsType createQueueConnections();
-void enqueueConnection(struct QueueConnectionsType *queueConnections, struct QueueConnectionElementType connection);
-struct QueueConnectionElementType *getConnectionOrCreateByFd(struct QueueConnectionsType *queueConnections, int fd);
-struct QueueConnectionElementType *getConnectionByFd(struct QueueConnectionsType *queueConnections, int fd);
-bool existsConnection(struct QueueConnectionsType *queueConnections, int clientFd);
-void updateConnectionByFd(struct QueueConnectionsType *queueConnections, struct QueueConnectionElementType connection);
-void updateQueueConnection(struct QueueConnectionsType *queueConnections, int fd);
-void dequeueConnection(struct QueueConnectionsType *queueConnections);
-void dequeueConnectionByFd(struct QueueConnectionsType *queueConnections, int fd);
-struct QueueConnectionElementType *peekQueueConnections(struct QueueConnectionsType *queueConnections);
-void heapify(struct QueueConnectionsType *queueConnections, int index);
-void swapConnectionElementHeap(struct QueueConnectionElementType *a, struct QueueConnectionElementType *b);
-int leftChildHeap(int element);
-int rightChildHeap(int element);
-int parentHeap(int element);
+void initQueueConnections(struct QueueConnectionsType *queueConnections, int capacity);
+void freeQueueConnections(struct QueueConnectionsType *queueConnections);
+struct QueueConnectionElementType *acceptConnection(struct QueueConnectionsType *queueConnections,
+                                                    int fd,
+                                                    struct sockaddr_in *peerAddress);
+struct QueueConnectionElementType *getConnectionBySlot(struct QueueConnectionsType *queueConnections, int slot);
+void updateQueueConnection(struct QueueConnectionsType *queueConnections, struct QueueConnectionElementType *connection);
+void setConnectionDeadline(struct QueueConnectionsType *queueConnections,
+                           struct QueueConnectionElementType *connection,
+                           enum TimerKind kind);
+void setConnectionPacing(struct QueueConnectionsType *queueConnections,
+                         struct QueueConnectionElementType *connection,
+                         unsigned long long waitUs);
+enum TimerKind getConnectionDeadline(struct QueueConnectionsType *queueConnections,
+                                     struct QueueConnectionElementType *connection);
+bool shedConnection(struct QueueConnectionsType *queueConnections);
+void sampleAdmissionDelay(struct QueueConnectionsType *queueConnections, struct QueueConnectionElementType *connection);
+void dequeueConnection(struct QueueConnectionsType *queueConnections, struct QueueConnectionElementType *connection);
+void attachRequestBuffer(struct QueueConnectionsType *queueConnections, struct QueueConnectionElementType *connection);
+void releaseRequestBuffer(struct QueueConnectionsType *queueConnections, struct QueueConnectionElementType *connection);
+void attachResponseBuffer(struct QueueConnectionsType *queueConnections, struct QueueConnectionElementType *connection);
+void releaseResponseBuffer(struct QueueConnectionsType *queueConnections, struct QueueConnectionElementType *connection);
+void attachOutputQueue(struct QueueConnectionsType *queueConnections, struct QueueConnectionElementType *connection);
+void releaseOutputQueue(struct QueueConnectionsType *queueConnections, struct QueueConnectionElementType *connection);
+void resetConnection(struct QueueConnectionElementType *connection);
+void resetConnectionRequest(struct QueueConnectionElementType *connection);
 void freeConnection(struct QueueConnectionElementType *connection);
-struct QueueConnectionElementType emptyConnection();
-void printConnection(struct QueueConnectionElementType connection);
+void consumeRequestBuffer(struct QueueConnectionElementType *connection, size_t length);
+void compactRequestBuffer(struct QueueConnectionElementType *connection);
+void printConnection(struct QueueConnectionsType *queueConnections, struct QueueConnectionElementType *connection);
 void printQueueConnections(struct QueueConnectionsType *queueConnections);
 
 #endif // END QUEUE_CONNECTIONS_H
\ No newline at end of file
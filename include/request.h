@@ -8,9 +8,10 @@
 #include "queue_connections.h"
 
 
-bool isRequestComplete(char *buffer);
+size_t getRequestLength(struct QueueConnectionElementType *connection);
 void recvRequest(struct QueueConnectionElementType *connection);
 bool processRequest(struct QueueConnectionElementType *connection);
+char *getRequestHeader(struct ConnectionRequestType *request, enum HeaderId id);
 
 void printRequest(struct QueueConnectionElementType connection);
 void logRequest(struct QueueConnectionElementType connection);
@@ -0,0 +1,64 @@
+#ifndef REQUEST_PARSER_H
+#define REQUEST_PARSER_H
+
+#include <stdbool.h> // for bool
+#include <stddef.h>  // for size_t
+#include <stdint.h>  // for uint16_t
+
+#include "header.h"
+#include "http_status_code.h"
+
+#define REQUEST_PARSER_MAX_LENGTH UINT16_MAX // of a request, its views are 16 bits offsets
+#define REQUEST_CONTENT_LENGTH_MAX 0xFFFFFFFFUL
+
+enum RequestParserState {
+    REQUEST_PARSER_METHOD_START, // empty lines before the request line are skipped
+    REQUEST_PARSER_METHOD,
+    REQUEST_PARSER_PATH_START,
+    REQUEST_PARSER_PATH,
+    REQUEST_PARSER_VERSION_START,
+    REQUEST_PARSER_VERSION,
+    REQUEST_PARSER_LINE_LF,      // CR of a header line (or the request line) seen
+    REQUEST_PARSER_HEADER_START, // a header or the empty line of the end of the headers
+    REQUEST_PARSER_HEADER_NAME,
+    REQUEST_PARSER_VALUE_START,
+    REQUEST_PARSER_VALUE,
+    REQUEST_PARSER_HEADERS_LF, // CR of the empty line seen
+    REQUEST_PARSER_BODY,       // waiting for the content-length bytes
+    REQUEST_PARSER_DONE,
+    REQUEST_PARSER_ERROR,
+};
+
+enum RequestParseResult {
+    REQUEST_PARSE_INCOMPLETE,
+    REQUEST_PARSE_COMPLETE,
+    REQUEST_PARSE_ERROR, // bad request, the connection is answered with its errorStatus and closed
+};
+
+/**
+ * Resumable parser of one request: every call scans only the bytes received since the previous one.
+ * The method, path, version and headers are views into the request, and the delimiter after each of them
+ * is replaced with NUL, so they are also C strings; the body is only a view (the next pipelined request
+ * may follow it). Nothing is allocated.
+ */
+struct RequestParserType {
+    enum RequestParserState state;
+    uint16_t position;   // next byte to scan, from the start of the request
+    uint16_t tokenStart; // of the token being scanned
+    uint16_t tokenEnd;   // of a header value without its trailing whitespace
+    uint16_t headersLength; // up to the empty line included, once it is parsed
+    unsigned long contentLength;
+    enum HTTP_STATUS_CODE errorStatus; // 400, or 413 (body), 414 (request line), 431 (headers), 501 (transfer coding)
+    struct RequestViewType method;
+    struct RequestViewType path; // with the query
+    struct RequestViewType version;
+    struct RequestViewType body;
+    struct RequestViewType name; // of the header being parsed
+    struct HeaderTableType headers;
+};
+
+void initRequestParser(struct RequestParserType *parser);
+enum RequestParseResult parseRequest(struct RequestParserType *parser, char *data, size_t length, size_t maxLength);
+size_t getParsedRequestLength(struct RequestParserType *parser);
+
+#endif // REQUEST_PARSER_H
@@ -0,0 +1,50 @@
+#ifndef REQUEST_SCAN_H
+#define REQUEST_SCAN_H
+
+#include <stdbool.h> // for bool
+#include <stddef.h>  // for size_t
+#include <stdint.h>  // for uint32_t
+
+enum RequestScanLevel {
+    REQUEST_SCAN_SCALAR,
+    REQUEST_SCAN_SSE42,
+    REQUEST_SCAN_AVX2,
+    REQUEST_SCAN_LEVELS,
+};
+
+/**
+ * Kernels of the byte scans of the request parser, the same results with every instruction set.
+ * The lengths are of the leading bytes of the class, so the first byte after them is the delimiter
+ * (or the bad byte); they never read past length.
+ */
+struct RequestScanType {
+    const char *name;
+    size_t (*tokenLength)(const char *data, size_t length); // method and header names
+    size_t (*pathLength)(const char *data, size_t length);  // request target and version
+    size_t (*valueLength)(const char *data, size_t length); // header values, up to the CR or LF
+    void (*lowerCase)(char *destination, const char *source, size_t length); // ASCII, may be in place
+};
+
+extern struct RequestScanType REQUEST_SCAN; // scalar until initRequestScan()
+
+// tchar of RFC 9110: !#$%&'*+-.^_`|~ digits and letters, one bit per byte
+static const uint32_t requestTokenChars[8] = {0x00000000, 0x03FF6CFA, 0xC7FFFFFE, 0x57FFFFFF, 0, 0, 0, 0};
+
+static inline bool isTokenChar(unsigned char c) {
+    return (requestTokenChars[c >> 5] >> (c & 31)) & 1;
+}
+
+// visible ASCII and obs-text of a request target
+static inline bool isPathChar(unsigned char c) {
+    return c > ' ' && c != 0x7F;
+}
+
+// field-vchar, spaces and tabs of a header value
+static inline bool isValueChar(unsigned char c) {
+    return c >= ' ' ? c != 0x7F : c == '\t';
+}
+
+void initRequestScan();
+const struct RequestScanType *getRequestScanKernels(enum RequestScanLevel level);
+
+#endif // REQUEST_SCAN_H
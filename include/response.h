@@ -1,22 +1,31 @@
 #ifndef RESPONSE_H
 #define RESPONSE_H
 
+#include <stdbool.h>   // for bool
 #include <sys/types.h> // for size_t
 #include <time.h>      // for strftime() and time_t
 
 #include "queue_connections.h"
 
 void makeResponse(struct QueueConnectionElementType *connection);
-void sendResponseHeaders(struct QueueConnectionElementType *connection);
-void sendResponseFile(struct QueueConnectionElementType *connection);
+void inlineResponseBody(struct QueueConnectionElementType *connection);
+void queueResponse(struct QueueConnectionElementType *connection, size_t headersOffset);
+enum OutputFlushResult sendResponse(struct QueueConnectionElementType *connection, size_t quantum, size_t *bytesSent);
 
 void makeContentEncoding(struct QueueConnectionElementType *connection, struct stat statResponseBodyFd, char *mimeType);
 void getMimeType(struct QueueConnectionElementType *connection, char *mimeType);
+void closeMimeMagic();
+bool makeGzipCache(const char *path, const char *gzipPath);
 
-void helloResponse(int clientFd);
-void unsupportedProtocolResponse(int clientFd, char *protocolVersion);
-void badRequestResponse(int clientFd);
-void tooManyRequestResponse(int clientFd);
+void queueCannedResponse(struct QueueConnectionElementType *connection, const char *response);
+void helloResponse(struct QueueConnectionElementType *connection);
+void unsupportedProtocolResponse(struct QueueConnectionElementType *connection, char *protocolVersion);
+void badRequestResponse(struct QueueConnectionElementType *connection);
+char *getBadRequestTemplate(enum HTTP_STATUS_CODE status);
+void tooManyRequestResponse(struct QueueConnectionElementType *connection);
+void serviceUnavailableResponse(struct QueueConnectionElementType *connection);
+void discardRequest(int clientFd);
+void rejectConnection(int clientFd, const char *response);
 
 static char *helloResponseTemplate =
     "HTTP/1.1 200 OK\n"
@@ -42,6 +51,51 @@ static char *badRequestResponseTemplate =
     " </body>\n"
     "</html>\n";
 
+static char *contentTooLargeResponseTemplate =
+    "HTTP/1.1 413 Content Too Large\n"
+    "Content-type: text/html; charset=UTF-8\n"
+    "Connection: close\n"
+    "\n"
+    "<html>\n"
+    " <body>\n"
+    "  <h1>Content Too Large</h1>\n"
+    " </body>\n"
+    "</html>\n";
+
+static char *uriTooLongResponseTemplate =
+    "HTTP/1.1 414 URI Too Long\n"
+    "Content-type: text/html; charset=UTF-8\n"
+    "Connection: close\n"
+    "\n"
+    "<html>\n"
+    " <body>\n"
+    "  <h1>URI Too Long</h1>\n"
+    " </body>\n"
+    "</html>\n";
+
+static char *headerFieldsTooLargeResponseTemplate =
+    "HTTP/1.1 431 Request Header Fields Too Large\n"
+    "Content-type: text/html; charset=UTF-8\n"
+    "Connection: close\n"
+    "\n"
+    "<html>\n"
+    " <body>\n"
+    "  <h1>Request Header Fields Too Large</h1>\n"
+    " </body>\n"
+    "</html>\n";
+
+static char *notImplementedResponseTemplate =
+    "HTTP/1.1 501 Not Implemented\n"
+    "Content-type: text/html; charset=UTF-8\n"
+    "Connection: close\n"
+    "\n"
+    "<html>\n"
+    " <body>\n"
+    "  <h1>Not Implemented</h1>\n"
+    "  <p>This server does not support the transfer coding of your request.</p>\n"
+    " </body>\n"
+    "</html>\n";
+
 static char *versionNotSupportedResponseTemplate =
     "HTTP/1.1 505 HTTP Version Not Supported\n"
     "Content-type: text/html; charset=UTF-8\n"
@@ -56,6 +110,7 @@ static char *versionNotSupportedResponseTemplate =
 static char *tooManyRequestResponseTemplate =
     "HTTP/1.1 429 Too Many Requests\n"
     "Content-type: text/html; charset=UTF-8\n"
+    "Retry-After: 1\n"
     "Connection: close\n"
     "\n"
     "<html>\n"
@@ -64,6 +119,18 @@ static char *tooManyRequestResponseTemplate =
     " </body>\n"
     "</html>\n";
 
+static char *serviceUnavailableResponseTemplate =
+    "HTTP/1.1 503 Service Unavailable\n"
+    "Content-type: text/html; charset=UTF-8\n"
+    "Retry-After: 1\n"
+    "Connection: close\n"
+    "\n"
+    "<html>\n"
+    " <body>\n"
+    "  <h1>Service Unavailable</h1>\n"
+    " </body>\n"
+    "</html>\n";
+
 static char *notFoundResponseTemplate =
     "HTTP/1.1 404 Not Found\n"
     "Content-type: text/html; charset=UTF-8\n"
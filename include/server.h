@@ -5,9 +5,30 @@
 #define REQUEST_PATH_MAX_SIZE 4096
 #define BUFFER_REQUEST_SIZE 1024
 #define BUFFER_RESPONSE_SIZE 4096
-#define MAX_CONNECTIONS 1024
-#define KEEP_ALIVE_TIMEOUT 60 // seconds
-#define MAX_EPOLL_EVENTS 1024
+#define RESPONSE_HEADERS_MAX_SIZE 512 // room in the response buffer to queue one more pipelined response
+#define RESPONSE_INLINE_BODY_MAX_SIZE 1024 // bodies copied after the headers, sent in the same packet
+#define BUFFER_POOL_CHUNK_SIZE 64 // buffers allocated at once by the pools of every thread
+#define MAX_CONNECTIONS 65536 // by default, per process (--max-connections)
+#define RESERVED_FDS 64       // listeners, epoll, logger, files of the responses...
+#define KEEP_ALIVE_TIMEOUT 60 // seconds by default (--keep-alive-timeout), shorter when the connections fill the thread
+#define KEEP_ALIVE_REQUESTS 1000 // responses of a connection by default (--keep-alive-requests)
+#define HEADER_READ_TIMEOUT 10 // seconds to receive the complete request headers (slowloris)
+#define SEND_STALL_TIMEOUT 30  // seconds without sending any byte of the response
+#define MAX_EPOLL_EVENTS 1024 // events per epoll_wait, not a limit of connections
+#define ACCEPT_BATCH_SIZE 64 // max accepted connections per wakeup
+#define SEND_QUANTUM_SIZE 65536 // max bytes of one connection per turn of the event loop
+#define SEND_QUANTA_PER_ITERATION 16 // scheduled transfers resumed between two epoll_wait
+#define BALANCE_THRESHOLD 16 // connections more than the least loaded thread before handing off (--balance)
+#define BALANCE_STEAL_BATCH 64 // max connections given to an idle thread at once
+#define BALANCE_STEAL_INTERVAL 1000 // milliseconds between two steal requests of an idle thread
+#define CODEL_INTERVAL 100 // milliseconds above --codel-target before shedding the new connections
+#define IO_POOL_READAHEAD_SIZE 1048576 // bytes of a file read into the page cache by one job of the I/O threads
+#define IO_POOL_READ_SIZE 65536 // buffer of the reads of an I/O thread
+#define PREFORK_MIN_UPTIME 5 // seconds a worker has to live for its respawn not to be delayed (--workers)
+#define PREFORK_MAX_RESPAWN_DELAY 30 // seconds, the longest delay of the respawn of a failing worker
+#define PREFORK_STOP_TIMEOUT 5 // seconds for the workers to exit after SIGINT before SIGKILL
+#define DRAIN_TIMEOUT 30 // seconds for the connections to finish after SIGQUIT or an upgrade, then they are closed
+#define CLIENT_LIMITS_ENTRIES 65536 // client addresses tracked by --client-rate and --client-connections
 
 // TCP Keep Alive, TCP and HTTP keep-alive are different
 // https://stackoverflow.com/questions/411460/use-http-keep-alive-for-server-to-communicate-to-client
@@ -31,8 +52,15 @@
 
 
 extern volatile sig_atomic_t sigintReceived;
+extern volatile sig_atomic_t sigquitReceived; // graceful stop: no new connections, drain the current ones
+extern volatile sig_atomic_t dumpStatsReceived; // SIGUSR1: dump the loop stats to the log
 
 void serverRun(struct Options options);
+int createServerSocket(struct Options options);
+void prepareInheritedSocket(int socketServerFd);
+void raiseFileDescriptorsLimit(int maxConnections);
+void steerServerSocketToCpu(int socketServerFd, int cpu);
+void steerReuseportGroup(int socketServerFd, const int *threadCpus, int nSockets);
 
 int makeSocketNonBlocking(int sfd);
 void makeTCPKeepAlive(int socketFd);
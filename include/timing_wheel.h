@@ -0,0 +1,62 @@
+#ifndef TIMING_WHEEL_H
+#define TIMING_WHEEL_H
+
+#include <stdbool.h> // for bool
+#include <stddef.h>  // for size_t
+#include <stdint.h>  // for uint32_t
+
+#define TIMING_WHEEL_TICK_MS 10 // resolution of the deadlines
+#define TIMING_WHEEL_BITS 6
+#define TIMING_WHEEL_SLOTS (1 << TIMING_WHEEL_BITS) // 64 slots per level
+#define TIMING_WHEEL_MASK (TIMING_WHEEL_SLOTS - 1)
+#define TIMING_WHEEL_LEVELS 4 // 64^4 ticks of 10 ms, ~46 hours
+
+#define TIMER_HANDLE_NONE UINT32_MAX
+
+enum TimerKind {
+    TIMER_KIND_NONE,
+    TIMER_KIND_IDLE,        // keep-alive connection waiting for the next request
+    TIMER_KIND_HEADER_READ, // request headers not complete yet (slowloris)
+    TIMER_KIND_SEND_STALL,  // response without progress, the client doesn't read
+    TIMER_KIND_SEND_PACING, // response throttled by the bandwidth limits, resumed instead of closed
+};
+
+static const char *timerKindList[] = {"NONE", "IDLE", "HEADER_READ", "SEND_STALL", "SEND_PACING"};
+
+// 16 bytes, linked by handles (index in the timers array of the wheel) instead of pointers
+struct TimerType {
+    uint32_t next;
+    uint32_t prev;
+    uint32_t expires; // tick, modulo 2^32
+    uint8_t kind;     // enum TimerKind
+    uint8_t level;
+    uint8_t slot;
+    bool active;
+};
+
+/**
+ * Hierarchical timing wheel: level 0 has one slot per tick, every slot of the level n covers
+ * 64^n ticks and is cascaded to the lower level when the wheel reaches it.
+ * Insert, reset and remove are O(1). The timers are a dense array indexed by the handle of their
+ * owner (the slot of the connection), the records of the owners are never touched nor moved.
+ */
+struct TimingWheelType {
+    unsigned long long currentTick;
+    size_t count;
+    struct TimerType *timers;
+    uint32_t timersCount;
+    uint32_t slots[TIMING_WHEEL_LEVELS][TIMING_WHEEL_SLOTS]; // list heads
+};
+
+unsigned long long monotonicMilliseconds();
+
+void initTimingWheel(struct TimingWheelType *timingWheel, unsigned long long nowMs);
+void freeTimingWheel(struct TimingWheelType *timingWheel);
+bool growTimingWheel(struct TimingWheelType *timingWheel, uint32_t timersCount);
+void addTimer(struct TimingWheelType *timingWheel, uint32_t handle, unsigned long long expiresMs, enum TimerKind kind);
+void removeTimer(struct TimingWheelType *timingWheel, uint32_t handle);
+void resetTimer(struct TimingWheelType *timingWheel, uint32_t handle, unsigned long long expiresMs, enum TimerKind kind);
+uint32_t expireTimers(struct TimingWheelType *timingWheel, unsigned long long nowMs);
+int nextTimerTimeout(struct TimingWheelType *timingWheel, unsigned long long nowMs);
+
+#endif // TIMING_WHEEL_H
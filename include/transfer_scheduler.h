@@ -0,0 +1,29 @@
+#ifndef TRANSFER_SCHEDULER_H
+#define TRANSFER_SCHEDULER_H
+
+#include <stdbool.h> // for bool
+#include <stddef.h>  // for size_t
+
+// 16 bytes, the connection is found by its slot
+struct TransferType {
+    size_t remaining; // bytes left in the output queue, the priority
+    int slot;
+};
+
+/**
+ * Transfers that used their send quantum with the socket still writable: edge triggered epoll will not
+ * report them again, so the event loop resumes them, the shortest remaining first.
+ * Binary min-heap, it grows on demand.
+ */
+struct TransferSchedulerType {
+    struct TransferType *heap;
+    int count;
+    int capacity;
+};
+
+void initTransferScheduler(struct TransferSchedulerType *scheduler);
+void freeTransferScheduler(struct TransferSchedulerType *scheduler);
+bool scheduleTransfer(struct TransferSchedulerType *scheduler, int slot, size_t remaining);
+bool nextTransfer(struct TransferSchedulerType *scheduler, int *slot);
+
+#endif // TRANSFER_SCHEDULER_H
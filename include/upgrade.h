@@ -0,0 +1,23 @@
+#ifndef UPGRADE_H
+#define UPGRADE_H
+
+#include <stdbool.h> // for bool
+
+#define UPGRADE_LISTEN_FDS_START 3 // first descriptor passed by the socket activation (SD_LISTEN_FDS_START)
+#define UPGRADE_RECEIVE_TIMEOUT 5  // seconds for the running server to send its listener
+
+// the socket where the running server gives its listener to the new binary (--upgrade-socket)
+struct UpgradeType {
+    int fd; // -1 without --upgrade-socket, and in the workers
+    bool handedOver;
+};
+
+extern struct UpgradeType UPGRADE;
+
+int getActivationListener();
+int receiveUpgradeListener(const char *path);
+void openUpgradeSocket(const char *path);
+void closeUpgradeSocket(const char *path);
+void waitUpgrade(int socketServerFd, int timeout);
+
+#endif // UPGRADE_H
@@ -1,4 +1,3 @@
-#include <aio.h>
 #include <errno.h>
 #include <fcntl.h> // for open() nonblocking socket
 #include <stdarg.h>
@@ -183,30 +182,10 @@ void logMessage(enum LOG_LEVEL level, bool showErrno, char *codeFileName, int co
 
     // TODO: truncate message if it is too long (lenFullMessage > LOGGER_MAX_MESSAGE_LENGTH)
 
-    struct aiocb *aiocbp;
-    aiocbp = malloc(sizeof(struct aiocb));
-    memset(aiocbp, 0, sizeof(struct aiocb));
-    aiocbp->aio_fildes = fileFd;
-    aiocbp->aio_buf = fullMessage;
-    aiocbp->aio_nbytes = lenFullMessage;
-    aiocbp->aio_sigevent.sigev_notify = SIGEV_NONE;
-
-    if (aio_write(aiocbp) == -1) {
-        die("aio_write: Error writing to logger file");
-    }
-
-    while (aio_error(aiocbp) == EINPROGRESS) {
-        // wait until the write is done
+    // a plain write: the glibc aio helper threads do not survive a fork, the workers of --workers would hang
+    if (writeAll(fileFd, fullMessage, lenFullMessage) == -1) {
+        fprintf(stderr, "%s", "write: Error writing to logger file");
     }
-    int loggerWriteResult = aio_return(aiocbp);
-    free(aiocbp);
-    if (loggerWriteResult == -1) {
-        fprintf(stderr, "%s", "aio_return: Error writing to logger file");
-    }
-
-   /*  if (writeAll(fileFd, fullMessage, lenFullMessage) == -1) {
-        die("Error writing to logger file");
-    } */
 }
 
 /**
@@ -221,7 +200,7 @@ void logMessage(enum LOG_LEVEL level, bool showErrno, char *codeFileName, int co
 size_t writeAll(int fd, const void *buffer, size_t count) {
     size_t left_to_write = count;
     while (left_to_write > 0) {
-        size_t written = write(fd, buffer, count);
+        ssize_t written = write(fd, (const char *)buffer + (count - left_to_write), left_to_write);
         if (written == -1) {
             if (errno == EINTR) {
                 // The call was interrupted by a signal
@@ -229,7 +208,7 @@ size_t writeAll(int fd, const void *buffer, size_t count) {
             }
             return -1;
         } else {
-            left_to_write -= written;
+            left_to_write -= (size_t)written;
         }
     }
     return count;
@@ -0,0 +1,70 @@
+#include <stdlib.h> // for malloc()
+
+#include "./pool.h"
+
+void poolInit(struct Pool *pool, size_t objectSize, size_t objectsPerChunk) {
+    // room for the free list pointer, and aligned for any object
+    if (objectSize < sizeof(void *)) {
+        objectSize = sizeof(void *);
+    }
+    pool->objectSize = (objectSize + sizeof(max_align_t) - 1) & ~(sizeof(max_align_t) - 1);
+    pool->objectsPerChunk = objectsPerChunk;
+    pool->freeList = NULL;
+    pool->chunks = NULL;
+    pool->chunksCount = 0;
+    pool->inUse = 0;
+}
+
+void poolDestroy(struct Pool *pool) {
+    size_t i;
+    for (i = 0; i < pool->chunksCount; i++) {
+        free(pool->chunks[i]);
+    }
+    free(pool->chunks);
+    pool->chunks = NULL;
+    pool->chunksCount = 0;
+    pool->freeList = NULL;
+    pool->inUse = 0;
+}
+
+static int poolGrow(struct Pool *pool) {
+    void **chunks = realloc(pool->chunks, (pool->chunksCount + 1) * sizeof(void *));
+    if (chunks == NULL) {
+        return -1;
+    }
+    pool->chunks = chunks;
+    char *chunk = malloc(pool->objectSize * pool->objectsPerChunk);
+    if (chunk == NULL) {
+        return -1;
+    }
+    pool->chunks[pool->chunksCount] = chunk;
+    pool->chunksCount++;
+
+    size_t i;
+    for (i = pool->objectsPerChunk; i > 0; i--) {
+        void *object = chunk + (i - 1) * pool->objectSize;
+        *(void **)object = pool->freeList;
+        pool->freeList = object;
+    }
+    return 0;
+}
+
+// NULL if there is no memory
+void *poolAcquire(struct Pool *pool) {
+    if (pool->freeList == NULL && poolGrow(pool) == -1) {
+        return NULL;
+    }
+    void *object = pool->freeList;
+    pool->freeList = *(void **)object;
+    pool->inUse++;
+    return object;
+}
+
+void poolRelease(struct Pool *pool, void *object) {
+    if (object == NULL) {
+        return;
+    }
+    *(void **)object = pool->freeList;
+    pool->freeList = object;
+    pool->inUse--;
+}
@@ -0,0 +1,24 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h> // for size_t
+
+/**
+ * Free list of fixed size objects, allocated by chunks and never returned to the allocator
+ * until poolDestroy. Not thread safe: one pool per thread.
+ */
+struct Pool {
+    size_t objectSize;
+    size_t objectsPerChunk;
+    void *freeList; // the first bytes of a free object point to the next free object
+    void **chunks;
+    size_t chunksCount;
+    size_t inUse;
+};
+
+void poolInit(struct Pool *pool, size_t objectSize, size_t objectsPerChunk);
+void poolDestroy(struct Pool *pool);
+void *poolAcquire(struct Pool *pool);
+void poolRelease(struct Pool *pool, void *object);
+
+#endif // POOL_H
@@ -0,0 +1,265 @@
+#include <errno.h>
+#include <signal.h>      // for _NSIG
+#include <stdatomic.h>   // for atomic_load_explicit()
+#include <stdlib.h>      // for malloc()
+#include <string.h>      // for memset()
+#include <sys/mman.h>    // for mmap()
+#include <sys/syscall.h> // for __NR_io_uring_setup
+#include <unistd.h>      // for syscall()
+
+#include "./uring.h"
+
+#define URING_LOAD_ACQUIRE(p) atomic_load_explicit((_Atomic unsigned int *)(p), memory_order_acquire)
+#define URING_STORE_RELEASE(p, v) atomic_store_explicit((_Atomic unsigned int *)(p), (v), memory_order_release)
+
+static int uringSetup(unsigned int entries, struct io_uring_params *params) {
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int uringEnter(int ringFd, unsigned int toSubmit, unsigned int minComplete, unsigned int flags, void *arg,
+                      size_t argSize) {
+    return (int)syscall(__NR_io_uring_enter, ringFd, toSubmit, minComplete, flags, arg, argSize);
+}
+
+static int uringRegister(int ringFd, unsigned int opcode, void *arg, unsigned int nrArgs) {
+    return (int)syscall(__NR_io_uring_register, ringFd, opcode, arg, nrArgs);
+}
+
+/**
+ * @brief Create the ring and map the submission and completion queues
+ *
+ * @return 0 on success, -1 and errno on failure (ENOSYS or EPERM if io_uring is not available)
+ */
+int uringInit(struct Uring *ring, unsigned int entries) {
+    memset(ring, 0, sizeof(struct Uring));
+
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int ringFd = uringSetup(entries, &params);
+    if (ringFd < 0) {
+        return -1;
+    }
+
+    ring->ringFd = ringFd;
+    ring->features = params.features;
+    ring->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    ring->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cqRingSize > ring->sqRingSize) {
+            ring->sqRingSize = ring->cqRingSize;
+        }
+        ring->cqRingSize = ring->sqRingSize;
+    }
+
+    ring->sqRing = mmap(NULL, ring->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd,
+                        IORING_OFF_SQ_RING);
+    if (ring->sqRing == MAP_FAILED) {
+        close(ringFd);
+        return -1;
+    }
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cqRing = ring->sqRing;
+    } else {
+        ring->cqRing = mmap(NULL, ring->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd,
+                            IORING_OFF_CQ_RING);
+        if (ring->cqRing == MAP_FAILED) {
+            munmap(ring->sqRing, ring->sqRingSize);
+            close(ringFd);
+            return -1;
+        }
+    }
+
+    ring->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        if (ring->cqRing != ring->sqRing) {
+            munmap(ring->cqRing, ring->cqRingSize);
+        }
+        munmap(ring->sqRing, ring->sqRingSize);
+        close(ringFd);
+        return -1;
+    }
+
+    char *sq = ring->sqRing;
+    ring->sqHead = (unsigned int *)(sq + params.sq_off.head);
+    ring->sqTail = (unsigned int *)(sq + params.sq_off.tail);
+    ring->sqMask = (unsigned int *)(sq + params.sq_off.ring_mask);
+    ring->sqArray = (unsigned int *)(sq + params.sq_off.array);
+    ring->sqEntries = params.sq_entries;
+    ring->sqLocalTail = *ring->sqTail;
+
+    char *cq = ring->cqRing;
+    ring->cqHead = (unsigned int *)(cq + params.cq_off.head);
+    ring->cqTail = (unsigned int *)(cq + params.cq_off.tail);
+    ring->cqMask = (unsigned int *)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+    return 0;
+}
+
+void uringExit(struct Uring *ring) {
+    munmap(ring->sqes, ring->sqesSize);
+    if (ring->cqRing != ring->sqRing) {
+        munmap(ring->cqRing, ring->cqRingSize);
+    }
+    munmap(ring->sqRing, ring->sqRingSize);
+    close(ring->ringFd);
+}
+
+bool uringSupportsOperation(struct Uring *ring, int operation) {
+    size_t probeSize = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = calloc(1, probeSize);
+    if (probe == NULL) {
+        return false;
+    }
+    bool supported = false;
+    if (uringRegister(ring->ringFd, IORING_REGISTER_PROBE, probe, 256) == 0 && operation <= probe->last_op) {
+        supported = (probe->ops[operation].flags & IO_URING_OP_SUPPORTED) != 0;
+    }
+    free(probe);
+    return supported;
+}
+
+/**
+ * @brief Get a free submission entry, submitting the pending ones if the queue is full
+ *
+ * @return NULL only if the kernel does not consume any entry
+ */
+struct io_uring_sqe *uringGetSqe(struct Uring *ring) {
+    unsigned int head = URING_LOAD_ACQUIRE(ring->sqHead);
+    if (ring->sqLocalTail - head >= ring->sqEntries) {
+        if (uringSubmit(ring) < 0) {
+            return NULL;
+        }
+        head = URING_LOAD_ACQUIRE(ring->sqHead);
+        if (ring->sqLocalTail - head >= ring->sqEntries) {
+            return NULL;
+        }
+    }
+    unsigned int index = ring->sqLocalTail & *ring->sqMask;
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    ring->sqArray[index] = index;
+    ring->sqLocalTail++;
+    ring->sqToSubmit++;
+    return sqe;
+}
+
+static void uringFlushSq(struct Uring *ring) {
+    URING_STORE_RELEASE(ring->sqTail, ring->sqLocalTail);
+}
+
+int uringSubmit(struct Uring *ring) {
+    return uringSubmitAndWait(ring, 0, NULL);
+}
+
+/**
+ * @brief Submit all the prepared entries and wait for waitNr completions in the same system call
+ *
+ * @param timeout NULL to wait forever
+ * @return the number of entries submitted, -1 and errno (EINTR, ETIME) on failure
+ */
+int uringSubmitAndWait(struct Uring *ring, unsigned int waitNr, struct timespec *timeout) {
+    uringFlushSq(ring);
+    unsigned int toSubmit = ring->sqToSubmit;
+    unsigned int flags = waitNr > 0 ? IORING_ENTER_GETEVENTS : 0;
+
+    if (toSubmit == 0 && waitNr == 0) {
+        return 0;
+    }
+
+    int submitted;
+    if (timeout != NULL && waitNr > 0 && (ring->features & IORING_FEAT_EXT_ARG)) {
+        struct __kernel_timespec ts = {.tv_sec = timeout->tv_sec, .tv_nsec = timeout->tv_nsec};
+        struct io_uring_getevents_arg arg;
+        memset(&arg, 0, sizeof(arg));
+        arg.ts = (unsigned long long)&ts;
+        submitted = uringEnter(ring->ringFd, toSubmit, waitNr, flags | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+    } else {
+        submitted = uringEnter(ring->ringFd, toSubmit, waitNr, flags, NULL, _NSIG / 8);
+    }
+
+    // the kernel consumes the entries before waiting, even if the wait is interrupted (EINTR, ETIME)
+    ring->sqToSubmit = ring->sqLocalTail - URING_LOAD_ACQUIRE(ring->sqHead);
+    return submitted;
+}
+
+struct io_uring_cqe *uringPeekCqe(struct Uring *ring) {
+    unsigned int head = *ring->cqHead;
+    if (head == URING_LOAD_ACQUIRE(ring->cqTail)) {
+        return NULL;
+    }
+    return &ring->cqes[head & *ring->cqMask];
+}
+
+void uringCqeSeen(struct Uring *ring) {
+    URING_STORE_RELEASE(ring->cqHead, *ring->cqHead + 1);
+}
+
+/**
+ * @brief Register a ring of bufferSize buffers that the kernel selects for IOSQE_BUFFER_SELECT operations (5.19+)
+ *
+ * @param entries power of 2
+ * @return 0 on success, -1 and errno on failure
+ */
+int uringRegisterBufferRing(struct Uring *ring, struct UringBufferRing *bufferRing, unsigned int entries,
+                            unsigned int bufferSize, unsigned short groupId) {
+    memset(bufferRing, 0, sizeof(struct UringBufferRing));
+
+    bufferRing->ringSize = entries * sizeof(struct io_uring_buf);
+    void *ringMemory =
+        mmap(NULL, bufferRing->ringSize, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if (ringMemory == MAP_FAILED) {
+        return -1;
+    }
+    bufferRing->buffers = malloc((size_t)entries * bufferSize);
+    if (bufferRing->buffers == NULL) {
+        munmap(ringMemory, bufferRing->ringSize);
+        return -1;
+    }
+    bufferRing->ring = ringMemory;
+    bufferRing->entries = entries;
+    bufferRing->bufferSize = bufferSize;
+    bufferRing->groupId = groupId;
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (unsigned long long)ringMemory;
+    reg.ring_entries = entries;
+    reg.bgid = groupId;
+    if (uringRegister(ring->ringFd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        free(bufferRing->buffers);
+        munmap(ringMemory, bufferRing->ringSize);
+        return -1;
+    }
+
+    for (unsigned int i = 0; i < entries; i++) {
+        uringRecycleBuffer(bufferRing, (unsigned short)i);
+    }
+
+    return 0;
+}
+
+void uringUnregisterBufferRing(struct Uring *ring, struct UringBufferRing *bufferRing) {
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.bgid = bufferRing->groupId;
+    uringRegister(ring->ringFd, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+    free(bufferRing->buffers);
+    munmap(bufferRing->ring, bufferRing->ringSize);
+}
+
+char *uringBuffer(struct UringBufferRing *bufferRing, unsigned short bufferId) {
+    return bufferRing->buffers + (size_t)bufferId * bufferRing->bufferSize;
+}
+
+// give the buffer back to the kernel
+void uringRecycleBuffer(struct UringBufferRing *bufferRing, unsigned short bufferId) {
+    unsigned short tail = bufferRing->ring->tail;
+    struct io_uring_buf *buf = &bufferRing->ring->bufs[tail & (bufferRing->entries - 1)];
+    buf->addr = (unsigned long long)uringBuffer(bufferRing, bufferId);
+    buf->len = bufferRing->bufferSize;
+    buf->bid = bufferId;
+    atomic_store_explicit((_Atomic unsigned short *)&bufferRing->ring->tail, (unsigned short)(tail + 1),
+                          memory_order_release);
+}
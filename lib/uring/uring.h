@@ -0,0 +1,67 @@
+#ifndef URING_H
+#define URING_H
+
+#include <linux/io_uring.h> // for struct io_uring_sqe, struct io_uring_cqe
+#include <stdbool.h>        // for bool
+#include <stddef.h>         // for size_t
+#include <time.h>           // for struct timespec
+
+/**
+ * Minimal io_uring wrapper over the raw system calls (without liburing).
+ *
+ * https://kernel.dk/io_uring.pdf
+ * https://man7.org/linux/man-pages/man7/io_uring.7.html
+ */
+
+struct Uring {
+    int ringFd;
+    unsigned int features;
+    // submission queue
+    unsigned int *sqHead;
+    unsigned int *sqTail;
+    unsigned int *sqMask;
+    unsigned int *sqArray;
+    unsigned int sqEntries;
+    unsigned int sqLocalTail; // prepared but not submitted
+    unsigned int sqToSubmit;
+    struct io_uring_sqe *sqes;
+    // completion queue
+    unsigned int *cqHead;
+    unsigned int *cqTail;
+    unsigned int *cqMask;
+    struct io_uring_cqe *cqes;
+    // mmap regions
+    void *sqRing;
+    size_t sqRingSize;
+    void *cqRing;
+    size_t cqRingSize;
+    size_t sqesSize;
+};
+
+// Ring of provided buffers (IORING_REGISTER_PBUF_RING), the kernel picks one when the data arrives
+struct UringBufferRing {
+    struct io_uring_buf_ring *ring;
+    size_t ringSize;
+    char *buffers;
+    unsigned int entries;
+    unsigned int bufferSize;
+    unsigned short groupId;
+};
+
+int uringInit(struct Uring *ring, unsigned int entries);
+void uringExit(struct Uring *ring);
+bool uringSupportsOperation(struct Uring *ring, int operation);
+
+struct io_uring_sqe *uringGetSqe(struct Uring *ring);
+int uringSubmit(struct Uring *ring);
+int uringSubmitAndWait(struct Uring *ring, unsigned int waitNr, struct timespec *timeout);
+struct io_uring_cqe *uringPeekCqe(struct Uring *ring);
+void uringCqeSeen(struct Uring *ring);
+
+int uringRegisterBufferRing(struct Uring *ring, struct UringBufferRing *bufferRing, unsigned int entries,
+                            unsigned int bufferSize, unsigned short groupId);
+void uringUnregisterBufferRing(struct Uring *ring, struct UringBufferRing *bufferRing);
+char *uringBuffer(struct UringBufferRing *bufferRing, unsigned short bufferId);
+void uringRecycleBuffer(struct UringBufferRing *bufferRing, unsigned short bufferId);
+
+#endif // URING_H
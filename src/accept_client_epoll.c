@@ -1,66 +1,133 @@
-#include <arpa/inet.h> // for inet_ntoa()
+#include <arpa/inet.h> // for ntohs()
 #include <errno.h>     // for errno
 #include <netdb.h>     // for getaddrinfo() and getservbyname
 #include <stdio.h>     // for fprintf()
 #include <stdlib.h>    // for exit()
 #include <string.h>    // for strlen()
+#include <sys/timerfd.h> // for timerfd_create()
 #include <unistd.h>    // for close()
 
 #include "../lib/die/die.h"
 #include "../lib/logger/logger.h"
 #include "accept_client_epoll.h"
+#include "balancer.h"
+#include "bandwidth.h"
+#include "busy_poll.h"
+#include "client_limits.h"
 #include "helper.h"
+#include "io_pool.h"
+#include "keep_alive.h"
 #include "options.h"
 #include "queue_connections.h"
 #include "request.h"
 #include "response.h"
 #include "server.h"
 
-static pthread_mutex_t queueMutex = PTHREAD_MUTEX_INITIALIZER;
+void handleEpoll(int socketServerFd, int epollFd, int maxConnections, int worker, bool ownListener) {
 
-void handleEpoll(int socketServerFd, int epollFd) {
-
-    // Only one event array and priority queue per thread
+    // Only one event array and connections queue per thread
     struct epoll_event events[MAX_EPOLL_EVENTS];
-    struct QueueConnectionsType queueConnections = createQueueConnections();
+    struct QueueConnectionsType queueConnections;
+    initQueueConnections(&queueConnections, maxConnections);
 
     long int threadId = pthread_self();
 
+    int timerFd = -1;
+    unsigned long long timerFdDeadline = 0; // 0 disarmed
+    if (OPTIONS.timerFd) {
+        timerFd = createEpollTimerFd(epollFd);
+    }
+
+    queueConnections.worker = worker;
+    unsigned long long nextStealRequest = 0;
+    if (worker != BALANCER_NO_WORKER) {
+        addEpollClient(epollFd, getBalancerEventFd(worker), EPOLLIN, EPOLL_TAG_INBOX);
+    }
+
+    struct IoCompletionsType ioCompletions;
+    if (IO_POOL.count > 0) {
+        initIoCompletions(&ioCompletions);
+        queueConnections.ioCompletions = &ioCompletions;
+        addEpollClient(epollFd, ioCompletions.eventFd, EPOLLIN, EPOLL_TAG_IO);
+    }
+
+    queueConnections.loopStats = registerLoopStats(threadId);
+    unsigned long long iterationStart = 0; // return of the last epoll_wait
+    int iterationEvents = 0;
+
     while (!sigintReceived) {
-        // calculate epoll timeout
-        time_t now = time(NULL);
-        int timeout = -1;
-        struct QueueConnectionElementType *firstConnectionQueueElement = peekQueueConnections(&queueConnections);
-        if (firstConnectionQueueElement != NULL) {
-            if (firstConnectionQueueElement->clientFd != 0) {
-                timeout = (now - firstConnectionQueueElement->priorityTime) * 1000;
-            }
-            // check for CLOSE client connection by time_t
-            while (firstConnectionQueueElement != NULL && firstConnectionQueueElement->clientFd != 0
-                   && difftime(now, firstConnectionQueueElement->priorityTime) >= KEEP_ALIVE_TIMEOUT) {
-                logDebug(
-                    RED "Start dequeue on thread %ld, fd %i" RESET, threadId, firstConnectionQueueElement->clientFd);
-                int tempClientFd = firstConnectionQueueElement->clientFd;
-                char date[DATETIME_HELPER_SIZE];
-                timeToDatetimeString(firstConnectionQueueElement->priorityTime, date);
-                logDebug("Close by timeout with thread %ld, fd %i tempFd %i, dateTime %s",
-                         threadId,
-                         firstConnectionQueueElement->clientFd,
-                         tempClientFd,
-                         date);
-                pthread_mutex_lock(&queueMutex);
-                if (existsConnection(&queueConnections, tempClientFd)) {
-                    dequeueConnectionByFd(&queueConnections, tempClientFd);
-                    closeEpollClient(epollFd, tempClientFd);
+        if (sigquitReceived && !queueConnections.draining) {
+            drainEpollConnections(epollFd, socketServerFd, ownListener, &queueConnections);
+        }
+        if (queueConnections.draining && queueConnections.currentSize == 0) {
+            break;
+        }
+
+        // close the connections whose deadline expired, resume the throttled ones
+        unsigned long long now = monotonicMilliseconds();
+        uint32_t handle = expireTimers(&queueConnections.timingWheel, now);
+        while (handle != TIMER_HANDLE_NONE) {
+            struct TimerType *timer = &queueConnections.timingWheel.timers[handle];
+            uint32_t nextHandle = timer->next;
+            struct QueueConnectionElementType *connection = getConnectionBySlot(&queueConnections, (int)handle);
+            int tempClientFd = connection->clientFd;
+            if (timer->kind == TIMER_KIND_SEND_PACING) {
+                setConnectionDeadline(&queueConnections, connection, TIMER_KIND_SEND_STALL);
+                connection->transferScheduled = scheduleTransfer(&queueConnections.transfers,
+                                                                 connection->slot,
+                                                                 getOutputQueueLength(connection->request->output));
+                if (connection->transferScheduled) {
+                    handle = nextHandle;
+                    continue;
                 }
-                pthread_mutex_unlock(&queueMutex);
-                firstConnectionQueueElement = peekQueueConnections(&queueConnections);
             }
+            logDebug("Close by %s timeout with thread %ld, fd %i", timerKindList[timer->kind], threadId, tempClientFd);
+            dequeueConnection(&queueConnections, connection);
+            closeEpollClient(epollFd, tempClientFd);
+            handle = nextHandle;
         }
 
-        int i, readyEventClients;
         // -1 block forever, 0 non-blocking, > 0 timeout in milliseconds
-        readyEventClients = epoll_wait(epollFd, events, MAX_EPOLL_EVENTS, timeout);
+        int timeout = nextTimerTimeout(&queueConnections.timingWheel, now);
+        if (timerFd != -1) {
+            // the timerfd is only rearmed when the next deadline changes
+            unsigned long long deadline = timeout == -1 ? 0 : now + (unsigned long long)timeout;
+            if (deadline != timerFdDeadline) {
+                armEpollTimerFd(timerFd, timeout);
+                timerFdDeadline = deadline;
+            }
+            timeout = -1;
+        }
+
+        if (worker != BALANCER_NO_WORKER) {
+            publishWorkerLoad(worker, queueConnections.currentSize);
+            if (now >= nextStealRequest && !queueConnections.draining) {
+                requestSteal(worker, queueConnections.currentSize);
+                nextStealRequest = now + BALANCE_STEAL_INTERVAL;
+            }
+            // an idle thread wakes up to ask for connections again
+            if (timeout == -1 || timeout > BALANCE_STEAL_INTERVAL) {
+                timeout = BALANCE_STEAL_INTERVAL;
+            }
+        }
+
+        if (queueConnections.transfers.count > 0) {
+            // only poll, the scheduled transfers are still writable
+            timeout = 0;
+        }
+
+        bool inboxReady = false;
+        bool ioReady = false;
+        int i, readyEventClients;
+        if (iterationStart != 0) {
+            recordLoopIteration(queueConnections.loopStats, iterationStart, iterationEvents);
+            iterationStart = 0;
+        }
+        readyEventClients = busyPollEpoll(epollFd, events, MAX_EPOLL_EVENTS, timeout);
+        if (queueConnections.loopStats != NULL) {
+            iterationStart = monotonicMicroseconds();
+            iterationEvents = readyEventClients > 0 ? readyEventClients : 0;
+        }
         if (readyEventClients < 0) {
             if (errno == EINTR) {
                 // avoid error when we receive a signal
@@ -69,105 +136,363 @@ void handleEpoll(int socketServerFd, int epollFd) {
             logWarning("epoll_wait failed");
         }
         for (i = 0; i < readyEventClients; i++) {
-            if (events[i].data.fd == socketServerFd) {
+            if (events[i].data.ptr == EPOLL_TAG_LISTENER) {
                 logDebug("Accepting new connection in the thread %ld", threadId);
-                acceptEpollConnection(epollFd, socketServerFd, EPOLLIN | EPOLLET | EPOLLONESHOT);
-            } else if (events[i].events & EPOLLIN) {
-
-                int clientFd = events[i].data.fd;
-                struct QueueConnectionElementType *connection = getConnectionOrCreateByFd(&queueConnections, clientFd);
-
-                // simple state machine
-                bool repeat;
-                do {
-                    repeat = true;
-                    switch (connection->state) {
-                        case STATE_CONNECTION_RECV: {
-                            logDebug("STATE_CONNECTION_RECV with fd %i and threadID %ld", clientFd, threadId);
-                            recvRequest(connection);
-                            break;
-                        }
-                        case STATE_CONNECTION_SEND_HEADERS: {
-                            logDebug("STATE_CONNECTION_SEND_HEADERS with fd %i and threadID %ld", clientFd, threadId);
-                            if (connection->requestHeaders == NULL) {
-                                logDebug("processRequest with fd %i", clientFd);
-                                bool isValidRequest = processRequest(connection);
-
-                                if (!isValidRequest) {
-                                    logDebug(RED "badRequestResponse with fd %i" RESET, clientFd);
-                                    badRequestResponse(clientFd);
-                                    logRequest(*connection);
-                                    connection->state = STATE_CONNECTION_DONE_FOR_CLOSE;
-                                    break;
-                                }
-                                // check supported protocol
-                                char *protocol = connection->protocolVersion;
-                                if (strcmp(protocol, "HTTP/1.0") != 0 && strcmp(protocol, "HTTP/1.1") != 0) {
-                                    unsupportedProtocolResponse(clientFd, protocol);
-                                    logRequest(*connection);
-                                    connection->state = STATE_CONNECTION_DONE_FOR_CLOSE;
-                                    break;
-                                }
-
-                                // hello response
-                                if (strcmp(connection->path, "/hello") == 0) {
-                                    helloResponse(clientFd);
-                                    logRequest(*connection);
-                                    connection->state = STATE_CONNECTION_DONE_FOR_CLOSE;
-                                    break;
-                                }
-                            }
-                            if (connection->responseBufferHeaders == NULL) {
-                                makeResponse(connection);
-                            }
-
-                            sendResponseHeaders(connection);
-                            break;
-                        }
-                        case STATE_CONNECTION_SEND_BODY: {
-                            logDebug("STATE_CONNECTION_SEND_BODY with fd %i and threadID %ld", clientFd, threadId);
-                            sendResponseFile(connection);
-                            break;
-                        }
-                        case STATE_CONNECTION_DONE: {
-                            logDebug("STATE_CONNECTION_DONE with fd %i and threadID %ld", clientFd, threadId);
-                            logRequest(*connection);
-                            if (connection->keepAlive == true) {
-                                // rearm the file descriptor with a new event mask
-                                // EPOLL_CTL_MOD with EPOLLONESHOT, only when the event is full processed
-                                pthread_mutex_lock(&queueMutex);
-                                if (existsConnection(&queueConnections, clientFd)) {
-                                    updateQueueConnection(&queueConnections, clientFd);
-                                    modEpollClient(epollFd, clientFd, EPOLLIN | EPOLLET | EPOLLONESHOT);
-                                }
-                                pthread_mutex_unlock(&queueMutex);
-                                repeat = false;
-                            } else {
-                                connection->state = STATE_CONNECTION_DONE_FOR_CLOSE;
-                            }
-                            break;
-                        }
-                        case STATE_CONNECTION_DONE_FOR_CLOSE: {
-                            logDebug("STATE_CONNECTION_DONE_FOR_CLOSE with fd %i and threadID %ld", clientFd, threadId);
-                            if (existsConnection(&queueConnections, clientFd)) {
-                                dequeueConnectionByFd(&queueConnections, clientFd);
-                                closeEpollClient(epollFd, clientFd);
-                            }
+                acceptEpollConnection(epollFd, socketServerFd, EPOLLIN | EPOLLOUT | EPOLLET, &queueConnections);
+            } else if (events[i].data.ptr == EPOLL_TAG_TIMERFD) {
+                unsigned long long expirations;
+                if (read(timerFd, &expirations, sizeof(expirations)) == -1 && errno != EAGAIN) {
+                    logWarning("read timerfd failed");
+                }
+                timerFdDeadline = 0;
+            } else if (events[i].data.ptr == EPOLL_TAG_INBOX) {
+                // after the events, their connections must not move meanwhile
+                inboxReady = true;
+            } else if (events[i].data.ptr == EPOLL_TAG_IO) {
+                ioReady = true;
+            } else {
+
+                struct QueueConnectionElementType *connection = events[i].data.ptr;
+                if (connection->transferScheduled) {
+                    // the transfer scheduler resumes it in its turn
+                    continue;
+                }
+                if (connection->state == STATE_CONNECTION_RECV && !(events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP))) {
+                    // only writable, there is no response to resume
+                    continue;
+                }
+                handleEpollConnection(epollFd, &queueConnections, connection);
+            }
+        }
+
+        if (ioReady) {
+            receiveEpollIoCompletions(epollFd, &queueConnections);
+        }
+        resumeEpollTransfers(epollFd, &queueConnections);
+        if (inboxReady) {
+            receiveEpollHandoffs(epollFd, &queueConnections);
+        }
+
+        // printQueueConnections(queueConnections);
+    }
+
+    logDebug("sigIntReceived or drained in the thread %ld", threadId);
+    freeQueueConnections(&queueConnections);
+    if (queueConnections.ioCompletions != NULL) {
+        freeIoCompletions(&ioCompletions);
+    }
+    if (timerFd != -1) {
+        close(timerFd);
+    }
+}
+
+// state machine of a client connection, it runs until the connection has to wait for the socket
+void handleEpollConnection(int epollFd,
+                           struct QueueConnectionsType *queueConnections,
+                           struct QueueConnectionElementType *connection) {
+    long int threadId = pthread_self();
+    int clientFd = connection->clientFd;
+
+    struct LoopStatsType *loopStats = queueConnections->loopStats;
+    unsigned long long eventStart = 0;
+    enum stateConnection eventState = connection->state;
+    if (loopStats != NULL) {
+        startLoopEvent(loopStats, connection->state != STATE_CONNECTION_RECV ? connection->request->path : NULL);
+        eventStart = monotonicMicroseconds();
+    }
+
+    // simple state machine
+    bool repeat;
+    do {
+        repeat = true;
+        switch (connection->state) {
+            case STATE_CONNECTION_RECV: {
+                logDebug("STATE_CONNECTION_RECV with fd %i and threadID %ld", clientFd, threadId);
+                // the buffer is attached only when there is something to read
+                attachRequestBuffer(queueConnections, connection);
+                recvRequest(connection);
+                if (connection->state == STATE_CONNECTION_RECV) {
+                    // EAGAIN, wait for the next EPOLLIN
+                    if (connection->requestBufferOffset == 0) {
+                        releaseRequestBuffer(queueConnections, connection);
+                    } else if (getConnectionDeadline(queueConnections, connection) == TIMER_KIND_IDLE) {
+                        // the next request started, the headers have to arrive in time
+                        setConnectionDeadline(queueConnections, connection, TIMER_KIND_HEADER_READ);
+                    }
+                    repeat = false;
+                } else if (connection->state == STATE_CONNECTION_SEND_HEADERS) {
+                    setConnectionDeadline(queueConnections, connection, TIMER_KIND_SEND_STALL);
+                }
+                break;
+            }
+            case STATE_CONNECTION_SEND_HEADERS: {
+                logDebug("STATE_CONNECTION_SEND_HEADERS with fd %i and threadID %ld", clientFd, threadId);
+                processEpollRequests(queueConnections, connection);
+                break;
+            }
+            case STATE_CONNECTION_SEND_BODY: {
+                logDebug("STATE_CONNECTION_SEND_BODY with fd %i and threadID %ld", clientFd, threadId);
+                size_t quantum = SEND_QUANTUM_SIZE;
+                unsigned long long nowUs = 0;
+                if (BANDWIDTH.enabled) {
+                    nowUs = monotonicMicroseconds();
+                }
+                if (queueConnections->ioCompletions != NULL && !probeEpollOutputFile(queueConnections, connection)) {
+                    // the next bytes of the file are not in the page cache, sendfile would block
+                    repeat = false;
+                    break;
+                }
+                if (connection->request->paced) {
+                    unsigned long long waitUs;
+                    quantum = getBandwidthAllowance(connection->request->paceUs, nowUs, quantum, &waitUs);
+                    if (quantum == 0) {
+                        // throttled, EPOLLOUT is ignored until the timer resumes the transfer
+                        setConnectionPacing(queueConnections, connection, waitUs);
+                        repeat = false;
+                        break;
+                    }
+                }
+                size_t bytesSent;
+                enum OutputFlushResult result = sendResponse(connection, quantum, &bytesSent);
+                if (bytesSent > 0) {
+                    setConnectionDeadline(queueConnections, connection, TIMER_KIND_SEND_STALL);
+                    sampleAdmissionDelay(queueConnections, connection);
+                    if (BANDWIDTH.enabled) {
+                        chargeBandwidth(&connection->request->paceUs, bytesSent, nowUs);
+                    }
+                }
+                if (result == OUTPUT_FLUSH_QUANTUM) {
+                    // still writable, but edge triggered epoll will not report it again
+                    connection->transferScheduled = scheduleTransfer(
+                        &queueConnections->transfers, connection->slot, getOutputQueueLength(connection->request->output));
+                    if (!connection->transferScheduled) {
+                        connection->state = STATE_CONNECTION_DONE_FOR_CLOSE;
+                        break;
+                    }
+                    repeat = false;
+                } else if (result == OUTPUT_FLUSH_AGAIN) {
+                    // the socket is full, the next EPOLLOUT resumes the output queue
+                    repeat = false;
+                }
+                break;
+            }
+            case STATE_CONNECTION_DONE: {
+                logDebug("STATE_CONNECTION_DONE with fd %i and threadID %ld", clientFd, threadId);
+                if (connection->request->keepAlive == true) {
+                    // the fd belongs only to this thread's epoll (edge triggered),
+                    // there is nothing to rearm, only reset the connection for the next request
+                    updateQueueConnection(queueConnections, connection);
+                    if (connection->requestBufferOffset > 0 && getRequestLength(connection) > 0) {
+                        // pipelined requests left in the buffer
+                        connection->state = STATE_CONNECTION_SEND_HEADERS;
+                        setConnectionDeadline(queueConnections, connection, TIMER_KIND_SEND_STALL);
+                    } else if (connection->requestBufferOffset == 0 && queueConnections->worker != BALANCER_NO_WORKER
+                               && !queueConnections->draining) {
+                        // between two requests, an overloaded thread gives the connection away
+                        int target = pickHandoffTarget(queueConnections->worker, queueConnections->currentSize);
+                        if (target != BALANCER_NO_WORKER
+                            && handOffEpollConnection(epollFd, queueConnections, connection, target)) {
                             repeat = false;
-                            break;
                         }
                     }
-                } while (repeat);
+                    // else read what arrived while sending, its EPOLLIN edge was already consumed
+                } else {
+                    connection->state = STATE_CONNECTION_DONE_FOR_CLOSE;
+                }
+                break;
+            }
+            case STATE_CONNECTION_WAIT_IO: {
+                // resumed by receiveEpollIoCompletions
+                repeat = false;
+                break;
+            }
+            case STATE_CONNECTION_DONE_FOR_CLOSE: {
+                logDebug("STATE_CONNECTION_DONE_FOR_CLOSE with fd %i and threadID %ld", clientFd, threadId);
+                dequeueConnection(queueConnections, connection);
+                closeEpollClient(epollFd, clientFd);
+                repeat = false;
+                break;
             }
         }
+    } while (repeat);
 
-        // printQueueConnections(queueConnections);
+    if (loopStats != NULL) {
+        recordLoopEvent(loopStats, eventStart, clientFd, eventState);
     }
+}
 
-    logDebug("sigIntReceived in the thread %ld", threadId);
-    unsigned short int i;
-    for (i = 0; i < queueConnections.currentSize; i++) {
-        freeConnection(&queueConnections.connections[i]);
+/**
+ * One send quantum for each of the first SEND_QUANTA_PER_ITERATION scheduled transfers, the fewest bytes
+ * left first, then back to epoll_wait, so the new requests do not wait behind the large transfers.
+ * A transfer scheduled again during the round goes to the next one (the round is bounded by the
+ * transfers pending at its start), the slots of the connections closed meanwhile are skipped.
+ */
+void resumeEpollTransfers(int epollFd, struct QueueConnectionsType *queueConnections) {
+    int quanta = queueConnections->transfers.count;
+    if (quanta > SEND_QUANTA_PER_ITERATION) {
+        quanta = SEND_QUANTA_PER_ITERATION;
+    }
+    int slot;
+    while (quanta-- > 0 && nextTransfer(&queueConnections->transfers, &slot)) {
+        struct QueueConnectionElementType *connection = getConnectionBySlot(queueConnections, slot);
+        if (connection == NULL || !connection->transferScheduled) {
+            continue;
+        }
+        connection->transferScheduled = false;
+        handleEpollConnection(epollFd, queueConnections, connection);
+    }
+}
+
+/**
+ * Pipelining: every complete request of the buffer is processed in order and its response queued after the
+ * previous ones, then all of them are flushed together by STATE_CONNECTION_SEND_BODY. A batch ends when the
+ * output queue or the response buffer is full, or with a response that closes the connection;
+ * the requests left in the buffer are processed when the batch is sent.
+ */
+void processEpollRequests(struct QueueConnectionsType *queueConnections, struct QueueConnectionElementType *connection) {
+    int clientFd = connection->clientFd;
+    connection->state = STATE_CONNECTION_SEND_BODY;
+    attachResponseBuffer(queueConnections, connection);
+    attachOutputQueue(queueConnections, connection);
+
+    size_t requestLength;
+    while ((requestLength = getRequestLength(connection)) > 0) {
+        if (!isOutputQueueEmpty(connection->request->output)
+            && (getOutputQueueRoom(connection->request->output) < 2
+                || BUFFER_RESPONSE_SIZE - connection->responseBufferHeadersLength < RESPONSE_HEADERS_MAX_SIZE)) {
+            break;
+        }
+        // of the responses queued before, kept if this request waits for them
+        bool keepAlive = connection->request->keepAlive;
+        resetConnectionRequest(connection);
+
+        logDebug("processRequest with fd %i", clientFd);
+        bool isValidRequest = processRequest(connection);
+        if (!connection->request->clientAdmitted) {
+            // once per request, not again when it is processed again after waiting for its file
+            connection->request->clientAdmitted = takeClientRequest(connection->request->peerAddress.sin_addr.s_addr);
+        }
+
+        if (!connection->request->clientAdmitted) {
+            logDebug(RED "tooManyRequestResponse with fd %i" RESET, clientFd);
+            tooManyRequestResponse(connection);
+        } else if (!isValidRequest) {
+            logDebug(RED "badRequestResponse with fd %i" RESET, clientFd);
+            badRequestResponse(connection);
+        } else if (strcmp(connection->request->protocolVersion, "HTTP/1.0") != 0
+                   && strcmp(connection->request->protocolVersion, "HTTP/1.1") != 0) {
+            unsupportedProtocolResponse(connection, connection->request->protocolVersion);
+        } else if (strcmp(connection->request->path, "/hello") == 0) {
+            helloResponse(connection);
+        } else if (queueConnections->ioCompletions != NULL && !probeEpollRequestFile(queueConnections, connection)) {
+            // not answered yet, the parser keeps the request and it is processed again when the file is warm,
+            // or after the responses queued before it are sent (then its job is submitted)
+            connection->request->keepAlive = keepAlive;
+            break;
+        } else {
+            size_t headersOffset = connection->responseBufferHeadersLength;
+            applyKeepAlivePolicy(queueConnections, connection);
+            makeResponse(connection);
+            queueResponse(connection, headersOffset);
+        }
+        logRequest(*connection);
+        if (queueConnections->loopStats != NULL) {
+            noteLoopPath(queueConnections->loopStats, connection->request->path);
+        }
+        // the parser goes on with the next request, the bytes of this one stay until the batch is sent
+        consumeRequestBuffer(connection, requestLength);
+
+        if (!connection->request->keepAlive) {
+            // the rest of the pipeline is not answered
+            break;
+        }
+    }
+
+    if (connection->state == STATE_CONNECTION_WAIT_IO) {
+        return;
+    }
+    // a new burst for the batch, only the bulk transfers wait for the bandwidth limits
+    connection->request->paceUs = 0;
+    connection->request->paced =
+        BANDWIDTH.enabled && getOutputQueueLength(connection->request->output) > SEND_QUANTUM_SIZE;
+}
+
+// the connection waits for a job of the I/O threads, its events are ignored meanwhile
+static void waitEpollIo(struct QueueConnectionElementType *connection, enum stateConnection resumeState) {
+    logDebug("Wait for the I/O threads with fd %i", connection->clientFd);
+    connection->request->ioResumeState = resumeState;
+    connection->state = STATE_CONNECTION_WAIT_IO;
+}
+
+/**
+ * true if the file of the request can be opened without blocking, else the caches are warmed by the
+ * I/O threads and the connection waits for them (after sending the responses already queued)
+ */
+bool probeEpollRequestFile(struct QueueConnectionsType *queueConnections, struct QueueConnectionElementType *connection) {
+    if (connection->request->ioWarmed || connection->request->absolutePath == NULL) {
+        connection->request->ioWarmed = false;
+        return true;
+    }
+    int fd;
+    bool cached = probeFileOpen(connection->request->absolutePath, &fd);
+    if (fd != -1) {
+        cached = probeFileRange(fd, 0);
+        if (cached) {
+            // makeResponse sends it, without opening the path again
+            connection->request->requestFd = fd;
+            return true;
+        }
+        close(fd);
+    }
+    if (cached) {
+        return true;
+    }
+    if (!isOutputQueueEmpty(connection->request->output)) {
+        return false;
+    }
+    unsigned int ticket = ++queueConnections->ioTickets;
+    if (!submitIoOpen(queueConnections->ioCompletions, connection->request->absolutePath, connection->slot, ticket)) {
+        return true;
+    }
+    connection->request->ioTicket = ticket;
+    waitEpollIo(connection, STATE_CONNECTION_SEND_HEADERS);
+    return false;
+}
+
+// true if sendfile will not block on the next file bytes of the output queue, else they are read by the I/O threads
+bool probeEpollOutputFile(struct QueueConnectionsType *queueConnections, struct QueueConnectionElementType *connection) {
+    if (connection->request->ioWarmed) {
+        connection->request->ioWarmed = false;
+        return true;
+    }
+    struct OutputSegmentType *segment = getOutputQueueFile(connection->request->output);
+    if (segment == NULL || probeFileRange(segment->fd, segment->offset)) {
+        return true;
+    }
+    unsigned int ticket = ++queueConnections->ioTickets;
+    if (!submitIoReadahead(
+            queueConnections->ioCompletions, segment->fd, segment->offset, segment->length, connection->slot, ticket)) {
+        return true;
+    }
+    connection->request->ioTicket = ticket;
+    waitEpollIo(connection, STATE_CONNECTION_SEND_BODY);
+    return false;
+}
+
+// resume the connections whose caches were warmed, the ones closed meanwhile are skipped
+void receiveEpollIoCompletions(int epollFd, struct QueueConnectionsType *queueConnections) {
+    struct IoJobType *job = takeIoCompletions(queueConnections->ioCompletions);
+    while (job != NULL) {
+        struct IoJobType *next = job->next;
+        struct QueueConnectionElementType *connection = getConnectionBySlot(queueConnections, job->slot);
+        if (connection != NULL && connection->state == STATE_CONNECTION_WAIT_IO
+            && connection->request->ioTicket == job->ticket) {
+            connection->request->ioWarmed = true;
+            connection->state = connection->request->ioResumeState;
+            handleEpollConnection(epollFd, queueConnections, connection);
+        }
+        free(job);
+        job = next;
     }
 }
 
@@ -177,39 +502,203 @@ void handleEpollFacade(int socketServerFd) {
     if (epollFd < 0) {
         die("epoll_create failed");
     }
-    addEpollClient(epollFd, socketServerFd, 0);
+    addEpollClient(epollFd, socketServerFd, EPOLLIN, EPOLL_TAG_LISTENER);
 
-    handleEpoll(socketServerFd, epollFd);
+    handleEpoll(socketServerFd, epollFd, OPTIONS.maxConnections, BALANCER_NO_WORKER, false);
 }
 
-void acceptEpollConnection(int epollFd, int socketServerFd, int events) {
-    while (1) {
-        struct sockaddr_in client_address;
-        socklen_t client_address_len = sizeof(client_address);
-        int clientFd = accept(socketServerFd, (struct sockaddr *)&client_address, &client_address_len);
-        // alternative to makeSocketNonBlocking function with fcntl, we save a call to the system
-        // int client_fd = accept4(socket_server_fd, (struct sockaddr *)&client_address, (socklen_t
-        // *)&client_address_len, SOCK_NONBLOCK);
+/**
+ * The listening socket is level triggered, so a bounded batch of accepts per wakeup is enough:
+ * the pending connections are reported again by the next epoll_wait, after serving the ready clients.
+ * accept4 makes the socket non-blocking without fcntl, and the client address is saved in the connection,
+ * so there is no getpeername per request.
+ */
+void acceptEpollConnection(int epollFd, int socketServerFd, int events, struct QueueConnectionsType *queueConnections) {
+    int i;
+    for (i = 0; i < ACCEPT_BATCH_SIZE; i++) {
+        struct sockaddr_in clientAddress;
+        socklen_t clientAddressLen = sizeof(clientAddress);
+        int clientFd = accept4(
+            socketServerFd, (struct sockaddr *)&clientAddress, &clientAddressLen, SOCK_NONBLOCK | SOCK_CLOEXEC);
         if (clientFd < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
             if (errno != EAGAIN && errno != EWOULDBLOCK) {
-                logWarning("accept() failed");
+                logWarning("accept4() failed");
             }
             break;
         }
 
-        logDebug("Connect with the client %d %s:%d",
-                 clientFd,
-                 inet_ntoa(client_address.sin_addr),
-                 htons(client_address.sin_port));
-        makeSocketNonBlocking(clientFd);
-        addEpollClient(epollFd, clientFd, events);
+        logDebug("Connect with the client %d port %d", clientFd, ntohs(clientAddress.sin_port));
+        if (!acquireClientConnection(clientAddress.sin_addr.s_addr)) {
+            logDebug("Too many connections of the client of the fd %d", clientFd);
+            rejectConnection(clientFd, tooManyRequestResponseTemplate);
+            continue;
+        }
+        if (queueConnections->worker != BALANCER_NO_WORKER && !queueConnections->draining) {
+            int target = pickHandoffTarget(queueConnections->worker, queueConnections->currentSize);
+            if (target != BALANCER_NO_WORKER && pushHandoff(target, clientFd, &clientAddress, false, true)) {
+                continue;
+            }
+        }
+        struct QueueConnectionElementType *connection = acceptConnection(queueConnections, clientFd, &clientAddress);
+        if (connection == NULL) {
+            releaseClientConnection(clientAddress.sin_addr.s_addr);
+            rejectConnection(clientFd, serviceUnavailableResponseTemplate);
+            continue;
+        }
+        connection->request->clientCounted = true;
+        addEpollClient(epollFd, clientFd, events, connection);
+        if (shedConnection(queueConnections)) {
+            // overloaded, the prebuilt 503 is sent by the first EPOLLOUT, the request is never read
+            logDebug("Shed the connection %d", clientFd);
+            connection->request->acceptedUs = 0;
+            discardRequest(clientFd);
+            attachOutputQueue(queueConnections, connection);
+            serviceUnavailableResponse(connection);
+            connection->state = STATE_CONNECTION_SEND_BODY;
+            setConnectionDeadline(queueConnections, connection, TIMER_KIND_SEND_STALL);
+        }
+    }
+}
+
+/**
+ * Move an idle connection to another thread: it leaves this epoll and this queue, the descriptor stays open.
+ * The target adds it to its epoll, which reports the data that arrived meanwhile.
+ */
+bool handOffEpollConnection(int epollFd,
+                            struct QueueConnectionsType *queueConnections,
+                            struct QueueConnectionElementType *connection,
+                            int target) {
+    int clientFd = connection->clientFd;
+    bool idle = getConnectionDeadline(queueConnections, connection) == TIMER_KIND_IDLE;
+    if (epoll_ctl(epollFd, EPOLL_CTL_DEL, clientFd, NULL) == -1) {
+        logWarning("EPOLL_CTL_DEL failed with the clientFd %d", clientFd);
+        return false;
+    }
+    if (!pushHandoff(target, clientFd, &connection->request->peerAddress, idle, connection->request->clientCounted)) {
+        addEpollClient(epollFd, clientFd, EPOLLIN | EPOLLOUT | EPOLLET, connection);
+        return false;
+    }
+    logDebug("Hand off the fd %d to the thread %d", clientFd, target);
+    // the client keeps its count, the target releases it
+    connection->request->clientCounted = false;
+    dequeueConnection(queueConnections, connection);
+    return true;
+}
+
+// the connections handed off to this thread, then the ones an idle thread asked for
+void receiveEpollHandoffs(int epollFd, struct QueueConnectionsType *queueConnections) {
+    int worker = queueConnections->worker;
+    struct HandoffType *handoff = takeHandoffs(worker);
+    while (handoff != NULL) {
+        struct HandoffType *next = handoff->next;
+        struct QueueConnectionElementType *connection =
+            acceptConnection(queueConnections, handoff->clientFd, &handoff->peerAddress);
+        if (connection == NULL) {
+            if (handoff->clientCounted) {
+                releaseClientConnection(handoff->peerAddress.sin_addr.s_addr);
+            }
+            close(handoff->clientFd);
+        } else {
+            connection->request->clientCounted = handoff->clientCounted;
+            if (handoff->idle) {
+                // the wait for the next request is not a queueing delay
+                connection->request->acceptedUs = 0;
+                setConnectionDeadline(queueConnections, connection, TIMER_KIND_IDLE);
+            }
+            addEpollClient(epollFd, handoff->clientFd, EPOLLIN | EPOLLOUT | EPOLLET, connection);
+        }
+        free(handoff);
+        handoff = next;
+    }
+
+    int thief = takeStealRequest(worker);
+    if (thief == BALANCER_NO_WORKER || queueConnections->draining) {
+        return;
+    }
+    // half of the difference, the connections waiting for a request
+    int connections = (queueConnections->currentSize - getWorkerLoad(thief)) / 2;
+    if (connections > BALANCE_STEAL_BATCH) {
+        connections = BALANCE_STEAL_BATCH;
+    }
+    int slot;
+    int slots = queueConnections->chunksCount * QUEUE_CONNECTIONS_CHUNK_SIZE;
+    for (slot = 0; slot < slots && connections > 0; slot++) {
+        struct QueueConnectionElementType *connection = getConnectionBySlot(queueConnections, slot);
+        if (connection == NULL || connection->state != STATE_CONNECTION_RECV || connection->requestBufferOffset > 0) {
+            continue;
+        }
+        if (handOffEpollConnection(epollFd, queueConnections, connection, thief)) {
+            connections--;
+        }
+    }
+    logDebug("Thread %d stolen by the thread %d", worker, thief);
+}
+
+/**
+ * SIGQUIT or upgrade: the thread stops accepting, closes its kept-alive connections waiting for a request
+ * and answers the others with `Connection: close`, the loop ends when there are none left.
+ * A listener of its own (--reuseport) is closed, with net.ipv4.tcp_migrate_req its queued connections
+ * go to the other listeners of the port.
+ */
+void drainEpollConnections(int epollFd,
+                           int socketServerFd,
+                           bool ownListener,
+                           struct QueueConnectionsType *queueConnections) {
+    queueConnections->draining = true;
+    if (epoll_ctl(epollFd, EPOLL_CTL_DEL, socketServerFd, NULL) == -1) {
+        logWarning("epoll_ctl EPOLL_CTL_DEL of the listener failed");
+    }
+    if (ownListener) {
+        acceptEpollConnection(epollFd, socketServerFd, EPOLLIN | EPOLLOUT | EPOLLET, queueConnections);
+        close(socketServerFd);
+    }
+    int slot;
+    int slots = queueConnections->chunksCount * QUEUE_CONNECTIONS_CHUNK_SIZE;
+    for (slot = 0; slot < slots; slot++) {
+        struct QueueConnectionElementType *connection = getConnectionBySlot(queueConnections, slot);
+        // a new connection has not sent its first request yet, it is served
+        if (connection == NULL || connection->state != STATE_CONNECTION_RECV || connection->requestBufferOffset > 0
+            || connection->request->requests == 0) {
+            continue;
+        }
+        int clientFd = connection->clientFd;
+        dequeueConnection(queueConnections, connection);
+        closeEpollClient(epollFd, clientFd);
+    }
+}
+
+int createEpollTimerFd(int epollFd) {
+    int timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timerFd == -1) {
+        die("timerfd_create failed");
+    }
+    addEpollClient(epollFd, timerFd, EPOLLIN, EPOLL_TAG_TIMERFD);
+    return timerFd;
+}
+
+// relative timeout in milliseconds, -1 disarms the timer
+void armEpollTimerFd(int timerFd, int timeout) {
+    struct itimerspec value = {0};
+    if (timeout == 0) {
+        timeout = 1; // a zero it_value disarms the timer
+    }
+    if (timeout > 0) {
+        value.it_value.tv_sec = timeout / 1000;
+        value.it_value.tv_nsec = (long)(timeout % 1000) * 1000000;
+    }
+    if (timerfd_settime(timerFd, 0, &value, NULL) == -1) {
+        logWarning("timerfd_settime failed");
     }
 }
 
-struct epoll_event buildEpollEvent(int events, int fd) {
+// ptr: the connection, or EPOLL_TAG_* for the other descriptors
+struct epoll_event buildEpollEvent(int events, void *ptr) {
     struct epoll_event event = {0};
     event.events = events;
-    event.data.fd = fd;
+    event.data.ptr = ptr;
     return event;
 }
 
@@ -223,24 +712,25 @@ void closeEpollClient(int epollFd, int clientFd) {
     close(clientFd);
 }
 
-void addEpollClient(int epollFd, int clientFd, int events) {
+void addEpollClient(int epollFd, int clientFd, int events, void *ptr) {
     if (events == 0) {
         events = EPOLLIN | EPOLLET;
     }
-    // (EPOLLIN | EPOLLET Edge Triggered (ET) for non-blocking sockets
+    // (EPOLLIN | EPOLLET Edge Triggered (ET) for non-blocking sockets, the clients also
+    // with EPOLLOUT, registered once, to resume the output queue when the socket is writable again
     // EPOLLERR and EPOLLHUP are always included even if you're not requesting them
-    struct epoll_event event = buildEpollEvent(events, clientFd);
+    struct epoll_event event = buildEpollEvent(events, ptr);
     int s = epoll_ctl(epollFd, EPOLL_CTL_ADD, clientFd, &event);
     if (s == -1) {
         die("EPOLL_CTL_ADD failed");
     }
 }
 
-void modEpollClient(int epollFd, int clientFd, int events) {
+void modEpollClient(int epollFd, int clientFd, int events, void *ptr) {
     if (events == 0) {
         events = EPOLLIN | EPOLLET;
     }
-    struct epoll_event event = buildEpollEvent(events, clientFd);
+    struct epoll_event event = buildEpollEvent(events, ptr);
     int s = epoll_ctl(epollFd, EPOLL_CTL_MOD, clientFd, &event);
     if (s == -1) {
         die("EPOLL_CTL_MOD failed");
@@ -8,7 +8,9 @@
 #include <errno.h>     // for errno
 #include <netdb.h>     // for getaddrinfo() and getservbyname
 #include <pthread.h>   // for pthread_create()
+#include <sched.h>     // for cpu_set_t
 #include <signal.h>    // for sigaction
+#include <stdatomic.h> // for atomic_bool
 #include <stdio.h>     // for fprintf()
 #include <stdlib.h>    // for exit()
 #include <string.h>    // for strlen()
@@ -20,54 +22,206 @@
 #include "../lib/logger/logger.h"
 #include "accept_client_epoll.h"
 #include "accept_client_thread_epoll.h"
+#include "balancer.h"
+#include "cpu_placement.h"
+#include "io_pool.h"
+#include "loop_stats.h"
+#include "accept_client_uring.h"
+#include "options.h"
+#include "prefork.h"
 #include "queue_connections.h"
+#include "response.h"
 #include "server.h"
+#include "upgrade.h"
 
 struct threadData {
     pthread_t thread;
+    int index;
+    int cpu; // -1 not pinned
     int socketFd;
     int epollFd;
+    int maxConnections; // of this thread
+    int worker;         // index in the balancer, BALANCER_NO_WORKER without --balance
+    atomic_bool finished; // drained, the thread is gone
 };
 
+/**
+ * Every worker thread owns its epoll instance and the connections it accepts for their whole life,
+ * so the client descriptors are not shared between threads and don't need EPOLLONESHOT
+ * neither the rearm (EPOLL_CTL_MOD) after each request.
+ *
+ * - Shared mode (default): one listening socket added to every epoll with EPOLLEXCLUSIVE,
+ *   the kernel wakes up only one of the threads for each new connection.
+ * - Sharded mode (--reuseport): one SO_REUSEPORT listening socket per thread, pinned to one CPU.
+ *
+ * There is one thread per allowed CPU within the cgroup quota, or --threads, see cpu_placement.c,
+ * and with --cpus every thread is pinned to one of them.
+ *
+ * With --balance (epoll) the threads also move connections between them, see balancer.c.
+ * With --workers every worker process runs its own set of threads, see prefork.c.
+ */
 void acceptClientsThreadEpoll(int socketServerFd) {
 
-    int nThreads = sysconf(_SC_NPROCESSORS_ONLN);
-    if (nThreads < 0) {
-        die("sysconf nº processors failed");
+    int nThreads = getServerThreads();
+    if (PREFORK.threads > 0) {
+        nThreads = PREFORK.threads; // a worker of --workers, its share of the CPUs
     }
     struct threadData threads[nThreads];
 
-    int epollFd = epoll_create1(0);
-    if (epollFd < 0) {
-        die("epoll_create failed");
+    if (OPTIONS.ioBackend == IO_BACKEND_URING && !isUringSupported()) {
+        logWarning("io_uring backend not supported by the kernel, fallback to epoll");
+        OPTIONS.ioBackend = IO_BACKEND_EPOLL;
+    }
+    bool balance = OPTIONS.balance && nThreads > 1;
+    if (balance && OPTIONS.ioBackend == IO_BACKEND_URING) {
+        logWarning("--balance is only supported by the epoll backend");
+        balance = false;
+    }
+    if (balance) {
+        initBalancer(nThreads, (OPTIONS.maxConnections + nThreads - 1) / nThreads);
+    }
+    if (OPTIONS.ioThreads > 0 && OPTIONS.ioBackend == IO_BACKEND_URING) {
+        logWarning("--io-threads is only supported by the epoll backend");
+    } else {
+        initIoPool(OPTIONS.ioThreads);
+    }
+    if (OPTIONS.stallBudget > 0 && OPTIONS.ioBackend == IO_BACKEND_URING) {
+        logWarning("--stall-budget is only supported by the epoll backend");
+    } else {
+        initLoopStats(OPTIONS.stallBudget);
     }
-    addEpollClient(epollFd, socketServerFd, 0);
 
     // create threads
     int i;
     for (i = 0; i < nThreads; i++) {
-        threads[i].socketFd = socketServerFd;
-        threads[i].epollFd = epollFd;
+        threads[i].index = i;
+        threads[i].maxConnections = (OPTIONS.maxConnections + nThreads - 1) / nThreads;
+        threads[i].cpu = OPTIONS.reusePort || OPTIONS.cpus[0] != '\0' ? getThreadCpu(i) : -1;
+        threads[i].worker = balance ? i : BALANCER_NO_WORKER;
+        atomic_init(&threads[i].finished, false);
+        if (!OPTIONS.reusePort || i == 0) {
+            threads[i].socketFd = socketServerFd;
+        } else {
+            threads[i].socketFd = createServerSocket(OPTIONS);
+        }
+        if (OPTIONS.reusePort && OPTIONS.incomingCpu) {
+            steerServerSocketToCpu(threads[i].socketFd, threads[i].cpu);
+        }
+
+        threads[i].epollFd = -1;
+        if (OPTIONS.ioBackend == IO_BACKEND_URING) {
+            continue; // one ring per thread, created by the thread
+        }
+        threads[i].epollFd = epoll_create1(0);
+        if (threads[i].epollFd < 0) {
+            die("epoll_create failed");
+        }
+        // level triggered, see acceptEpollConnection
+        addEpollClient(threads[i].epollFd,
+                       threads[i].socketFd,
+                       OPTIONS.reusePort ? EPOLLIN : EPOLLIN | EPOLLEXCLUSIVE,
+                       EPOLL_TAG_LISTENER);
+    }
+    if (OPTIONS.reusePort && OPTIONS.incomingCpu) {
+        // once the group is complete, the program returns indexes of all its sockets
+        int threadCpus[nThreads];
+        for (i = 0; i < nThreads; i++) {
+            threadCpus[i] = threads[i].cpu;
+        }
+        steerReuseportGroup(socketServerFd, threadCpus, nThreads);
+    }
+
+    for (i = 0; i < nThreads; i++) {
         pthread_create(&threads[i].thread, NULL, workThreadEpoll, (void *)&threads[i]);
         pthread_detach(threads[i].thread);
     }
 
-    // We wait until we obtain the SIGINT signal
+    // We wait until we obtain the SIGINT signal, or until the threads drain their connections after SIGQUIT
+    time_t drainDeadline = 0;
     while (!sigintReceived) {
-        sleep(1);
+        waitUpgrade(socketServerFd, 1000);
+        if (dumpStatsReceived) {
+            dumpStatsReceived = 0;
+            dumpLoopStats();
+        }
+        if (!sigquitReceived) {
+            continue;
+        }
+        if (drainDeadline == 0) {
+            drainDeadline = time(NULL) + DRAIN_TIMEOUT;
+            // wake up every thread blocked in epoll_wait
+            for (i = 0; i < nThreads; i++) {
+                pthread_kill(threads[i].thread, SIGQUIT);
+            }
+        }
+        int running = 0;
+        for (i = 0; i < nThreads; i++) {
+            running += !atomic_load(&threads[i].finished);
+        }
+        if (running == 0) {
+            break;
+        }
+        if (time(NULL) >= drainDeadline) {
+            logWarning("%d threads still have connections after %d seconds of drain", running, DRAIN_TIMEOUT);
+            break;
+        }
     }
     // send a signal to exit the epoll loop and free any memory allocated
     for (i = 0; i < nThreads; i++) {
-        pthread_kill(threads[i].thread, SIGINT);
+        if (!atomic_load(&threads[i].finished)) {
+            pthread_kill(threads[i].thread, SIGINT);
+        }
         // pthread_cancel(threads[i].thread);
     }
     usleep(100000); // time for threads to finish
+
+    for (i = 0; i < nThreads; i++) {
+        if (threads[i].epollFd != -1) {
+            close(threads[i].epollFd);
+        }
+        // a drained thread closed its own listener
+        if (threads[i].socketFd != socketServerFd && drainDeadline == 0) {
+            close(threads[i].socketFd);
+        }
+    }
+    if (balance) {
+        freeBalancer();
+    }
+    // after the epoll threads, they wait for their jobs
+    freeIoPool();
+    freeLoopStats();
 }
 
 void *workThreadEpoll(void *threadDataArg) {
     struct threadData *threadData = (struct threadData *)threadDataArg;
 
-    handleEpoll(threadData->socketFd, threadData->epollFd);
+    if (threadData->cpu >= 0) {
+        pinThreadToCpu(pthread_self(), threadData->cpu);
+        // before the thread allocates its connections table and buffers
+        setLocalMemoryPolicy();
+    }
+
+    // the listener of thread 0 is the one of the process, it may also be of another process (upgrade)
+    bool ownListener = threadData->index > 0 && OPTIONS.reusePort;
+    if (OPTIONS.ioBackend == IO_BACKEND_URING) {
+        handleUring(threadData->socketFd, threadData->maxConnections, ownListener);
+    } else {
+        handleEpoll(
+            threadData->socketFd, threadData->epollFd, threadData->maxConnections, threadData->worker, ownListener);
+    }
+    closeMimeMagic();
+    atomic_store(&threadData->finished, true);
 
     return NULL;
-}
\ No newline at end of file
+}
+
+void pinThreadToCpu(pthread_t thread, int cpu) {
+    cpu_set_t cpuSet;
+    CPU_ZERO(&cpuSet);
+    CPU_SET(cpu, &cpuSet);
+    int s = pthread_setaffinity_np(thread, sizeof(cpu_set_t), &cpuSet);
+    if (s != 0) {
+        errno = s;
+        logWarning("pthread_setaffinity_np CPU %d failed", cpu);
+    }
+}
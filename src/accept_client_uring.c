@@ -0,0 +1,731 @@
+/**
+ *
+ * @brief io_uring I/O backend
+ *
+ * Same state machine as handleEpoll (accept_client_epoll.c), but driven by completions instead of readiness:
+ * multishot accept, multishot recv into a ring of provided buffers, send of the response headers and splice
+ * of the body (file -> pipe -> socket). Every operation of a loop iteration is submitted together with the wait
+ * for the next completions in a single io_uring_enter system call.
+ *
+ * Requires Linux 6.0+ (multishot recv), otherwise the epoll backend is used.
+ *
+ */
+
+#include <errno.h>     // for errno
+#include <fcntl.h>     // for pipe2()
+#include <stdio.h>     // for snprintf()
+#include <stdlib.h>    // for malloc()
+#include <string.h>    // for strlen()
+#include <sys/socket.h> // for shutdown()
+#include <unistd.h>    // for close()
+
+#include "../lib/die/die.h"
+#include "../lib/logger/logger.h"
+#include "accept_client_uring.h"
+#include "busy_poll.h"
+#include "client_limits.h"
+#include "helper.h"
+#include "keep_alive.h"
+#include "options.h"
+#include "queue_connections.h"
+#include "request.h"
+#include "response.h"
+#include "server.h"
+
+bool isUringSupported() {
+    struct Uring ring;
+    if (uringInit(&ring, 8) == -1) {
+        logWarning("io_uring_setup failed");
+        return false;
+    }
+
+    bool supported = (ring.features & IORING_FEAT_EXT_ARG) && uringSupportsOperation(&ring, IORING_OP_ACCEPT)
+                     && uringSupportsOperation(&ring, IORING_OP_RECV) && uringSupportsOperation(&ring, IORING_OP_SEND)
+                     && uringSupportsOperation(&ring, IORING_OP_SPLICE);
+
+    struct UringBufferRing bufferRing;
+    if (supported && uringRegisterBufferRing(&ring, &bufferRing, 8, 64, URING_BUFFER_GROUP_ID) == -1) {
+        logWarning("io_uring provided buffer ring not supported");
+        supported = false;
+    } else if (supported) {
+        uringUnregisterBufferRing(&ring, &bufferRing);
+    }
+
+    uringExit(&ring);
+    return supported;
+}
+
+void handleUring(int socketServerFd, int maxConnections, bool ownListener) {
+
+    struct QueueConnectionsType queueConnections;
+    initQueueConnections(&queueConnections, maxConnections);
+    struct UringWorker *worker = calloc(1, sizeof(struct UringWorker));
+    if (worker == NULL) {
+        die("calloc UringWorker");
+    }
+    worker->queueConnections = &queueConnections;
+    worker->socketServerFd = socketServerFd;
+
+    if (uringInit(&worker->ring, URING_ENTRIES) == -1) {
+        die("io_uring_setup failed");
+    }
+    if (uringRegisterBufferRing(
+            &worker->ring, &worker->bufferRing, URING_BUFFER_ENTRIES, URING_BUFFER_SIZE, URING_BUFFER_GROUP_ID)
+        == -1) {
+        die("io_uring register buffer ring failed");
+    }
+
+    long int threadId = pthread_self();
+
+    prepareUringAccept(worker);
+
+    while (!sigintReceived) {
+        if (sigquitReceived && !queueConnections.draining) {
+            drainUringConnections(worker, ownListener);
+        }
+        if (queueConnections.draining && queueConnections.currentSize == 0) {
+            break;
+        }
+
+        // close the connections whose deadline expired
+        unsigned long long now = monotonicMilliseconds();
+        uint32_t handle = expireTimers(&queueConnections.timingWheel, now);
+        while (handle != TIMER_HANDLE_NONE) {
+            struct TimerType *timer = &queueConnections.timingWheel.timers[handle];
+            uint32_t nextHandle = timer->next;
+            struct QueueConnectionElementType *connection = getConnectionBySlot(&queueConnections, (int)handle);
+            logDebug("Close by %s timeout with thread %ld, fd %i", timerKindList[timer->kind], threadId, connection->clientFd);
+            if (!worker->slots[connection->slot].closing) {
+                closeUringConnection(worker, connection);
+            }
+            handle = nextHandle;
+        }
+        struct timespec timeout = {0};
+        struct timespec *timeoutPtr = NULL;
+        int timeoutMs = nextTimerTimeout(&queueConnections.timingWheel, now);
+        if (timeoutMs != -1) {
+            timeout.tv_sec = timeoutMs / 1000;
+            timeout.tv_nsec = (long)(timeoutMs % 1000) * 1000000;
+            timeoutPtr = &timeout;
+        }
+
+        if (worker->backlogCount > 0) {
+            flushUringBacklog(worker);
+        }
+        // submit the pending operations and wait for one completion in the same system call, after the spin
+        // of --busy-poll
+        if ((timeoutMs == 0 || !busyPollUring(&worker->ring))
+            && uringSubmitAndWait(&worker->ring, 1, timeoutPtr) < 0 && errno != ETIME && errno != EINTR) {
+            logWarning("io_uring_enter failed");
+        }
+
+        struct io_uring_cqe *cqe;
+        while ((cqe = uringPeekCqe(&worker->ring)) != NULL) {
+            unsigned long long userData = cqe->user_data;
+            int result = cqe->res;
+            unsigned int flags = cqe->flags;
+            uringCqeSeen(&worker->ring);
+            handleUringCompletion(worker, userData, result, flags);
+        }
+    }
+
+    logDebug("sigIntReceived or drained in the thread %ld", threadId);
+    int i;
+    for (i = 0; i < worker->slotsCount; i++) {
+        struct QueueConnectionElementType *connection = getConnectionBySlot(&queueConnections, i);
+        if (connection != NULL) {
+            int clientFd = connection->clientFd;
+            shutdown(clientFd, SHUT_RDWR);
+            close(clientFd);
+        }
+        releaseUringPipe(worker, &worker->slots[i]);
+        free(worker->slots[i].spill);
+    }
+    freeQueueConnections(&queueConnections);
+    free(worker->slots);
+    free(worker->backlog);
+    for (i = 0; i < worker->freePipesCount; i++) {
+        close(worker->freePipes[i][0]);
+        close(worker->freePipes[i][1]);
+    }
+    uringUnregisterBufferRing(&worker->ring, &worker->bufferRing);
+    uringExit(&worker->ring);
+    free(worker);
+}
+
+void handleUringCompletion(struct UringWorker *worker, unsigned long long userData, int result, unsigned int flags) {
+    int operation = URING_USER_DATA_OPERATION(userData);
+
+    if (operation == URING_OPERATION_CANCEL) {
+        return;
+    }
+    if (operation == URING_OPERATION_ACCEPT) {
+        if (!(flags & IORING_CQE_F_MORE) && !worker->queueConnections->draining) {
+            // multishot accept terminated (error or overflow), arm it again
+            prepareUringAccept(worker);
+        }
+        if (result == -ECANCELED) {
+            return;
+        }
+        if (result < 0) {
+            errno = -result;
+            logWarning("io_uring accept() failed");
+            return;
+        }
+        acceptUringConnection(worker, result);
+        return;
+    }
+
+    int slot = URING_USER_DATA_SLOT(userData);
+    struct UringSlotState *slotState = &worker->slots[slot];
+    bool isStale = URING_USER_DATA_GENERATION(userData) != (slotState->generation & 0xFFFFFF);
+    // not stale: the connection is freed only after the last completion of its generation
+    struct QueueConnectionElementType *connection = getConnectionBySlot(worker->queueConnections, slot);
+    if (!isStale && connection == NULL) {
+        die("io_uring completion of the free slot %d", slot);
+    }
+
+    switch (operation) {
+        case URING_OPERATION_RECV: {
+            unsigned short bufferId = flags >> IORING_CQE_BUFFER_SHIFT;
+            if (isStale) {
+                if (flags & IORING_CQE_F_BUFFER) {
+                    uringRecycleBuffer(&worker->bufferRing, bufferId);
+                }
+                return;
+            }
+            if (!(flags & IORING_CQE_F_MORE)) {
+                slotState->recvArmed = false;
+            }
+            if (result == -ECANCELED) {
+                // paused by the spill, armed again if the spill already fits in the request buffer
+                if (!slotState->recvArmed && !slotState->recvPaused && !slotState->closing) {
+                    prepareUringRecv(worker, connection);
+                }
+                return;
+            }
+            if (result == -ENOBUFS) {
+                // no provided buffers left, try again once the buffers are recycled
+                prepareUringRecv(worker, connection);
+                return;
+            }
+            if (result <= 0) {
+                if (result < 0) {
+                    errno = -result;
+                    logError("io_uring recv() request failed. DoneForClose");
+                } else {
+                    logDebug("0 bytes read, client disconnected");
+                }
+                closeUringConnection(worker, connection);
+                return;
+            }
+            char *buffer = uringBuffer(&worker->bufferRing, bufferId);
+            handleUringRecv(worker, connection, buffer, (size_t)result);
+            uringRecycleBuffer(&worker->bufferRing, bufferId);
+            if (!slotState->recvArmed && !slotState->recvPaused && !slotState->closing
+                && getConnectionBySlot(worker->queueConnections, slot)) {
+                prepareUringRecv(worker, connection);
+            }
+            break;
+        }
+        case URING_OPERATION_SEND:
+        case URING_OPERATION_SPLICE_IN:
+        case URING_OPERATION_SPLICE_OUT: {
+            if (isStale) {
+                return;
+            }
+            slotState->outputInFlight = false;
+            if (slotState->closing) {
+                closeUringConnection(worker, connection);
+                return;
+            }
+            if (result < 0) {
+                errno = -result;
+                logError("io_uring send/splice response failed. DoneForClose");
+                closeUringConnection(worker, connection);
+                return;
+            }
+            if (result == 0 && operation != URING_OPERATION_SPLICE_IN) {
+                logDebug("0 bytes send, client disconnected");
+                closeUringConnection(worker, connection);
+                return;
+            }
+            handleUringOutput(worker, connection, operation, (size_t)result);
+            break;
+        }
+    }
+}
+
+// SIGQUIT or upgrade, see drainEpollConnections: the multishot accept is cancelled
+void drainUringConnections(struct UringWorker *worker, bool ownListener) {
+    struct QueueConnectionsType *queueConnections = worker->queueConnections;
+    queueConnections->draining = true;
+    prepareUringCancelAccept(worker);
+    if (ownListener) {
+        // the ring holds its own reference until the accept is cancelled
+        close(worker->socketServerFd);
+    }
+    int slot;
+    for (slot = 0; slot < worker->slotsCount; slot++) {
+        struct QueueConnectionElementType *connection = getConnectionBySlot(queueConnections, slot);
+        if (connection == NULL || worker->slots[slot].closing || connection->state != STATE_CONNECTION_RECV
+            || connection->requestBufferOffset > 0 || connection->request->requests == 0) {
+            continue;
+        }
+        closeUringConnection(worker, connection);
+    }
+}
+
+void acceptUringConnection(struct UringWorker *worker, int clientFd) {
+    logDebug("Connect with the client %d", clientFd);
+
+    // multishot accept doesn't return the address, one getpeername per connection (not per request)
+    struct sockaddr_in clientAddress = {0};
+    socklen_t clientAddressLen = sizeof(clientAddress);
+    if (getpeername(clientFd, (struct sockaddr *)&clientAddress, &clientAddressLen) == -1) {
+        logWarning("getpeername failed");
+    }
+    if (!acquireClientConnection(clientAddress.sin_addr.s_addr)) {
+        logDebug("Too many connections of the client of the fd %d", clientFd);
+        rejectConnection(clientFd, tooManyRequestResponseTemplate);
+        return;
+    }
+    struct QueueConnectionElementType *connection =
+        acceptConnection(worker->queueConnections, clientFd, &clientAddress);
+    if (connection == NULL) {
+        releaseClientConnection(clientAddress.sin_addr.s_addr);
+        rejectConnection(clientFd, serviceUnavailableResponseTemplate);
+        return;
+    }
+    connection->request->clientCounted = true;
+    if (!growUringSlots(worker, connection->slot)) {
+        dequeueConnection(worker->queueConnections, connection);
+        close(clientFd);
+        return;
+    }
+
+    struct UringSlotState *slotState = &worker->slots[connection->slot];
+    unsigned int generation = slotState->generation;
+    memset(slotState, 0, sizeof(struct UringSlotState));
+    slotState->generation = generation;
+    slotState->pipeFds[0] = -1;
+    slotState->pipeFds[1] = -1;
+
+    if (shedConnection(worker->queueConnections)) {
+        // overloaded, the prebuilt 503 is sent without reading the request
+        connection->request->acceptedUs = 0;
+        discardRequest(clientFd);
+        connection->request->responseStatusCode = HTTP_STATUS_SERVICE_UNAVAILABLE;
+        setConnectionDeadline(worker->queueConnections, connection, TIMER_KIND_SEND_STALL);
+        makeUringCannedResponse(worker, connection, serviceUnavailableResponseTemplate);
+        prepareUringSend(worker, connection);
+        return;
+    }
+    prepareUringRecv(worker, connection);
+}
+
+// the slot states follow the connections slab, a new slot is always the next one or a reused one
+bool growUringSlots(struct UringWorker *worker, int slot) {
+    if (slot < worker->slotsCount) {
+        return true;
+    }
+    int slotsCount = (slot / QUEUE_CONNECTIONS_CHUNK_SIZE + 1) * QUEUE_CONNECTIONS_CHUNK_SIZE;
+    struct UringSlotState *slots = realloc(worker->slots, slotsCount * sizeof(struct UringSlotState));
+    if (slots == NULL) {
+        logError("Cannot grow the io_uring slots to %d", slotsCount);
+        return false;
+    }
+    memset(slots + worker->slotsCount, 0, (slotsCount - worker->slotsCount) * sizeof(struct UringSlotState));
+    int i;
+    for (i = worker->slotsCount; i < slotsCount; i++) {
+        slots[i].pipeFds[0] = -1;
+        slots[i].pipeFds[1] = -1;
+    }
+    worker->slots = slots;
+    worker->slotsCount = slotsCount;
+    return true;
+}
+
+/**
+ * The received bytes go to the request buffer, the ones that do not fit (pipelined requests, or a request
+ * sent while its response is in flight) wait in the spill of the slot, in order, until the buffered requests
+ * are answered, like the epoll backend stops reading. A spill of URING_SPILL_PAUSE_SIZE bytes pauses the
+ * multishot recv. A full buffer with nothing answered before it ends its request, complete or too large
+ * (413, 414 or 431).
+ */
+void handleUringRecv(struct UringWorker *worker, struct QueueConnectionElementType *connection, char *data, size_t length) {
+    int clientFd = connection->clientFd;
+    struct UringSlotState *slotState = &worker->slots[connection->slot];
+
+    attachRequestBuffer(worker->queueConnections, connection);
+    size_t copied = 0;
+    if (slotState->spillLength == 0) {
+        size_t available = connection->requestBufferLength - connection->requestBufferOffset - 1;
+        copied = length < available ? length : available;
+        memcpy(connection->requestBuffer + connection->requestBufferOffset, data, copied);
+        connection->requestBufferOffset += copied;
+        connection->requestBuffer[connection->requestBufferOffset] = '\0';
+    }
+    if (copied < length) {
+        char *spill = realloc(slotState->spill, slotState->spillLength + length - copied);
+        if (spill == NULL) {
+            logError("Cannot keep the %lu bytes received on fd %d", length - copied, clientFd);
+            closeUringConnection(worker, connection);
+            return;
+        }
+        memcpy(spill + slotState->spillLength, data + copied, length - copied);
+        slotState->spill = spill;
+        slotState->spillLength += length - copied;
+        if (slotState->spillLength >= URING_SPILL_PAUSE_SIZE && slotState->recvArmed && !slotState->recvPaused) {
+            logDebug("Pause the recv of fd %d with %lu bytes spilled", clientFd, slotState->spillLength);
+            prepareUringCancelRecv(worker, connection);
+        }
+    }
+
+    if (connection->state != STATE_CONNECTION_RECV) {
+        // pipelined, processed when the current response is sent
+        logDebug("Keep %lu bytes received while sending the response on fd %d", length, clientFd);
+        return;
+    }
+    processUringRequest(worker, connection);
+}
+
+// the spilled bytes that fit in the request buffer, once the answered requests are compacted
+void refillUringRequestBuffer(struct UringWorker *worker, struct QueueConnectionElementType *connection) {
+    struct UringSlotState *slotState = &worker->slots[connection->slot];
+    if (slotState->spillLength == 0) {
+        return;
+    }
+    attachRequestBuffer(worker->queueConnections, connection);
+    size_t available = connection->requestBufferLength - connection->requestBufferOffset - 1;
+    size_t length = slotState->spillLength < available ? slotState->spillLength : available;
+    memcpy(connection->requestBuffer + connection->requestBufferOffset, slotState->spill, length);
+    connection->requestBufferOffset += length;
+    connection->requestBuffer[connection->requestBufferOffset] = '\0';
+    slotState->spillLength -= length;
+    memmove(slotState->spill, slotState->spill + length, slotState->spillLength);
+    if (slotState->spillLength == 0) {
+        free(slotState->spill);
+        slotState->spill = NULL;
+        slotState->recvPaused = false;
+    }
+}
+
+// the first request of the buffer, the pipelined requests after it are answered one at a time
+void processUringRequest(struct UringWorker *worker, struct QueueConnectionElementType *connection) {
+    int clientFd = connection->clientFd;
+    size_t requestLength = getRequestLength(connection);
+    if (requestLength == 0) {
+        if (getConnectionDeadline(worker->queueConnections, connection) == TIMER_KIND_IDLE) {
+            // the next request started, the headers have to arrive in time
+            setConnectionDeadline(worker->queueConnections, connection, TIMER_KIND_HEADER_READ);
+        }
+        return;
+    }
+    setConnectionDeadline(worker->queueConnections, connection, TIMER_KIND_SEND_STALL);
+    connection->state = STATE_CONNECTION_SEND_HEADERS;
+
+    logDebug("processRequest with fd %i", clientFd);
+    // the views of the request are used until its response is sent and logged
+    bool isValidRequest = processRequest(connection);
+    if (!takeClientRequest(connection->request->peerAddress.sin_addr.s_addr)) {
+        logDebug(RED "tooManyRequestResponse with fd %i" RESET, clientFd);
+        connection->request->responseStatusCode = HTTP_STATUS_TOO_MANY_REQUESTS;
+        makeUringCannedResponse(worker, connection, tooManyRequestResponseTemplate);
+    } else if (!isValidRequest) {
+        logDebug(RED "badRequestResponse with fd %i" RESET, clientFd);
+        discardRequest(clientFd);
+        connection->request->responseStatusCode = connection->request->parser->errorStatus;
+        makeUringCannedResponse(worker, connection, getBadRequestTemplate(connection->request->parser->errorStatus));
+    } else if (strcmp(connection->request->protocolVersion, "HTTP/1.0") != 0
+               && strcmp(connection->request->protocolVersion, "HTTP/1.1") != 0) {
+        char responseBuffer[1024];
+        snprintf(responseBuffer, 1024, versionNotSupportedResponseTemplate, connection->request->protocolVersion);
+        makeUringCannedResponse(worker, connection, responseBuffer);
+    } else if (strcmp(connection->request->path, "/hello") == 0) {
+        makeUringCannedResponse(worker, connection, helloResponseTemplate);
+    } else {
+        attachResponseBuffer(worker->queueConnections, connection);
+        applyKeepAlivePolicy(worker->queueConnections, connection);
+        makeResponse(connection);
+    }
+
+    prepareUringSend(worker, connection);
+}
+
+// canned responses go through the same send path as the headers, and close the connection after
+void makeUringCannedResponse(struct UringWorker *worker, struct QueueConnectionElementType *connection, char *response) {
+    logRequest(*connection);
+    attachResponseBuffer(worker->queueConnections, connection);
+    strncpy(connection->responseBufferHeaders, response, BUFFER_RESPONSE_SIZE - 1);
+    connection->responseBufferHeaders[BUFFER_RESPONSE_SIZE - 1] = '\0';
+    connection->responseBufferHeadersLength = strlen(connection->responseBufferHeaders);
+    connection->responseBufferHeadersOffset = 0;
+    connection->request->keepAlive = false;
+    connection->state = STATE_CONNECTION_DONE_FOR_CLOSE;
+}
+
+void handleUringOutput(struct UringWorker *worker,
+                       struct QueueConnectionElementType *connection,
+                       int operation,
+                       size_t bytes) {
+    struct UringSlotState *slotState = &worker->slots[connection->slot];
+    if (bytes > 0) {
+        setConnectionDeadline(worker->queueConnections, connection, TIMER_KIND_SEND_STALL);
+        sampleAdmissionDelay(worker->queueConnections, connection);
+    }
+
+    if (operation == URING_OPERATION_SEND) {
+        connection->responseBufferHeadersOffset += bytes;
+        if (connection->responseBufferHeadersOffset < connection->responseBufferHeadersLength) {
+            prepareUringSend(worker, connection);
+            return;
+        }
+        if (connection->state == STATE_CONNECTION_DONE_FOR_CLOSE) {
+            closeUringConnection(worker, connection);
+            return;
+        }
+        connection->state = STATE_CONNECTION_SEND_BODY;
+        connection->responseBufferHeadersOffset = 0;
+    } else if (operation == URING_OPERATION_SPLICE_IN) {
+        if (bytes == 0) {
+            logError("splice() unexpected end of file %s", connection->request->absolutePath);
+            closeUringConnection(worker, connection);
+            return;
+        }
+        connection->bodyOffset += bytes;
+        slotState->pipeBytes = bytes;
+        prepareUringSplice(worker, connection, URING_OPERATION_SPLICE_OUT);
+        return;
+    } else {
+        slotState->pipeBytes -= bytes;
+        if (slotState->pipeBytes > 0) {
+            prepareUringSplice(worker, connection, URING_OPERATION_SPLICE_OUT);
+            return;
+        }
+    }
+
+    // STATE_CONNECTION_SEND_BODY
+    if (connection->bodyFd != -1 && (size_t)connection->bodyOffset < connection->bodyLength) {
+        if (slotState->pipeFds[0] == -1 && !acquireUringPipe(worker, slotState)) {
+            closeUringConnection(worker, connection);
+            return;
+        }
+        prepareUringSplice(worker, connection, URING_OPERATION_SPLICE_IN);
+        return;
+    }
+
+    // STATE_CONNECTION_DONE
+    releaseUringPipe(worker, slotState);
+    if (connection->bodyFd != -1) {
+        close(connection->bodyFd);
+        connection->bodyFd = -1;
+    }
+    connection->bodyOffset = 0;
+    connection->state = STATE_CONNECTION_DONE;
+    logRequest(*connection);
+    if (connection->request->keepAlive == true) {
+        consumeRequestBuffer(connection, getParsedRequestLength(connection->request->parser));
+        updateQueueConnection(worker->queueConnections, connection);
+        refillUringRequestBuffer(worker, connection);
+        if (!slotState->recvArmed && !slotState->recvPaused) {
+            prepareUringRecv(worker, connection);
+        }
+        if (connection->requestBufferOffset > 0) {
+            processUringRequest(worker, connection);
+        }
+    } else {
+        closeUringConnection(worker, connection);
+    }
+}
+
+void closeUringConnection(struct UringWorker *worker, struct QueueConnectionElementType *connection) {
+    int clientFd = connection->clientFd;
+    struct UringSlotState *slotState = &worker->slots[connection->slot];
+
+    // shutdown wakes up the multishot recv and the pending send, they hold a reference to the socket
+    shutdown(clientFd, SHUT_RDWR);
+    if (slotState->outputInFlight) {
+        // the kernel may still read the response buffers, wait for the completion
+        slotState->closing = true;
+        return;
+    }
+    if (slotState->pipeBytes > 0 && slotState->pipeFds[0] != -1) {
+        close(slotState->pipeFds[0]);
+        close(slotState->pipeFds[1]);
+        slotState->pipeFds[0] = -1;
+        slotState->pipeFds[1] = -1;
+        slotState->pipeBytes = 0;
+    }
+    releaseUringPipe(worker, slotState);
+    free(slotState->spill);
+    slotState->spill = NULL;
+    slotState->spillLength = 0;
+
+    dequeueConnection(worker->queueConnections, connection);
+    slotState->generation++;
+    slotState->recvArmed = false;
+    slotState->recvPaused = false;
+    slotState->closing = false;
+    logDebug("Closed connection on descriptor %d", clientFd);
+    close(clientFd);
+}
+
+bool acquireUringPipe(struct UringWorker *worker, struct UringSlotState *slotState) {
+    if (worker->freePipesCount > 0) {
+        worker->freePipesCount--;
+        slotState->pipeFds[0] = worker->freePipes[worker->freePipesCount][0];
+        slotState->pipeFds[1] = worker->freePipes[worker->freePipesCount][1];
+        return true;
+    }
+    if (pipe2(slotState->pipeFds, O_CLOEXEC) == -1) {
+        logError("pipe2() for splice failed");
+        slotState->pipeFds[0] = -1;
+        slotState->pipeFds[1] = -1;
+        return false;
+    }
+    return true;
+}
+
+// an empty pipe goes back to the pool for the next response
+void releaseUringPipe(struct UringWorker *worker, struct UringSlotState *slotState) {
+    if (slotState->pipeFds[0] == -1) {
+        return;
+    }
+    if (slotState->pipeBytes == 0 && worker->freePipesCount < URING_MAX_PIPES) {
+        worker->freePipes[worker->freePipesCount][0] = slotState->pipeFds[0];
+        worker->freePipes[worker->freePipesCount][1] = slotState->pipeFds[1];
+        worker->freePipesCount++;
+    } else {
+        close(slotState->pipeFds[0]);
+        close(slotState->pipeFds[1]);
+    }
+    slotState->pipeFds[0] = -1;
+    slotState->pipeFds[1] = -1;
+    slotState->pipeBytes = 0;
+}
+
+/**
+ * A submission entry for the next operation. When the queue is still full after a submit (the kernel
+ * does not take entries while its completion queue overflows), the operation waits in the backlog of the
+ * worker and is moved to the queue by the next loop iterations, after the completions are reaped.
+ * Nothing is linked, so only the order matters: once there is a backlog, the new operations go after it.
+ */
+struct io_uring_sqe *getUringSqe(struct UringWorker *worker) {
+    struct io_uring_sqe *sqe = worker->backlogCount == 0 ? uringGetSqe(&worker->ring) : NULL;
+    if (sqe != NULL) {
+        return sqe;
+    }
+    if (worker->backlogCount == worker->backlogSize) {
+        int size = worker->backlogSize + URING_BACKLOG_CHUNK_SIZE;
+        struct io_uring_sqe *backlog = realloc(worker->backlog, size * sizeof(struct io_uring_sqe));
+        if (backlog == NULL) {
+            die("realloc io_uring backlog");
+        }
+        worker->backlog = backlog;
+        worker->backlogSize = size;
+    }
+    if (worker->backlogCount == 0) {
+        logWarning("io_uring submission queue is full, the operations wait for the next loop iteration");
+    }
+    sqe = &worker->backlog[worker->backlogCount++];
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    return sqe;
+}
+
+// the operations of the backlog that fit in the submission queue, in the order they were prepared
+void flushUringBacklog(struct UringWorker *worker) {
+    int flushed = 0;
+    while (flushed < worker->backlogCount) {
+        struct io_uring_sqe *sqe = uringGetSqe(&worker->ring);
+        if (sqe == NULL) {
+            break;
+        }
+        *sqe = worker->backlog[flushed++];
+    }
+    worker->backlogCount -= flushed;
+    memmove(worker->backlog, worker->backlog + flushed, worker->backlogCount * sizeof(struct io_uring_sqe));
+}
+
+void prepareUringAccept(struct UringWorker *worker) {
+    struct io_uring_sqe *sqe = getUringSqe(worker);
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = worker->socketServerFd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->user_data = URING_USER_DATA(URING_OPERATION_ACCEPT, 0, worker->socketServerFd);
+}
+
+void prepareUringCancelAccept(struct UringWorker *worker) {
+    struct io_uring_sqe *sqe = getUringSqe(worker);
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = URING_USER_DATA(URING_OPERATION_ACCEPT, 0, worker->socketServerFd);
+    sqe->user_data = URING_USER_DATA(URING_OPERATION_CANCEL, 0, 0);
+}
+
+void prepareUringRecv(struct UringWorker *worker, struct QueueConnectionElementType *connection) {
+    struct UringSlotState *slotState = &worker->slots[connection->slot];
+    struct io_uring_sqe *sqe = getUringSqe(worker);
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = connection->clientFd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = worker->bufferRing.groupId;
+    sqe->user_data = URING_USER_DATA(URING_OPERATION_RECV, slotState->generation, connection->slot);
+    slotState->recvArmed = true;
+}
+
+// stop the multishot recv of the connection, its -ECANCELED completion does not close it
+void prepareUringCancelRecv(struct UringWorker *worker, struct QueueConnectionElementType *connection) {
+    struct UringSlotState *slotState = &worker->slots[connection->slot];
+    struct io_uring_sqe *sqe = getUringSqe(worker);
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = URING_USER_DATA(URING_OPERATION_RECV, slotState->generation, connection->slot);
+    sqe->user_data = URING_USER_DATA(URING_OPERATION_CANCEL, 0, 0);
+    slotState->recvPaused = true;
+}
+
+void prepareUringSend(struct UringWorker *worker, struct QueueConnectionElementType *connection) {
+    struct UringSlotState *slotState = &worker->slots[connection->slot];
+    struct io_uring_sqe *sqe = getUringSqe(worker);
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = connection->clientFd;
+    sqe->addr = (unsigned long long)(connection->responseBufferHeaders + connection->responseBufferHeadersOffset);
+    sqe->len = connection->responseBufferHeadersLength - connection->responseBufferHeadersOffset;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    if (connection->bodyFd != -1 && connection->state != STATE_CONNECTION_DONE_FOR_CLOSE) {
+        // the body follows with splice, the headers wait for its first bytes
+        sqe->msg_flags |= MSG_MORE;
+    }
+    sqe->user_data = URING_USER_DATA(URING_OPERATION_SEND, slotState->generation, connection->slot);
+    slotState->outputInFlight = true;
+}
+
+void prepareUringSplice(struct UringWorker *worker, struct QueueConnectionElementType *connection, int operation) {
+    struct UringSlotState *slotState = &worker->slots[connection->slot];
+    struct io_uring_sqe *sqe = getUringSqe(worker);
+    sqe->opcode = IORING_OP_SPLICE;
+    if (operation == URING_OPERATION_SPLICE_IN) {
+        size_t rest = connection->bodyLength - connection->bodyOffset;
+        sqe->splice_fd_in = connection->bodyFd;
+        sqe->splice_off_in = connection->bodyOffset;
+        sqe->fd = slotState->pipeFds[1];
+        sqe->off = -1;
+        sqe->len = rest < URING_SPLICE_CHUNK_SIZE ? rest : URING_SPLICE_CHUNK_SIZE;
+    } else {
+        sqe->splice_fd_in = slotState->pipeFds[0];
+        sqe->splice_off_in = -1;
+        sqe->fd = connection->clientFd;
+        sqe->off = -1;
+        sqe->len = slotState->pipeBytes;
+    }
+    sqe->splice_flags = SPLICE_F_MOVE;
+    if (operation == URING_OPERATION_SPLICE_OUT && (size_t)connection->bodyOffset < connection->bodyLength) {
+        // more of the body follows, like MSG_MORE
+        sqe->splice_flags |= SPLICE_F_MORE;
+    }
+    sqe->user_data = URING_USER_DATA(operation, slotState->generation, connection->slot);
+    slotState->outputInFlight = true;
+}
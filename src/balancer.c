@@ -0,0 +1,181 @@
+/**
+ *
+ * @brief Balance the connections between the epoll threads (--balance)
+ *
+ * Every thread owns its connections, so an overloaded thread (full queue, or BALANCE_THRESHOLD
+ * connections more than the least loaded one) hands off the new connections and the kept-alive ones
+ * between two requests to the least loaded thread, through its inbox. A thread with few connections
+ * asks the most loaded one to give it some (steal), the victim moves them in its next iteration,
+ * because only the owner can touch its connections.
+ *
+ */
+
+#include <errno.h>       // for errno
+#include <stdint.h>      // for uint64_t
+#include <stdlib.h>      // for malloc()
+#include <sys/eventfd.h> // for eventfd()
+#include <unistd.h>      // for close()
+
+#include "../lib/die/die.h"
+#include "../lib/logger/logger.h"
+#include "balancer.h"
+#include "server.h"
+
+struct BalancerType BALANCER;
+
+void initBalancer(int workers, int capacity) {
+    BALANCER.inboxes = aligned_alloc(64, sizeof(struct WorkerInboxType) * workers);
+    if (BALANCER.inboxes == NULL) {
+        die("Cannot allocate the inboxes of %d threads", workers);
+    }
+    int i;
+    for (i = 0; i < workers; i++) {
+        atomic_init(&BALANCER.inboxes[i].head, NULL);
+        atomic_init(&BALANCER.inboxes[i].load, 0);
+        atomic_init(&BALANCER.inboxes[i].thief, BALANCER_NO_WORKER);
+        BALANCER.inboxes[i].eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (BALANCER.inboxes[i].eventFd == -1) {
+            die("eventfd failed");
+        }
+    }
+    BALANCER.count = workers;
+    BALANCER.capacity = capacity;
+}
+
+// close the connections not received by their thread
+void freeBalancer() {
+    int i;
+    for (i = 0; i < BALANCER.count; i++) {
+        struct HandoffType *handoff = atomic_exchange(&BALANCER.inboxes[i].head, NULL);
+        while (handoff != NULL) {
+            struct HandoffType *next = handoff->next;
+            close(handoff->clientFd);
+            free(handoff);
+            handoff = next;
+        }
+        close(BALANCER.inboxes[i].eventFd);
+    }
+    free(BALANCER.inboxes);
+    BALANCER.inboxes = NULL;
+    BALANCER.count = 0;
+}
+
+int getBalancerEventFd(int worker) { return BALANCER.inboxes[worker].eventFd; }
+
+int getWorkerLoad(int worker) { return atomic_load_explicit(&BALANCER.inboxes[worker].load, memory_order_relaxed); }
+
+void publishWorkerLoad(int worker, int load) {
+    // relaxed, only a hint for the other threads
+    if (atomic_load_explicit(&BALANCER.inboxes[worker].load, memory_order_relaxed) != load) {
+        atomic_store_explicit(&BALANCER.inboxes[worker].load, load, memory_order_relaxed);
+    }
+}
+
+static void wakeUpWorker(int worker) {
+    uint64_t one = 1;
+    if (write(BALANCER.inboxes[worker].eventFd, &one, sizeof(one)) == -1 && errno != EAGAIN) {
+        logWarning("write eventfd of the thread %d failed", worker);
+    }
+}
+
+// the least loaded thread if this one should hand off a connection, else BALANCER_NO_WORKER
+int pickHandoffTarget(int worker, int load) {
+    int target = BALANCER_NO_WORKER;
+    int minLoad = load;
+    int i;
+    for (i = 0; i < BALANCER.count; i++) {
+        int workerLoad = getWorkerLoad(i);
+        if (i != worker && workerLoad < minLoad) {
+            target = i;
+            minLoad = workerLoad;
+        }
+    }
+    if (target == BALANCER_NO_WORKER || minLoad >= BALANCER.capacity) {
+        return BALANCER_NO_WORKER;
+    }
+    if (load >= BALANCER.capacity || load - minLoad > BALANCE_THRESHOLD) {
+        return target;
+    }
+    return BALANCER_NO_WORKER;
+}
+
+// the target owns the descriptor from now on, false if it cannot be pushed
+bool pushHandoff(int target, int clientFd, struct sockaddr_in *peerAddress, bool idle, bool clientCounted) {
+    struct HandoffType *handoff = malloc(sizeof(struct HandoffType));
+    if (handoff == NULL) {
+        logError("Cannot allocate the handoff of the fd %d", clientFd);
+        return false;
+    }
+    handoff->clientFd = clientFd;
+    handoff->idle = idle;
+    handoff->clientCounted = clientCounted;
+    handoff->peerAddress = *peerAddress;
+
+    struct WorkerInboxType *inbox = &BALANCER.inboxes[target];
+    struct HandoffType *head = atomic_load_explicit(&inbox->head, memory_order_relaxed);
+    do {
+        handoff->next = head;
+    } while (!atomic_compare_exchange_weak_explicit(
+        &inbox->head, &head, handoff, memory_order_release, memory_order_relaxed));
+
+    // counted until the owner publishes its load again, so a burst of accepts is spread between the threads
+    atomic_fetch_add_explicit(&inbox->load, 1, memory_order_relaxed);
+
+    // the owner takes the whole stack, it is woken up only by the first push
+    if (head == NULL) {
+        wakeUpWorker(target);
+    }
+    return true;
+}
+
+// the connections handed off to the worker, in arrival order
+struct HandoffType *takeHandoffs(int worker) {
+    struct WorkerInboxType *inbox = &BALANCER.inboxes[worker];
+    uint64_t value;
+    if (read(inbox->eventFd, &value, sizeof(value)) == -1 && errno != EAGAIN) {
+        logWarning("read eventfd of the thread %d failed", worker);
+    }
+
+    struct HandoffType *handoff = atomic_exchange_explicit(&inbox->head, NULL, memory_order_acquire);
+    struct HandoffType *ordered = NULL;
+    while (handoff != NULL) {
+        struct HandoffType *next = handoff->next;
+        handoff->next = ordered;
+        ordered = handoff;
+        handoff = next;
+    }
+    return ordered;
+}
+
+// ask the most loaded thread for connections, true if the request was posted
+bool requestSteal(int worker, int load) {
+    int victim = BALANCER_NO_WORKER;
+    int maxLoad = load;
+    int i;
+    for (i = 0; i < BALANCER.count; i++) {
+        int workerLoad = getWorkerLoad(i);
+        if (i != worker && workerLoad > maxLoad) {
+            victim = i;
+            maxLoad = workerLoad;
+        }
+    }
+    if (victim == BALANCER_NO_WORKER || maxLoad - load <= BALANCE_THRESHOLD) {
+        return false;
+    }
+
+    int noThief = BALANCER_NO_WORKER;
+    if (!atomic_compare_exchange_strong(&BALANCER.inboxes[victim].thief, &noThief, worker)) {
+        return false; // another thread is already served
+    }
+    wakeUpWorker(victim);
+    return true;
+}
+
+// the worker that asked this one for connections, BALANCER_NO_WORKER if none
+int takeStealRequest(int worker) {
+    struct WorkerInboxType *inbox = &BALANCER.inboxes[worker];
+    if (atomic_load_explicit(&inbox->thief, memory_order_relaxed) == BALANCER_NO_WORKER) {
+        return BALANCER_NO_WORKER;
+    }
+    return atomic_exchange(&inbox->thief, BALANCER_NO_WORKER);
+}
@@ -0,0 +1,99 @@
+/**
+ *
+ * @brief Output bandwidth shaping of the responses (--limit-rate, --limit-rate-after, --limit-rate-total)
+ *
+ * A throttled connection does not sleep nor poll: it gets the bytes its limits allow in this turn,
+ * and when there are none its timer in the timing wheel resumes the transfer when there are, meanwhile
+ * it costs nothing to the event loop. The smallest allowance is one tick of the wheel at the rate,
+ * so a slow transfer is not split in tiny sends.
+ *
+ */
+
+#include "bandwidth.h"
+#include "timing_wheel.h"
+
+#define BANDWIDTH_TICK_US (TIMING_WHEEL_TICK_MS * 1000ULL)
+
+struct BandwidthLimitsType BANDWIDTH;
+
+void initBandwidthLimits(unsigned long long connectionRate,
+                         unsigned long long connectionBurst,
+                         unsigned long long totalRate) {
+    BANDWIDTH.connectionRate = connectionRate;
+    BANDWIDTH.connectionBurstUs = connectionRate > 0 ? connectionBurst * 1000000 / connectionRate : 0;
+    BANDWIDTH.totalRate = totalRate;
+    BANDWIDTH.totalBurstUs = BANDWIDTH_TOTAL_BURST_MS * 1000ULL;
+    atomic_store(&BANDWIDTH.totalNextUs, 0);
+    BANDWIDTH.enabled = connectionRate > 0 || totalRate > 0;
+}
+
+// bytes a limit allows now, or 0 and the wait until it allows a tick of its rate
+static size_t getLimitAllowance(unsigned long long nextUs,
+                                unsigned long long rate,
+                                unsigned long long burstUs,
+                                unsigned long long nowUs,
+                                unsigned long long *waitUs) {
+    unsigned long long start = nextUs > nowUs ? nextUs : nowUs;
+    // two ticks ahead, the timer of a throttled connection can fire a tick late
+    unsigned long long end = nowUs + burstUs + 2 * BANDWIDTH_TICK_US;
+    if (start + BANDWIDTH_TICK_US > end) {
+        *waitUs = start + BANDWIDTH_TICK_US - end;
+        return 0;
+    }
+    return (size_t)((end - start) * rate / 1000000);
+}
+
+// the bytes that can be sent now, at most the quantum; 0 if the connection has to wait waitUs
+size_t getBandwidthAllowance(unsigned long long connectionNextUs,
+                             unsigned long long nowUs,
+                             size_t quantum,
+                             unsigned long long *waitUs) {
+    size_t allowance = quantum;
+    *waitUs = 0;
+    if (BANDWIDTH.connectionRate > 0) {
+        size_t bytes = getLimitAllowance(
+            connectionNextUs, BANDWIDTH.connectionRate, BANDWIDTH.connectionBurstUs, nowUs, waitUs);
+        if (bytes < allowance) {
+            allowance = bytes;
+        }
+    }
+    if (BANDWIDTH.totalRate > 0) {
+        unsigned long long totalWaitUs = 0;
+        size_t bytes = getLimitAllowance(atomic_load_explicit(&BANDWIDTH.totalNextUs, memory_order_relaxed),
+                                         BANDWIDTH.totalRate,
+                                         BANDWIDTH.totalBurstUs,
+                                         nowUs,
+                                         &totalWaitUs);
+        if (bytes < allowance) {
+            allowance = bytes;
+        }
+        if (totalWaitUs > *waitUs) {
+            *waitUs = totalWaitUs;
+        }
+    }
+    return allowance;
+}
+
+static unsigned long long getBandwidthCost(size_t bytes, unsigned long long rate) {
+    return ((unsigned long long)bytes * 1000000 + rate - 1) / rate;
+}
+
+/**
+ * Move the schedules by the bytes actually sent. The threads read the process schedule before
+ * sending, so it can be overrun by the quanta of the threads at once, and that is paid by the next sends.
+ */
+void chargeBandwidth(unsigned long long *connectionNextUs, size_t bytes, unsigned long long nowUs) {
+    if (BANDWIDTH.connectionRate > 0) {
+        unsigned long long start = *connectionNextUs > nowUs ? *connectionNextUs : nowUs;
+        *connectionNextUs = start + getBandwidthCost(bytes, BANDWIDTH.connectionRate);
+    }
+    if (BANDWIDTH.totalRate > 0) {
+        unsigned long long cost = getBandwidthCost(bytes, BANDWIDTH.totalRate);
+        unsigned long long nextUs = atomic_load_explicit(&BANDWIDTH.totalNextUs, memory_order_relaxed);
+        unsigned long long start;
+        do {
+            start = nextUs > nowUs ? nextUs : nowUs;
+        } while (!atomic_compare_exchange_weak_explicit(
+            &BANDWIDTH.totalNextUs, &nextUs, start + cost, memory_order_relaxed, memory_order_relaxed));
+    }
+}
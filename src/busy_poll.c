@@ -0,0 +1,85 @@
+/**
+ *
+ * @brief Low latency mode (--busy-poll): the loops spin before they sleep
+ *
+ * A thread that runs out of events polls without blocking (epoll_wait with a zero timeout, or the completion
+ * queue of its ring, without any system call) for --busy-poll microseconds before the blocking wait, so a
+ * request that arrives meanwhile is served without the wakeup of a sleeping thread. The listener gets
+ * SO_BUSY_POLL and SO_PREFER_BUSY_POLL, inherited by the accepted sockets, so the kernel also polls the
+ * device queue of the connection when the driver supports it (NAPI). It trades the idle CPU for the latency,
+ * for dedicated cores: --reuseport or --cpus pin every thread to its own one.
+ *
+ */
+
+#include <errno.h>      // for errno
+#include <sys/socket.h> // for setsockopt()
+
+#include "../lib/logger/logger.h"
+#include "busy_poll.h"
+#include "codel.h"
+#include "options.h"
+#include "server.h"
+
+// on the listener, before accept: the accepted sockets inherit both options
+void setBusyPollSocket(int socketFd) {
+    if (OPTIONS.busyPoll == 0) {
+        return;
+    }
+    int busyPoll = OPTIONS.busyPoll;
+    // above net.core.busy_read it needs CAP_NET_ADMIN, the loops spin anyway
+    if (setsockopt(socketFd, SOL_SOCKET, SO_BUSY_POLL, &busyPoll, sizeof(busyPoll)) == -1) {
+        logWarning("setsockopt SO_BUSY_POLL %d failed", busyPoll);
+    }
+    int enable = 1;
+    if (setsockopt(socketFd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &enable, sizeof(enable)) == -1 && errno != ENOPROTOOPT) {
+        logWarning("setsockopt SO_PREFER_BUSY_POLL failed");
+    }
+}
+
+// the spin stops at the end of the budget, at the timeout of the loop or with a signal for the loop
+static bool keepBusyPolling(unsigned long long startUs, unsigned long long budgetUs) {
+    return !sigintReceived && !sigquitReceived && monotonicMicroseconds() - startUs < budgetUs;
+}
+
+/**
+ * epoll_wait with --busy-poll: non-blocking polls until there are events, then the blocking wait for the
+ * rest of the timeout (milliseconds, -1 forever).
+ */
+int busyPollEpoll(int epollFd, struct epoll_event *events, int maxEvents, int timeout) {
+    if (OPTIONS.busyPoll == 0 || timeout == 0) {
+        return epoll_wait(epollFd, events, maxEvents, timeout);
+    }
+    unsigned long long startUs = monotonicMicroseconds();
+    unsigned long long budgetUs = OPTIONS.busyPoll;
+    if (timeout > 0 && (unsigned long long)timeout * 1000 < budgetUs) {
+        budgetUs = (unsigned long long)timeout * 1000;
+    }
+    do {
+        int ready = epoll_wait(epollFd, events, maxEvents, 0);
+        if (ready != 0) {
+            return ready;
+        }
+    } while (keepBusyPolling(startUs, budgetUs));
+    if (timeout > 0) {
+        int spentMs = (int)((monotonicMicroseconds() - startUs) / 1000);
+        timeout = spentMs < timeout ? timeout - spentMs : 0;
+    }
+    return epoll_wait(epollFd, events, maxEvents, timeout);
+}
+
+// io_uring with --busy-poll: after the submission, true when a completion arrived while spinning
+bool busyPollUring(struct Uring *ring) {
+    if (OPTIONS.busyPoll == 0) {
+        return false;
+    }
+    if (uringSubmit(ring) < 0 && errno != EINTR) {
+        logWarning("io_uring_enter failed");
+    }
+    unsigned long long startUs = monotonicMicroseconds();
+    do {
+        if (uringPeekCqe(ring) != NULL) {
+            return true;
+        }
+    } while (keepBusyPolling(startUs, OPTIONS.busyPoll));
+    return false;
+}
@@ -0,0 +1,216 @@
+/**
+ *
+ * @brief Per client limits: requests per second (token bucket) and concurrent connections
+ *
+ * The clients are keyed by the binary peer address captured by accept, in a table shared by all the
+ * threads (the connections of one client are spread between them) and split in shards by the hash
+ * of the address. The bucket of a client holds one second of requests and is refilled on use,
+ * there is no timer per client.
+ *
+ */
+
+#include <stdlib.h> // for calloc()
+#include <string.h> // for memset()
+
+#include "../lib/die/die.h"
+#include "client_limits.h"
+#include "timing_wheel.h"
+
+struct ClientLimitsType CLIENT_LIMITS;
+
+// multiplicative hash, the high bits select the shard and the next ones the bucket
+static uint32_t hashAddress(in_addr_t address) { return (uint32_t)address * 2654435761u; }
+
+static struct ClientShardType *getClientShard(uint32_t hash) {
+    return &CLIENT_LIMITS.shards[hash >> (32 - CLIENT_LIMITS_SHARD_BITS)];
+}
+
+static uint32_t getClientBucket(struct ClientShardType *shard, uint32_t hash) {
+    return (hash >> 10) & (shard->capacity - 1);
+}
+
+void initClientLimits(int requestsPerSecond, int connections, uint32_t entries) {
+    CLIENT_LIMITS.requestsPerSecond = requestsPerSecond;
+    CLIENT_LIMITS.connections = connections;
+    CLIENT_LIMITS.enabled = requestsPerSecond > 0 || connections > 0;
+    if (!CLIENT_LIMITS.enabled) {
+        return;
+    }
+
+    uint32_t capacity = 16;
+    while (capacity * CLIENT_LIMITS_SHARDS < entries) {
+        capacity *= 2;
+    }
+    int i;
+    for (i = 0; i < CLIENT_LIMITS_SHARDS; i++) {
+        struct ClientShardType *shard = &CLIENT_LIMITS.shards[i];
+        pthread_spin_init(&shard->lock, PTHREAD_PROCESS_PRIVATE);
+        shard->entries = calloc(capacity, sizeof(struct ClientEntryType));
+        shard->buckets = malloc(capacity * sizeof(uint32_t));
+        if (shard->entries == NULL || shard->buckets == NULL) {
+            die("Cannot allocate the client limits table");
+        }
+        memset(shard->buckets, 0xff, capacity * sizeof(uint32_t)); // CLIENT_LIMITS_NONE
+        shard->count = 0;
+        shard->capacity = capacity;
+        shard->lruHead = CLIENT_LIMITS_NONE;
+        shard->lruTail = CLIENT_LIMITS_NONE;
+    }
+}
+
+void freeClientLimits() {
+    if (!CLIENT_LIMITS.enabled) {
+        return;
+    }
+    int i;
+    for (i = 0; i < CLIENT_LIMITS_SHARDS; i++) {
+        struct ClientShardType *shard = &CLIENT_LIMITS.shards[i];
+        pthread_spin_destroy(&shard->lock);
+        free(shard->entries);
+        free(shard->buckets);
+        shard->entries = NULL;
+        shard->buckets = NULL;
+    }
+    CLIENT_LIMITS.enabled = false;
+}
+
+static void unlinkClientLru(struct ClientShardType *shard, uint32_t index) {
+    struct ClientEntryType *entry = &shard->entries[index];
+    if (entry->lruPrev != CLIENT_LIMITS_NONE) {
+        shard->entries[entry->lruPrev].lruNext = entry->lruNext;
+    } else {
+        shard->lruHead = entry->lruNext;
+    }
+    if (entry->lruNext != CLIENT_LIMITS_NONE) {
+        shard->entries[entry->lruNext].lruPrev = entry->lruPrev;
+    } else {
+        shard->lruTail = entry->lruPrev;
+    }
+}
+
+static void pushClientLru(struct ClientShardType *shard, uint32_t index) {
+    struct ClientEntryType *entry = &shard->entries[index];
+    entry->lruPrev = CLIENT_LIMITS_NONE;
+    entry->lruNext = shard->lruHead;
+    if (shard->lruHead != CLIENT_LIMITS_NONE) {
+        shard->entries[shard->lruHead].lruPrev = index;
+    } else {
+        shard->lruTail = index;
+    }
+    shard->lruHead = index;
+}
+
+static uint32_t findClient(struct ClientShardType *shard, uint32_t bucket, in_addr_t address) {
+    uint32_t index = shard->buckets[bucket];
+    while (index != CLIENT_LIMITS_NONE && shard->entries[index].address != address) {
+        index = shard->entries[index].next;
+    }
+    return index;
+}
+
+// the least recently used client without connections (or the last one) leaves its entry to the new one
+static uint32_t evictClient(struct ClientShardType *shard) {
+    uint32_t victim = shard->lruTail;
+    uint32_t index = shard->lruTail;
+    int i;
+    for (i = 0; i < CLIENT_LIMITS_EVICT_SCAN && index != CLIENT_LIMITS_NONE; i++) {
+        if (shard->entries[index].connections == 0) {
+            victim = index;
+            break;
+        }
+        index = shard->entries[index].lruPrev;
+    }
+
+    uint32_t *link = &shard->buckets[getClientBucket(shard, hashAddress(shard->entries[victim].address))];
+    while (*link != victim) {
+        link = &shard->entries[*link].next;
+    }
+    *link = shard->entries[victim].next;
+    unlinkClientLru(shard, victim);
+    return victim;
+}
+
+// the entry of the client, created with a full bucket if it is not in the table, the shard has to be locked
+static struct ClientEntryType *getClient(struct ClientShardType *shard,
+                                         uint32_t hash,
+                                         in_addr_t address,
+                                         unsigned long long nowMs) {
+    uint32_t bucket = getClientBucket(shard, hash);
+    uint32_t index = findClient(shard, bucket, address);
+    if (index != CLIENT_LIMITS_NONE) {
+        if (shard->lruHead != index) {
+            unlinkClientLru(shard, index);
+            pushClientLru(shard, index);
+        }
+        return &shard->entries[index];
+    }
+
+    index = shard->count < shard->capacity ? shard->count++ : evictClient(shard);
+    struct ClientEntryType *entry = &shard->entries[index];
+    entry->address = address;
+    entry->connections = 0;
+    entry->tokens = (uint32_t)CLIENT_LIMITS.requestsPerSecond * 1000;
+    entry->refillMs = nowMs;
+    entry->next = shard->buckets[bucket];
+    shard->buckets[bucket] = index;
+    pushClientLru(shard, index);
+    return entry;
+}
+
+// false if the client already has the max concurrent connections
+bool acquireClientConnection(in_addr_t address) {
+    if (CLIENT_LIMITS.connections == 0) {
+        return true;
+    }
+    uint32_t hash = hashAddress(address);
+    struct ClientShardType *shard = getClientShard(hash);
+    pthread_spin_lock(&shard->lock);
+    struct ClientEntryType *entry = getClient(shard, hash, address, monotonicMilliseconds());
+    bool acquired = entry->connections < CLIENT_LIMITS.connections;
+    if (acquired) {
+        entry->connections++;
+    }
+    pthread_spin_unlock(&shard->lock);
+    return acquired;
+}
+
+void releaseClientConnection(in_addr_t address) {
+    if (CLIENT_LIMITS.connections == 0) {
+        return;
+    }
+    uint32_t hash = hashAddress(address);
+    struct ClientShardType *shard = getClientShard(hash);
+    pthread_spin_lock(&shard->lock);
+    // the client may have been evicted meanwhile
+    uint32_t index = findClient(shard, getClientBucket(shard, hash), address);
+    if (index != CLIENT_LIMITS_NONE && shard->entries[index].connections > 0) {
+        shard->entries[index].connections--;
+    }
+    pthread_spin_unlock(&shard->lock);
+}
+
+// false if the client has no request left in its bucket
+bool takeClientRequest(in_addr_t address) {
+    if (CLIENT_LIMITS.requestsPerSecond == 0) {
+        return true;
+    }
+    uint32_t hash = hashAddress(address);
+    struct ClientShardType *shard = getClientShard(hash);
+    unsigned long long now = monotonicMilliseconds();
+    pthread_spin_lock(&shard->lock);
+    struct ClientEntryType *entry = getClient(shard, hash, address, now);
+    // requests per second = thousandths of a request per millisecond
+    unsigned long long capacity = (unsigned long long)CLIENT_LIMITS.requestsPerSecond * 1000;
+    unsigned long long tokens = entry->tokens;
+    if (now > entry->refillMs) {
+        tokens += (now - entry->refillMs) * CLIENT_LIMITS.requestsPerSecond;
+        entry->refillMs = now;
+    }
+    entry->tokens = tokens < capacity ? (uint32_t)tokens : (uint32_t)capacity;
+    bool taken = entry->tokens >= 1000;
+    if (taken) {
+        entry->tokens -= 1000;
+    }
+    pthread_spin_unlock(&shard->lock);
+    return taken;
+}
@@ -0,0 +1,87 @@
+/**
+ *
+ * @brief CoDel overload shedding of the new connections (--codel-target)
+ *
+ * The rejected connections get a prebuilt 503 with Retry-After before any read, parse or open,
+ * so during a spike the admitted traffic keeps its latency instead of everyone waiting
+ * for a timeout. The clock is CLOCK_MONOTONIC (vDSO), the coarse one of the timing wheel has
+ * the resolution of a jiffy, too close to the target.
+ *
+ */
+
+#include <time.h> // for clock_gettime()
+
+#include "codel.h"
+
+unsigned long long monotonicMicroseconds() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long long)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+// interval / sqrt(count) after time, the rejections get closer while the overload lasts
+static unsigned long long controlLaw(struct CodelType *codel, unsigned long long time) {
+    unsigned int root = 1;
+    while ((root + 1) * (root + 1) <= codel->count) {
+        root++;
+    }
+    return time + codel->interval / root;
+}
+
+void initCodel(struct CodelType *codel, unsigned long long targetUs, unsigned long long intervalUs) {
+    codel->target = targetUs;
+    codel->interval = intervalUs;
+    codel->firstAboveTime = 0;
+    codel->lastSample = 0;
+    codel->dropNext = 0;
+    codel->count = 0;
+    codel->lastCount = 0;
+    codel->overloaded = false;
+    codel->dropping = false;
+}
+
+void sampleCodel(struct CodelType *codel, unsigned long long sojournUs, unsigned long long nowUs) {
+    codel->lastSample = nowUs;
+    if (sojournUs < codel->target) {
+        codel->firstAboveTime = 0;
+        codel->overloaded = false;
+        return;
+    }
+    if (codel->firstAboveTime == 0) {
+        codel->firstAboveTime = nowUs + codel->interval;
+    } else if (nowUs >= codel->firstAboveTime) {
+        codel->overloaded = true;
+    }
+}
+
+// true if the new connection has to be rejected
+bool shedCodel(struct CodelType *codel, unsigned long long nowUs) {
+    if (codel->target == 0) {
+        return false;
+    }
+    if (codel->overloaded && nowUs - codel->lastSample > codel->interval) {
+        // no connection was served during an interval, the delay is not known anymore
+        codel->overloaded = false;
+        codel->firstAboveTime = 0;
+    }
+    if (!codel->overloaded) {
+        codel->dropping = false;
+        return false;
+    }
+
+    if (!codel->dropping) {
+        codel->dropping = true;
+        // a new overload shortly after the previous one starts at its last rate
+        unsigned int delta = codel->count - codel->lastCount;
+        codel->count = delta > 1 && nowUs - codel->dropNext < 16 * codel->interval ? delta : 1;
+        codel->lastCount = codel->count;
+        codel->dropNext = controlLaw(codel, nowUs);
+        return true;
+    }
+    if (nowUs >= codel->dropNext) {
+        codel->count++;
+        codel->dropNext = controlLaw(codel, codel->dropNext);
+        return true;
+    }
+    return false;
+}
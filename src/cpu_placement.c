@@ -0,0 +1,124 @@
+/**
+ *
+ * @brief How many epoll threads, and on which CPUs (--threads, --cpus)
+ *
+ * By default there is one thread per CPU the process may run on (its affinity, so the cpuset of its cgroup),
+ * and not more than the CPU quota of the cgroup v2 `cpu.max`: a container limited to 2 CPUs of a large host
+ * runs 2 threads, instead of a thread per host CPU throttled by the quota at the end of every period.
+ * A pinned thread allocates its memory on its own NUMA node (MPOL_LOCAL), as its connections table,
+ * buffers and pools are allocated and first touched by the thread itself.
+ *
+ */
+
+#include <errno.h>          // for errno
+#include <linux/mempolicy.h> // for MPOL_LOCAL
+#include <stdio.h>          // for snprintf() and sscanf()
+#include <string.h>         // for strncmp()
+#include <sys/syscall.h>    // for SYS_set_mempolicy
+#include <unistd.h>         // for syscall()
+
+#include "../lib/die/die.h"
+#include "../lib/logger/logger.h"
+#include "cpu_placement.h"
+#include "helper.h"
+#include "options.h"
+
+// the CPUs of --cpus, or the ones the process is allowed to run on; the count
+int getServerCpus(cpu_set_t *cpuSet) {
+    if (OPTIONS.cpus[0] != '\0') {
+        return parseCpuList(OPTIONS.cpus, cpuSet);
+    }
+    if (sched_getaffinity(0, sizeof(cpu_set_t), cpuSet) == -1) {
+        logWarning("sched_getaffinity failed");
+        CPU_ZERO(cpuSet);
+        long nCpus = sysconf(_SC_NPROCESSORS_ONLN);
+        long cpu;
+        for (cpu = 0; cpu < nCpus && cpu < CPU_SETSIZE; cpu++) {
+            CPU_SET(cpu, cpuSet);
+        }
+    }
+    return CPU_COUNT(cpuSet);
+}
+
+// the cgroup v2 of the process, the path under the cgroup root ("/" in a cgroup namespace)
+static bool getCgroupPath(char *path, size_t pathSize) {
+    char content[CPU_PLACEMENT_PATH_MAX];
+    if (!readFileString("/proc/self/cgroup", content, sizeof(content))) {
+        return false;
+    }
+    char *line = content;
+    while (line != NULL && *line != '\0') {
+        if (strncmp(line, "0::", 3) == 0) {
+            char *end = strchr(line, '\n');
+            size_t length = end != NULL ? (size_t)(end - line - 3) : strlen(line + 3);
+            if (length == 0 || length >= pathSize) {
+                return false;
+            }
+            memcpy(path, line + 3, length);
+            path[length] = '\0';
+            return true;
+        }
+        line = strchr(line, '\n');
+        line = line != NULL ? line + 1 : NULL;
+    }
+    return false;
+}
+
+/**
+ * CPUs of the quota of the cgroup v2 (cpu.max), rounded up, 0 if unlimited. The quota of every
+ * ancestor applies too, the smallest one is the limit.
+ */
+int getCgroupCpuLimit() {
+    char path[CPU_PLACEMENT_PATH_MAX];
+    if (!getCgroupPath(path, sizeof(path))) {
+        return 0;
+    }
+    int limit = 0;
+    while (true) {
+        char file[CPU_PLACEMENT_PATH_MAX + sizeof(CPU_PLACEMENT_CGROUP_ROOT) + 16];
+        snprintf(file, sizeof(file), "%s%s/cpu.max", CPU_PLACEMENT_CGROUP_ROOT, strcmp(path, "/") == 0 ? "" : path);
+        char content[64];
+        long long quota;
+        long long period;
+        // "max 100000" when unlimited
+        if (readFileString(file, content, sizeof(content)) && sscanf(content, "%lld %lld", &quota, &period) == 2
+            && quota > 0 && period > 0) {
+            int cpus = (int)((quota + period - 1) / period);
+            if (limit == 0 || cpus < limit) {
+                limit = cpus;
+            }
+        }
+        char *slash = strrchr(path, '/');
+        if (slash == NULL || strcmp(path, "/") == 0) {
+            break;
+        }
+        if (slash == path) {
+            path[1] = '\0';
+        } else {
+            *slash = '\0';
+        }
+    }
+    return limit;
+}
+
+// the epoll threads of the server: --threads, or one per allowed CPU within the cgroup quota
+int getServerThreads() {
+    if (OPTIONS.threads > 0) {
+        return OPTIONS.threads;
+    }
+    cpu_set_t cpuSet;
+    int threads = getServerCpus(&cpuSet);
+    int limit = getCgroupCpuLimit();
+    if (limit > 0 && limit < threads) {
+        logInfo("cgroup CPU quota of %d CPUs, %d threads instead of %d", limit, limit, threads);
+        threads = limit;
+    }
+    return threads > 0 ? threads : 1;
+}
+
+// the memory of the calling thread comes from its NUMA node, whatever the policy of the process (numactl...)
+void setLocalMemoryPolicy() {
+    if (syscall(SYS_set_mempolicy, MPOL_LOCAL, NULL, 0) == -1 && errno != ENOSYS) {
+        logWarning("set_mempolicy MPOL_LOCAL failed");
+    }
+}
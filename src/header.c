@@ -1,53 +1,140 @@
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
+#include <stdio.h>  // for printf()
+#include <string.h> // for memcmp() and strlen()
 
 #include "header.h"
-#include "helper.h"
-
-// add header
-struct Header *addHeader(struct Header *header, char *name, char *value) {
-    struct Header *newHeader = malloc(sizeof(struct Header));
-    newHeader->name = strdup(name);
-    newHeader->value =  strdup(value);
-
-    if (header == NULL) {
-        newHeader->next = NULL;
-        header = newHeader;
-    }else{       
-        newHeader->next = header->next; 
-        header->next = newHeader;
-    }
-   
-    return header;
-}
 
-char *getHeader(struct Header *header, char *name) {
-    while (header != NULL) {
-        if (strcmp(header->name, name) == 0) {
-            return header->value;
-        }
-        header = header->next;
+#define HEADER_NAME(id, name) [id] = {name, sizeof(name) - 1}
+
+static const struct {
+    const char *name;
+    size_t length;
+} headerNames[HEADER_IDS] = {
+    HEADER_NAME(HEADER_ACCEPT, "accept"),
+    HEADER_NAME(HEADER_ACCEPT_CHARSET, "accept-charset"),
+    HEADER_NAME(HEADER_ACCEPT_ENCODING, "accept-encoding"),
+    HEADER_NAME(HEADER_ACCEPT_LANGUAGE, "accept-language"),
+    HEADER_NAME(HEADER_AUTHORIZATION, "authorization"),
+    HEADER_NAME(HEADER_CACHE_CONTROL, "cache-control"),
+    HEADER_NAME(HEADER_CONNECTION, "connection"),
+    HEADER_NAME(HEADER_CONTENT_LENGTH, "content-length"),
+    HEADER_NAME(HEADER_CONTENT_TYPE, "content-type"),
+    HEADER_NAME(HEADER_COOKIE, "cookie"),
+    HEADER_NAME(HEADER_EXPECT, "expect"),
+    HEADER_NAME(HEADER_HOST, "host"),
+    HEADER_NAME(HEADER_IF_MODIFIED_SINCE, "if-modified-since"),
+    HEADER_NAME(HEADER_IF_NONE_MATCH, "if-none-match"),
+    HEADER_NAME(HEADER_IF_RANGE, "if-range"),
+    HEADER_NAME(HEADER_KEEP_ALIVE, "keep-alive"),
+    HEADER_NAME(HEADER_ORIGIN, "origin"),
+    HEADER_NAME(HEADER_PRAGMA, "pragma"),
+    HEADER_NAME(HEADER_RANGE, "range"),
+    HEADER_NAME(HEADER_REFERER, "referer"),
+    HEADER_NAME(HEADER_TE, "te"),
+    HEADER_NAME(HEADER_TRANSFER_ENCODING, "transfer-encoding"),
+    HEADER_NAME(HEADER_UPGRADE, "upgrade"),
+    HEADER_NAME(HEADER_USER_AGENT, "user-agent"),
+    HEADER_NAME(HEADER_X_FORWARDED_FOR, "x-forwarded-for"),
+};
+
+/**
+ * Perfect hash of the well-known names: the length, the first two bytes and the last one, multiplied by
+ * HEADER_HASH_MULTIPLIER, and the top HEADER_HASH_BITS bits of the product are the slot. The multiplier is the
+ * first odd number from 0x9E3779B1 without two names in the same slot, a new name needs the search again
+ * (and a slot is only a candidate, the name is compared).
+ */
+static const uint8_t headerSlots[1 << HEADER_HASH_BITS] = {
+    [2] = HEADER_HOST,
+    [5] = HEADER_CONTENT_LENGTH,
+    [6] = HEADER_IF_NONE_MATCH,
+    [9] = HEADER_CONNECTION,
+    [14] = HEADER_CACHE_CONTROL,
+    [15] = HEADER_PRAGMA,
+    [16] = HEADER_RANGE,
+    [18] = HEADER_EXPECT,
+    [19] = HEADER_ACCEPT_ENCODING,
+    [20] = HEADER_IF_MODIFIED_SINCE,
+    [23] = HEADER_REFERER,
+    [27] = HEADER_TRANSFER_ENCODING,
+    [30] = HEADER_ACCEPT_CHARSET,
+    [34] = HEADER_ACCEPT,
+    [36] = HEADER_X_FORWARDED_FOR,
+    [37] = HEADER_CONTENT_TYPE,
+    [41] = HEADER_USER_AGENT,
+    [43] = HEADER_AUTHORIZATION,
+    [48] = HEADER_IF_RANGE,
+    [50] = HEADER_ACCEPT_LANGUAGE,
+    [52] = HEADER_ORIGIN,
+    [56] = HEADER_COOKIE,
+    [57] = HEADER_KEEP_ALIVE,
+    [58] = HEADER_TE,
+    [59] = HEADER_UPGRADE,
+};
+
+// the id of a lower case header name, HEADER_UNKNOWN if it is not a well-known one
+enum HeaderId getHeaderId(const char *name, size_t length) {
+    if (length < 2 || length > UINT8_MAX) {
+        return HEADER_UNKNOWN;
     }
-    return NULL;
+    uint32_t key = (uint32_t)length | (uint32_t)(unsigned char)name[0] << 8 | (uint32_t)(unsigned char)name[1] << 16
+                   | (uint32_t)(unsigned char)name[length - 1] << 24;
+    enum HeaderId id = headerSlots[(key * HEADER_HASH_MULTIPLIER) >> (32 - HEADER_HASH_BITS)];
+    if (id == HEADER_UNKNOWN || headerNames[id].length != length || memcmp(headerNames[id].name, name, length) != 0) {
+        return HEADER_UNKNOWN;
+    }
+    return id;
 }
 
+void initHeaderTable(struct HeaderTableType *table) {
+    table->count = 0;
+    memset(table->known, 0, sizeof(table->known));
+}
 
-void freeHeader(struct Header *header) {
+// false if the table is full
+bool addHeader(struct HeaderTableType *table, struct RequestViewType name, struct RequestViewType value, enum HeaderId id) {
+    if (table->count == REQUEST_HEADERS_MAX) {
+        return false;
+    }
+    struct HeaderViewType *header = &table->headers[table->count];
+    header->name = name;
+    header->value = value;
+    header->id = (uint8_t)id;
+    table->count++;
+    if (id != HEADER_UNKNOWN && table->known[id] == 0) {
+        table->known[id] = (uint8_t)table->count;
+    }
+    return true;
+}
 
-    while (header != NULL) {
-        struct Header *tmp = header;
-        header = header->next;
-        free(tmp->name);
-        free(tmp->value);
-        free(tmp);
+// the value of the first header with the id, NULL if the request does not have it
+char *getHeaderById(struct HeaderTableType *table, char *data, enum HeaderId id) {
+    int index = table->known[id];
+    if (index == 0) {
+        return NULL;
     }
+    return data + table->headers[index - 1].value.offset;
+}
 
+// the value of the first header with the name (lower case), NULL if the request does not have it
+char *getHeader(struct HeaderTableType *table, char *data, const char *name) {
+    size_t nameLength = strlen(name);
+    enum HeaderId id = getHeaderId(name, nameLength);
+    if (id != HEADER_UNKNOWN) {
+        return getHeaderById(table, data, id);
+    }
+    int i;
+    for (i = 0; i < table->count; i++) {
+        struct HeaderViewType *header = &table->headers[i];
+        if (header->id == HEADER_UNKNOWN && header->name.length == nameLength
+            && memcmp(data + header->name.offset, name, nameLength) == 0) {
+            return data + header->value.offset;
+        }
+    }
+    return NULL;
 }
 
-void printHeaders(struct Header *header) {
-    while (header != NULL) {
-        printf("%s: %s\n", header->name, header->value);
-        header = header->next;
+void printHeaders(struct HeaderTableType *table, char *data) {
+    int i;
+    for (i = 0; i < table->count; i++) {
+        printf("%s: %s\n", data + table->headers[i].name.offset, data + table->headers[i].value.offset);
     }
-}
\ No newline at end of file
+}
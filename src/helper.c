@@ -1,14 +1,17 @@
-#include <ctype.h>      // for tolower()
+#include <arpa/inet.h>  // for inet_ntop()
+#include <ctype.h>      // for toupper()
 #include <errno.h>      // for errno
 #include <fcntl.h>      // for fcntl() nonblocking socket
 #include <stdio.h>      // for perror()
 #include <stdlib.h>     // for malloc()
 #include <string.h>     // for strlen()
-#include <sys/socket.h> // for send()
+#include <sys/socket.h> // for recv()
+#include <unistd.h>     // for read() and close()
 
 #include "../lib/die/die.h"
 #include "../lib/logger/logger.h"
 #include "helper.h"
+#include "request_scan.h"
 
 int makeSocketNonBlocking(int fd) {
     int flags, s;
@@ -41,13 +44,22 @@ char *timeToDatetimeString(time_t time, char *format) {
     return format;
 }
 
+// thread safe alternative to inet_ntoa, ip must have INET_ADDRSTRLEN bytes
+char *peerAddressToString(struct sockaddr_in *address, char *ip) {
+    if (inet_ntop(AF_INET, &address->sin_addr, ip, INET_ADDRSTRLEN) == NULL) {
+        strCopySafe(ip, "-");
+    }
+    return ip;
+}
+
+// ASCII, the parser lower cases the header names in place with REQUEST_SCAN.lowerCase()
 char *toLower(char *str, size_t len) {
 
     char *strLower = calloc(len + 1, sizeof(char));
-
-    for (size_t i = 0; i < len; i++) {
-        strLower[i] = tolower((unsigned char)str[i]);
+    if (strLower == NULL) {
+        die("calloc toLower");
     }
+    REQUEST_SCAN.lowerCase(strLower, str, len);
     return strLower;
 }
 char *toUpper(char *str, size_t len) {
@@ -130,24 +142,63 @@ char *readAll(int fd, char *buffer, size_t bufferSize) {
     return buffer;
 }
 
-size_t sendAll(int fd, char *buffer, size_t count) {
-    size_t leftToWrite = count;
-    while (leftToWrite > 0) {
-        size_t written = send(fd, buffer, count, 0);
-        if (written == -1) {
-            if (errno == EINTR) {
-                // The send call was interrupted by a signal
-                continue;
-            }
-            if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                return written;
-            }
-            logError("sendAll() error");
+// the content of a small file (sysfs, procfs, cgroupfs) without the last newline, false if it cannot be read
+bool readFileString(const char *path, char *buffer, size_t bufferSize) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return false;
+    }
+    ssize_t bytesRead = read(fd, buffer, bufferSize - 1);
+    close(fd);
+    if (bytesRead < 0) {
+        return false;
+    }
+    if (bytesRead > 0 && buffer[bytesRead - 1] == '\n') {
+        bytesRead--;
+    }
+    buffer[bytesRead] = '\0';
+    return true;
+}
+
+// CPUs of a list in the kernel format "0-3,8,10-11" (sysfs, cgroup cpuset), the count or -1 if malformed
+int parseCpuList(const char *list, cpu_set_t *cpuSet) {
+    CPU_ZERO(cpuSet);
+    const char *current = list;
+    while (*current != '\0' && *current != '\n') {
+        char *end;
+        long first = strtol(current, &end, 10);
+        long last = first;
+        if (end == current || first < 0) {
             return -1;
-        } else {
-            leftToWrite -= written;
         }
+        if (*end == '-') {
+            current = end + 1;
+            last = strtol(current, &end, 10);
+            if (end == current || last < first) {
+                return -1;
+            }
+        }
+        long cpu;
+        for (cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++) {
+            CPU_SET(cpu, cpuSet);
+        }
+        current = *end == ',' ? end + 1 : end;
     }
+    return CPU_COUNT(cpuSet);
+}
 
-    return count;
-}
\ No newline at end of file
+// the CPU number index (modulo the count) of the set, -1 if the set is empty
+int getCpuOfSet(cpu_set_t *cpuSet, int index) {
+    int count = CPU_COUNT(cpuSet);
+    if (count == 0) {
+        return -1;
+    }
+    index %= count;
+    int cpu;
+    for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, cpuSet) && index-- == 0) {
+            return cpu;
+        }
+    }
+    return -1;
+}
@@ -0,0 +1,324 @@
+/**
+ *
+ * @brief I/O threads for the filesystem operations that would block an event loop (--io-threads)
+ *
+ * The event loop only does what the caches can answer at once: the path lookup with openat2
+ * RESOLVE_CACHED (dentry cache) and the first page of the next file range with preadv2 RWF_NOWAIT (page cache).
+ * On a miss the connection waits and a job does the blocking work in a small pool of threads: the open,
+ * or the read of the range into the page cache. The completion comes back to the loop through its eventfd,
+ * and the request is served again from the warm caches. The gzip cache of a file is also written by a job,
+ * the responses are sent with identity encoding until the .gz is there.
+ *
+ */
+
+#include <errno.h>          // for errno
+#include <fcntl.h>          // for open() and AT_FDCWD
+#include <linux/openat2.h>  // for struct open_how and RESOLVE_CACHED
+#include <stdint.h>         // for uint64_t
+#include <stdlib.h>         // for malloc()
+#include <string.h>         // for memcpy()
+#include <sys/eventfd.h>    // for eventfd()
+#include <sys/stat.h>       // for fstat()
+#include <sys/syscall.h>    // for SYS_openat2
+#include <sys/uio.h>        // for preadv2() and RWF_NOWAIT
+#include <unistd.h>         // for close() and pread()
+
+#include "../lib/die/die.h"
+#include "../lib/logger/logger.h"
+#include "io_pool.h"
+#include "response.h"
+#include "server.h"
+
+struct IoPoolType IO_POOL;
+
+// the kernel is older than openat2 (5.6) or RESOLVE_CACHED (5.12): the open is not probed, only the data
+static atomic_bool openat2Unsupported;
+
+// the blocking part of the job, its result is the state of the caches
+static void runIoJob(struct IoJobType *job) {
+    char buffer[IO_POOL_READ_SIZE];
+    int fd = job->fd;
+    off_t offset = job->offset;
+    size_t length = job->length;
+    const char *path = job->path;
+    if (job->gzip) {
+        path += strlen(job->path) + 1;
+        // an earlier job of the same file may have written it
+        if (access(path, F_OK) != 0 && !makeGzipCache(job->path, path)) {
+            return;
+        }
+    }
+    if (fd == -1) {
+        // the lookup fills the dentry cache (also a negative entry), the read the first pages of the file
+        fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+            return;
+        }
+        struct stat statFile;
+        length = fstat(fd, &statFile) == 0 && S_ISREG(statFile.st_mode) ? (size_t)statFile.st_size : 0;
+        if (length > IO_POOL_READAHEAD_SIZE) {
+            length = IO_POOL_READAHEAD_SIZE;
+        }
+        offset = 0;
+    }
+    while (length > 0) {
+        ssize_t bytesRead = pread(fd, buffer, length < sizeof(buffer) ? length : sizeof(buffer), offset);
+        if (bytesRead <= 0) {
+            break;
+        }
+        offset += bytesRead;
+        length -= (size_t)bytesRead;
+    }
+    close(fd);
+}
+
+static void completeIoJob(struct IoJobType *job) {
+    struct IoCompletionsType *completions = job->completions;
+    if (completions == NULL) {
+        free(job);
+        return;
+    }
+    struct IoJobType *head = atomic_load_explicit(&completions->head, memory_order_relaxed);
+    do {
+        job->next = head;
+    } while (!atomic_compare_exchange_weak_explicit(
+        &completions->head, &head, job, memory_order_release, memory_order_relaxed));
+
+    // the loop takes the whole stack, it is woken up only by the first push
+    if (head == NULL) {
+        uint64_t one = 1;
+        if (write(completions->eventFd, &one, sizeof(one)) == -1 && errno != EAGAIN) {
+            logWarning("write eventfd of the I/O completions failed");
+        }
+    }
+}
+
+// the queued jobs are still done when the pool stops, their loops wait for them
+static void *runIoThread(void *argument) {
+    (void)argument;
+    pthread_mutex_lock(&IO_POOL.lock);
+    while (true) {
+        while (IO_POOL.head == NULL && !IO_POOL.stopping) {
+            pthread_cond_wait(&IO_POOL.ready, &IO_POOL.lock);
+        }
+        struct IoJobType *job = IO_POOL.head;
+        if (job == NULL) {
+            break;
+        }
+        IO_POOL.head = job->next;
+        if (IO_POOL.head == NULL) {
+            IO_POOL.tail = NULL;
+        }
+        pthread_mutex_unlock(&IO_POOL.lock);
+
+        runIoJob(job);
+        completeIoJob(job);
+
+        pthread_mutex_lock(&IO_POOL.lock);
+    }
+    pthread_mutex_unlock(&IO_POOL.lock);
+    return NULL;
+}
+
+void initIoPool(int threads) {
+    IO_POOL.count = 0;
+    if (threads <= 0) {
+        return;
+    }
+    pthread_mutex_init(&IO_POOL.lock, NULL);
+    pthread_cond_init(&IO_POOL.ready, NULL);
+    IO_POOL.head = NULL;
+    IO_POOL.tail = NULL;
+    IO_POOL.stopping = false;
+    IO_POOL.threads = malloc(sizeof(pthread_t) * threads);
+    if (IO_POOL.threads == NULL) {
+        die("Cannot allocate %d I/O threads", threads);
+    }
+    int i;
+    for (i = 0; i < threads; i++) {
+        if (pthread_create(&IO_POOL.threads[i], NULL, runIoThread, NULL) != 0) {
+            die("pthread_create of the I/O thread %d failed", i);
+        }
+    }
+    IO_POOL.count = threads;
+}
+
+void freeIoPool() {
+    if (IO_POOL.count == 0) {
+        return;
+    }
+    pthread_mutex_lock(&IO_POOL.lock);
+    IO_POOL.stopping = true;
+    pthread_cond_broadcast(&IO_POOL.ready);
+    pthread_mutex_unlock(&IO_POOL.lock);
+    int i;
+    for (i = 0; i < IO_POOL.count; i++) {
+        pthread_join(IO_POOL.threads[i], NULL);
+    }
+    free(IO_POOL.threads);
+    IO_POOL.threads = NULL;
+    IO_POOL.count = 0;
+    pthread_mutex_destroy(&IO_POOL.lock);
+    pthread_cond_destroy(&IO_POOL.ready);
+}
+
+void initIoCompletions(struct IoCompletionsType *completions) {
+    atomic_init(&completions->head, NULL);
+    atomic_init(&completions->pending, 0);
+    completions->eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (completions->eventFd == -1) {
+        die("eventfd failed");
+    }
+}
+
+// the jobs still running point to the completions, so they are waited for
+void freeIoCompletions(struct IoCompletionsType *completions) {
+    while (true) {
+        struct IoJobType *job = takeIoCompletions(completions);
+        while (job != NULL) {
+            struct IoJobType *next = job->next;
+            free(job);
+            job = next;
+        }
+        if (atomic_load(&completions->pending) == 0) {
+            break;
+        }
+        usleep(1000);
+    }
+    close(completions->eventFd);
+}
+
+static void submitIoJob(struct IoJobType *job) {
+    if (job->completions != NULL) {
+        atomic_fetch_add_explicit(&job->completions->pending, 1, memory_order_relaxed);
+    }
+    pthread_mutex_lock(&IO_POOL.lock);
+    job->next = NULL;
+    if (IO_POOL.tail == NULL) {
+        IO_POOL.head = job;
+    } else {
+        IO_POOL.tail->next = job;
+    }
+    IO_POOL.tail = job;
+    pthread_cond_signal(&IO_POOL.ready);
+    pthread_mutex_unlock(&IO_POOL.lock);
+}
+
+// open the path and read its first bytes, false if the job cannot be allocated
+bool submitIoOpen(struct IoCompletionsType *completions, const char *path, int slot, unsigned int ticket) {
+    size_t pathLength = strlen(path);
+    struct IoJobType *job = malloc(sizeof(struct IoJobType) + pathLength + 1);
+    if (job == NULL) {
+        logError("Cannot allocate the I/O job of %s", path);
+        return false;
+    }
+    memcpy(job->path, path, pathLength + 1);
+    job->completions = completions;
+    job->fd = -1;
+    job->offset = 0;
+    job->length = 0;
+    job->slot = slot;
+    job->ticket = ticket;
+    job->gzip = false;
+    submitIoJob(job);
+    return true;
+}
+
+// read a range of an open file, the descriptor is duplicated: the connection can close its own meanwhile
+bool submitIoReadahead(struct IoCompletionsType *completions,
+                       int fd,
+                       off_t offset,
+                       size_t length,
+                       int slot,
+                       unsigned int ticket) {
+    struct IoJobType *job = malloc(sizeof(struct IoJobType) + 1);
+    if (job == NULL) {
+        logError("Cannot allocate the I/O job of the fd %d", fd);
+        return false;
+    }
+    job->fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+    if (job->fd == -1) {
+        logWarning("Cannot duplicate the fd %d for the I/O threads", fd);
+        free(job);
+        return false;
+    }
+    job->path[0] = '\0';
+    job->completions = completions;
+    job->offset = offset;
+    job->length = length < IO_POOL_READAHEAD_SIZE ? length : IO_POOL_READAHEAD_SIZE;
+    job->slot = slot;
+    job->ticket = ticket;
+    job->gzip = false;
+    submitIoJob(job);
+    return true;
+}
+
+// write the gzip cache of the file and read it into the page cache, false if the job cannot be allocated
+bool submitIoGzip(const char *path, const char *gzipPath) {
+    size_t pathLength = strlen(path);
+    size_t gzipPathLength = strlen(gzipPath);
+    struct IoJobType *job = malloc(sizeof(struct IoJobType) + pathLength + 1 + gzipPathLength + 1);
+    if (job == NULL) {
+        logError("Cannot allocate the I/O job of %s", gzipPath);
+        return false;
+    }
+    memcpy(job->path, path, pathLength + 1);
+    memcpy(job->path + pathLength + 1, gzipPath, gzipPathLength + 1);
+    job->completions = NULL;
+    job->fd = -1;
+    job->offset = 0;
+    job->length = 0;
+    job->slot = -1;
+    job->ticket = 0;
+    job->gzip = true;
+    submitIoJob(job);
+    return true;
+}
+
+// the completed jobs, the caller frees them
+struct IoJobType *takeIoCompletions(struct IoCompletionsType *completions) {
+    uint64_t value;
+    if (read(completions->eventFd, &value, sizeof(value)) == -1 && errno != EAGAIN) {
+        logWarning("read eventfd of the I/O completions failed");
+    }
+    struct IoJobType *job = atomic_exchange_explicit(&completions->head, NULL, memory_order_acquire);
+    struct IoJobType *taken = job;
+    int count = 0;
+    while (taken != NULL) {
+        count++;
+        taken = taken->next;
+    }
+    atomic_fetch_sub_explicit(&completions->pending, count, memory_order_relaxed);
+    return job;
+}
+
+/**
+ * Open the path only from the dentry cache, true if it did not block: fd is the open file, or -1
+ * if the path is not a file to send (makeResponse answers the error). False if the lookup needs the disk.
+ */
+bool probeFileOpen(const char *path, int *fd) {
+    *fd = -1;
+    if (atomic_load_explicit(&openat2Unsupported, memory_order_relaxed)) {
+        *fd = open(path, O_RDONLY | O_CLOEXEC);
+        return true;
+    }
+    struct open_how how = {.flags = O_RDONLY | O_CLOEXEC, .resolve = RESOLVE_CACHED};
+    *fd = (int)syscall(SYS_openat2, AT_FDCWD, path, &how, sizeof(how));
+    if (*fd == -1) {
+        if (errno == EAGAIN) {
+            return false;
+        }
+        if (errno == ENOSYS || errno == EINVAL) {
+            atomic_store(&openat2Unsupported, true);
+            *fd = open(path, O_RDONLY | O_CLOEXEC);
+        }
+    }
+    return true;
+}
+
+// true if the page at the offset is in the page cache (or the filesystem cannot tell), sendfile will not block on it
+bool probeFileRange(int fd, off_t offset) {
+    char byte;
+    struct iovec iov = {.iov_base = &byte, .iov_len = 1};
+    return preadv2(fd, &iov, 1, offset, RWF_NOWAIT) != -1 || errno != EAGAIN;
+}
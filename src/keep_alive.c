@@ -0,0 +1,71 @@
+/**
+ *
+ * @brief Keep-alive policy: which responses keep the connection open, and for how long
+ *
+ * HTTP/1.1 connections are persistent unless the client sends `close`, HTTP/1.0 ones only with
+ * `keep-alive`. A connection is closed after --keep-alive-requests responses, and the idle timeout
+ * shrinks when the connections table of the thread fills up, so the idle sockets of the browsers
+ * leave room for the active clients. The Keep-Alive response header advertises the values in effect.
+ *
+ */
+
+#include <string.h>  // for strcmp()
+#include <strings.h> // for strncasecmp()
+
+#include "keep_alive.h"
+#include "options.h"
+#include "request.h"
+
+// CONNECTION_TOKEN_* flags of the tokens found in the value, the unknown ones (upgrade...) are ignored
+int parseConnectionHeader(const char *value) {
+    int tokens = 0;
+    if (value == NULL) {
+        return tokens;
+    }
+    while (*value != '\0') {
+        while (*value == ' ' || *value == '\t' || *value == ',') {
+            value++;
+        }
+        const char *start = value;
+        while (*value != '\0' && *value != ',' && *value != ' ' && *value != '\t') {
+            value++;
+        }
+        size_t length = value - start;
+        if (length == 5 && strncasecmp(start, "close", 5) == 0) {
+            tokens |= CONNECTION_TOKEN_CLOSE;
+        } else if (length == 10 && strncasecmp(start, "keep-alive", 10) == 0) {
+            tokens |= CONNECTION_TOKEN_KEEP_ALIVE;
+        }
+    }
+    return tokens;
+}
+
+// seconds, the whole --keep-alive-timeout below half of the table, then less and less
+int getKeepAliveTimeout(struct QueueConnectionsType *queueConnections) {
+    int occupancy = (int)((long long)queueConnections->currentSize * 100 / queueConnections->capacity);
+    int timeout = OPTIONS.keepAliveTimeout;
+    if (occupancy >= 90) {
+        timeout = KEEP_ALIVE_MIN_TIMEOUT;
+    } else if (occupancy >= 75) {
+        timeout /= 8;
+    } else if (occupancy >= 50) {
+        timeout /= 2;
+    }
+    return timeout > KEEP_ALIVE_MIN_TIMEOUT ? timeout : KEEP_ALIVE_MIN_TIMEOUT;
+}
+
+// decide the keep-alive of the response of the current request, after it is parsed and before makeResponse
+void applyKeepAlivePolicy(struct QueueConnectionsType *queueConnections, struct QueueConnectionElementType *connection) {
+    struct ConnectionRequestType *request = connection->request;
+    request->requests++;
+    int tokens = parseConnectionHeader(getRequestHeader(request, HEADER_CONNECTION));
+    bool persistent = strcmp(request->protocolVersion, "HTTP/1.1") == 0 ? !(tokens & CONNECTION_TOKEN_CLOSE)
+                                                                       : (tokens & CONNECTION_TOKEN_KEEP_ALIVE) != 0;
+    if (OPTIONS.keepAliveRequests > 0 && request->requests >= (unsigned int)OPTIONS.keepAliveRequests) {
+        persistent = false;
+    }
+    if (queueConnections->draining) {
+        persistent = false;
+    }
+    request->keepAliveTimeout = persistent ? getKeepAliveTimeout(queueConnections) : 0;
+}
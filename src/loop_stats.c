@@ -0,0 +1,199 @@
+/**
+ *
+ * @brief Lag and stall detector of the epoll loops (--stall-budget)
+ *
+ * Every thread measures the time from each return of epoll_wait to its next call (the delay of the events
+ * that become ready meanwhile) and every run of the state machine of a connection. An event over the budget
+ * is reported with its descriptor, state and request path, and an iteration over the budget made of small
+ * events with the slowest of them. The histograms are dumped to the log on SIGUSR1.
+ *
+ */
+
+#include <errno.h>  // for errno
+#include <stdlib.h> // for aligned_alloc()
+#include <string.h> // for memset()
+
+#include "../lib/die/die.h"
+#include "../lib/logger/logger.h"
+#include "codel.h"
+#include "loop_stats.h"
+#include "queue_connections.h"
+
+struct LoopStatsRegistryType LOOP_STATS;
+
+void initLoopStats(unsigned long long budgetUs) {
+    atomic_init(&LOOP_STATS.count, 0);
+    LOOP_STATS.budgetUs = budgetUs;
+}
+
+// after the threads, the dump may read their stats until then
+void freeLoopStats() {
+    int count = atomic_load(&LOOP_STATS.count);
+    int i;
+    for (i = 0; i < count; i++) {
+        free(LOOP_STATS.threads[i]);
+        LOOP_STATS.threads[i] = NULL;
+    }
+    atomic_store(&LOOP_STATS.count, 0);
+}
+
+// the stats of the calling thread, NULL if disabled or there is no room
+struct LoopStatsType *registerLoopStats(long threadId) {
+    if (LOOP_STATS.budgetUs == 0) {
+        return NULL;
+    }
+    struct LoopStatsType *stats = aligned_alloc(64, sizeof(struct LoopStatsType));
+    if (stats == NULL) {
+        die("Cannot allocate the loop stats");
+    }
+    memset(stats, 0, sizeof(struct LoopStatsType));
+    stats->threadId = threadId;
+    stats->slowestFd = -1;
+    int index = atomic_fetch_add(&LOOP_STATS.count, 1);
+    if (index >= LOOP_STATS_MAX_THREADS) {
+        atomic_fetch_sub(&LOOP_STATS.count, 1);
+        free(stats);
+        return NULL;
+    }
+    LOOP_STATS.threads[index] = stats;
+    return stats;
+}
+
+static int getLoopBucket(unsigned long long us) {
+    if (us == 0) {
+        return 0;
+    }
+    int bucket = 64 - __builtin_clzll(us);
+    return bucket < LOOP_STATS_BUCKETS ? bucket : LOOP_STATS_BUCKETS - 1;
+}
+
+// only the owner thread writes, so a relaxed load and store are enough
+static void addLoopSample(struct LoopHistogramType *histogram, unsigned long long us) {
+    atomic_ullong *bucket = &histogram->buckets[getLoopBucket(us)];
+    atomic_store_explicit(bucket, atomic_load_explicit(bucket, memory_order_relaxed) + 1, memory_order_relaxed);
+    atomic_store_explicit(
+        &histogram->count, atomic_load_explicit(&histogram->count, memory_order_relaxed) + 1, memory_order_relaxed);
+    if (us > atomic_load_explicit(&histogram->maxUs, memory_order_relaxed)) {
+        atomic_store_explicit(&histogram->maxUs, us, memory_order_relaxed);
+    }
+}
+
+// path: of the request the connection is sending, NULL while it waits for one
+void startLoopEvent(struct LoopStatsType *stats, const char *path) {
+    stats->path[0] = '\0';
+    noteLoopPath(stats, path);
+}
+
+// the request the running event is processing, for the report if it stalls
+void noteLoopPath(struct LoopStatsType *stats, const char *path) {
+    if (path == NULL) {
+        return;
+    }
+    size_t length = strlen(path);
+    if (length >= LOOP_STATS_PATH_MAX) {
+        length = LOOP_STATS_PATH_MAX - 1;
+    }
+    memcpy(stats->path, path, length);
+    stats->path[length] = '\0';
+}
+
+void recordLoopEvent(struct LoopStatsType *stats, unsigned long long startUs, int fd, int state) {
+    unsigned long long us = monotonicMicroseconds() - startUs;
+    addLoopSample(&stats->events, us);
+    if (us >= stats->slowestUs) {
+        stats->slowestUs = us;
+        stats->slowestFd = fd;
+        stats->slowestState = state;
+        memcpy(stats->slowestPath, stats->path, LOOP_STATS_PATH_MAX);
+    }
+    if (us > LOOP_STATS.budgetUs) {
+        errno = 0;
+        logWarning("Stall of %llu us in the thread %ld: fd %d, state %s, path %s",
+                   us,
+                   stats->threadId,
+                   fd,
+                   stateConnectionList[state],
+                   stats->path[0] != '\0' ? stats->path : "-");
+    }
+}
+
+// before epoll_wait, startUs is its previous return
+void recordLoopIteration(struct LoopStatsType *stats, unsigned long long startUs, int events) {
+    unsigned long long us = monotonicMicroseconds() - startUs;
+    addLoopSample(&stats->iterations, us);
+    if (us > LOOP_STATS.budgetUs) {
+        atomic_store_explicit(
+            &stats->stalls, atomic_load_explicit(&stats->stalls, memory_order_relaxed) + 1, memory_order_relaxed);
+        errno = 0;
+        // a single event over the budget was already reported
+        if (stats->slowestFd == -1) {
+            logWarning("Loop iteration of %llu us in the thread %ld: %d events, none of a connection",
+                       us,
+                       stats->threadId,
+                       events);
+        } else if (stats->slowestUs <= LOOP_STATS.budgetUs) {
+            logWarning("Loop iteration of %llu us in the thread %ld: %d events, the slowest %llu us fd %d state %s path %s",
+                       us,
+                       stats->threadId,
+                       events,
+                       stats->slowestUs,
+                       stats->slowestFd,
+                       stateConnectionList[stats->slowestState],
+                       stats->slowestPath[0] != '\0' ? stats->slowestPath : "-");
+        }
+    }
+    stats->slowestUs = 0;
+    stats->slowestFd = -1;
+    stats->slowestState = 0;
+    stats->slowestPath[0] = '\0';
+}
+
+// upper bound in microseconds of the percentile (the end of its bucket, or the max), 0 without samples
+static unsigned long long getLoopPercentile(struct LoopHistogramType *histogram, unsigned long long count, int perMille) {
+    if (count == 0) {
+        return 0;
+    }
+    unsigned long long rank = (count * perMille + 999) / 1000;
+    unsigned long long seen = 0;
+    int bucket;
+    for (bucket = 0; bucket < LOOP_STATS_BUCKETS; bucket++) {
+        seen += atomic_load_explicit(&histogram->buckets[bucket], memory_order_relaxed);
+        if (seen >= rank) {
+            break;
+        }
+    }
+    unsigned long long bound = (1ULL << (bucket < LOOP_STATS_BUCKETS ? bucket : LOOP_STATS_BUCKETS - 1)) - 1;
+    unsigned long long maxUs = atomic_load_explicit(&histogram->maxUs, memory_order_relaxed);
+    return bound < maxUs || bucket >= LOOP_STATS_BUCKETS - 1 ? bound : maxUs;
+}
+
+static void dumpLoopHistogram(long threadId, const char *name, struct LoopHistogramType *histogram) {
+    unsigned long long count = atomic_load_explicit(&histogram->count, memory_order_relaxed);
+    logInfo("Loop of the thread %ld, %s: %llu, p50 <= %llu us, p99 <= %llu us, p99.9 <= %llu us, max %llu us",
+            threadId,
+            name,
+            count,
+            getLoopPercentile(histogram, count, 500),
+            getLoopPercentile(histogram, count, 990),
+            getLoopPercentile(histogram, count, 999),
+            atomic_load_explicit(&histogram->maxUs, memory_order_relaxed));
+}
+
+// SIGUSR1, from the main thread: the histograms of every loop
+void dumpLoopStats() {
+    if (LOOP_STATS.budgetUs == 0) {
+        logWarning("The loop stats are disabled, start the server with --stall-budget");
+        return;
+    }
+    int count = atomic_load(&LOOP_STATS.count);
+    int i;
+    for (i = 0; i < count; i++) {
+        struct LoopStatsType *stats = LOOP_STATS.threads[i];
+        dumpLoopHistogram(stats->threadId, "iterations", &stats->iterations);
+        dumpLoopHistogram(stats->threadId, "events", &stats->events);
+        logInfo("Loop of the thread %ld: %llu iterations over %llu us",
+                stats->threadId,
+                atomic_load_explicit(&stats->stalls, memory_order_relaxed),
+                LOOP_STATS.budgetUs);
+    }
+}
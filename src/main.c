@@ -11,6 +11,14 @@ void sigIntHandler(int s) {
     sigintReceived = 1;
 }
 
+void sigQuitHandler(int s) {
+    sigquitReceived = 1;
+}
+
+void sigUsr1Handler(int s) {
+    dumpStatsReceived = 1;
+}
+
 int main(int argc, char *argv[]) {
 
     programName = argv[0];
@@ -26,11 +34,21 @@ int main(int argc, char *argv[]) {
     if (sigaction(SIGINT, &action, NULL) == -1) { // SIGINT: Ctrl + c signal
         die("sigaction SIGINT failed");
     }
+    action.sa_handler = sigQuitHandler;
+    if (sigaction(SIGQUIT, &action, NULL) == -1) { // SIGQUIT: graceful stop, Ctrl + \ signal
+        die("sigaction SIGQUIT failed");
+    }
+    action.sa_handler = sigUsr1Handler;
+    if (sigaction(SIGUSR1, &action, NULL) == -1) { // SIGUSR1: dump the loop stats (--stall-budget)
+        die("sigaction SIGUSR1 failed");
+    }
     // SIGPIPE: Broken pipe with send or sendfile in response.c
     // https://stackoverflow.com/questions/108183/how-to-prevent-sigpipes-or-handle-them-properly
     signal(SIGPIPE, SIG_IGN);
 
     sigintReceived = 0; // sigintReceived for break epoll loop/threads
+    sigquitReceived = 0;
+    dumpStatsReceived = 0;
 
     serverRun(options);
 
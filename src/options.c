@@ -7,6 +7,7 @@
 #include "../lib/die/die.h"
 #include "../lib/color/color.h"
 #include "helper.h"
+#include "server.h"
 
 struct Logger LOGGER;
 struct Options OPTIONS;
@@ -24,13 +25,59 @@ void printOptions(struct Options options) {
     "HTML dir: %s\n"
     "Logger type: %s\n"
     "Logger path: %s\n"
+    "Listener: %s\n"
+    "Incoming CPU steering: %s\n"
+    "I/O backend: %s\n"
+    "TCP_DEFER_ACCEPT: %d\n"
+    "TCP_FASTOPEN: %d\n"
+    "Deadlines: %s\n"
+    "Max connections: %d\n"
+    "TCP_NOTSENT_LOWAT: %d\n"
+    "Balance threads: %s\n"
+    "CoDel target: %d ms\n"
+    "Client rate: %d requests/s\n"
+    "Client connections: %d\n"
+    "Limit rate: %llu bytes/s after %llu bytes\n"
+    "Limit rate total: %llu bytes/s\n"
+    "Keep-alive: %d s, %d requests\n"
+    "I/O threads: %d\n"
+    "Workers: %d (pinning %s)\n"
+    "Upgrade socket: %s\n"
+    "Threads: %d (0 automatic), CPUs: %s\n"
+    "Stall budget: %llu us (0 disabled)\n"
+    "Busy poll: %d us (0 disabled)\n"
    // "TCP Keep-Alive: %s\n\n"
     ,
     options.address,
     options.port,
     options.htmlDir,
     LOGGER.active ? "file" : "stderr",
-    LOGGER.path[0]== '\0' ? "stderr" : LOGGER.path
+    LOGGER.path[0]== '\0' ? "stderr" : LOGGER.path,
+    options.reusePort ? "one SO_REUSEPORT socket per thread" : "shared (EPOLLEXCLUSIVE)",
+    options.incomingCpu ? "On" : "Off",
+    options.ioBackend == IO_BACKEND_URING ? "io_uring" : "epoll",
+    options.deferAcceptSeconds,
+    options.fastOpenQueue,
+    options.timerFd ? "timing wheel + timerfd" : "timing wheel + epoll_wait timeout",
+    options.maxConnections,
+    options.notSentLowat,
+    options.balance ? "On" : "Off",
+    options.codelTarget,
+    options.clientRate,
+    options.clientConnections,
+    options.limitRate,
+    options.limitRateAfter,
+    options.limitRateTotal,
+    options.keepAliveTimeout,
+    options.keepAliveRequests,
+    options.ioThreads,
+    options.workers,
+    options.workerPinning == WORKER_PINNING_NUMA ? "numa" : options.workerPinning == WORKER_PINNING_CPU ? "cpu" : "none",
+    options.upgradeSocket[0] != '\0' ? options.upgradeSocket : "Off",
+    options.threads,
+    options.cpus[0] != '\0' ? options.cpus : "not pinned",
+    options.stallBudget,
+    options.busyPoll
     //,options.TCPKeepAlive ? "On" : "Off"
     );
 }
@@ -52,7 +99,31 @@ struct Options getOptions(int argc, char *argv[]) {
     strncpy(options.address, "localhost", 10);
     options.port = 3001;
     options.TCPKeepAlive = false;
-
+    options.reusePort = false;
+    options.incomingCpu = false;
+    options.ioBackend = IO_BACKEND_EPOLL;
+    options.deferAcceptSeconds = 0;
+    options.fastOpenQueue = 0;
+    options.timerFd = false;
+    options.maxConnections = MAX_CONNECTIONS;
+    options.notSentLowat = 0;
+    options.balance = false;
+    options.codelTarget = 0;
+    options.clientRate = 0;
+    options.clientConnections = 0;
+    options.limitRate = 0;
+    options.limitRateAfter = 0;
+    options.limitRateTotal = 0;
+    options.keepAliveTimeout = KEEP_ALIVE_TIMEOUT;
+    options.keepAliveRequests = KEEP_ALIVE_REQUESTS;
+    options.ioThreads = 0;
+    options.workers = 0;
+    options.workerPinning = WORKER_PINNING_NONE;
+    options.upgradeSocket[0] = '\0';
+    options.threads = 0;
+    options.cpus[0] = '\0';
+    options.stallBudget = 0;
+    options.busyPoll = 0;
 
       // Default html directory
     char HtmlDir[OPTIONS_PATH_MAX];
@@ -98,6 +169,116 @@ struct Options getOptions(int argc, char *argv[]) {
                 break;
             }
 
+            case OPTION_REUSEPORT:
+                options.reusePort = true;
+                break;
+            case OPTION_INCOMING_CPU:
+                options.incomingCpu = true;
+                break;
+            case OPTION_IO_BACKEND:
+                if (strcmp(optarg, "io_uring") == 0) {
+                    options.ioBackend = IO_BACKEND_URING;
+                } else if (strcmp(optarg, "epoll") == 0) {
+                    options.ioBackend = IO_BACKEND_EPOLL;
+                } else {
+                    fprintf(stderr, "Unknown I/O backend '%s'.\n", optarg);
+                    printUsage(1);
+                }
+                break;
+            case OPTION_DEFER_ACCEPT:
+                options.deferAcceptSeconds = atoi(optarg);
+                break;
+            case OPTION_FASTOPEN:
+                options.fastOpenQueue = atoi(optarg);
+                break;
+            case OPTION_TIMERFD:
+                options.timerFd = true;
+                break;
+            case OPTION_MAX_CONNECTIONS:
+                options.maxConnections = atoi(optarg);
+                if (options.maxConnections <= 0) {
+                    fprintf(stderr, "--max-connections must be greater than 0.\n");
+                    printUsage(1);
+                }
+                break;
+            case OPTION_NOTSENT_LOWAT:
+                options.notSentLowat = atoi(optarg);
+                break;
+            case OPTION_BALANCE:
+                options.balance = true;
+                break;
+            case OPTION_CODEL_TARGET:
+                options.codelTarget = atoi(optarg);
+                break;
+            case OPTION_CLIENT_RATE:
+                options.clientRate = atoi(optarg);
+                break;
+            case OPTION_CLIENT_CONNECTIONS:
+                options.clientConnections = atoi(optarg);
+                break;
+            case OPTION_LIMIT_RATE:
+                options.limitRate = strtoull(optarg, NULL, 10);
+                break;
+            case OPTION_LIMIT_RATE_AFTER:
+                options.limitRateAfter = strtoull(optarg, NULL, 10);
+                break;
+            case OPTION_LIMIT_RATE_TOTAL:
+                options.limitRateTotal = strtoull(optarg, NULL, 10);
+                break;
+            case OPTION_KEEP_ALIVE_TIMEOUT:
+                options.keepAliveTimeout = atoi(optarg);
+                if (options.keepAliveTimeout <= 0) {
+                    fprintf(stderr, "--keep-alive-timeout must be greater than 0.\n");
+                    printUsage(1);
+                }
+                break;
+            case OPTION_KEEP_ALIVE_REQUESTS:
+                options.keepAliveRequests = atoi(optarg);
+                break;
+            case OPTION_IO_THREADS:
+                options.ioThreads = atoi(optarg);
+                break;
+            case OPTION_WORKERS:
+                options.workers = atoi(optarg);
+                break;
+            case OPTION_WORKER_PINNING:
+                if (strcmp(optarg, "none") == 0) {
+                    options.workerPinning = WORKER_PINNING_NONE;
+                } else if (strcmp(optarg, "cpu") == 0) {
+                    options.workerPinning = WORKER_PINNING_CPU;
+                } else if (strcmp(optarg, "numa") == 0) {
+                    options.workerPinning = WORKER_PINNING_NUMA;
+                } else {
+                    fprintf(stderr, "Unknown worker pinning '%s'.\n", optarg);
+                    printUsage(1);
+                }
+                break;
+            case OPTION_UPGRADE_SOCKET:
+                strCopySafe(options.upgradeSocket, optarg);
+                break;
+            case OPTION_THREADS:
+                options.threads = atoi(optarg);
+                break;
+            case OPTION_CPUS: {
+                cpu_set_t cpuSet;
+                if (strlen(optarg) >= OPTIONS_CPUS_MAX || parseCpuList(optarg, &cpuSet) <= 0) {
+                    fprintf(stderr, "Invalid CPU list '%s'.\n", optarg);
+                    printUsage(1);
+                }
+                strCopySafe(options.cpus, optarg);
+                break;
+            }
+            case OPTION_STALL_BUDGET:
+                options.stallBudget = strtoull(optarg, NULL, 10);
+                break;
+            case OPTION_BUSY_POLL:
+                options.busyPoll = atoi(optarg);
+                if (options.busyPoll < 0) {
+                    fprintf(stderr, "Invalid busy poll '%s'.\n", optarg);
+                    printUsage(1);
+                }
+                break;
+
             case 'h':
                 printUsage(0);
             case '?':
@@ -0,0 +1,190 @@
+/**
+ *
+ * @brief Output queue of a connection
+ *
+ * The response is a chain of segments (headers, canned templates, file ranges) that is sent as far as
+ * the socket accepts it: the consecutive memory segments with one sendmsg (writev with flags), the files
+ * with sendfile. The memory segments followed by a file go with MSG_MORE, so the headers and the first bytes of
+ * the body share the packet, and the end of every chain is pushed at once.
+ * On EAGAIN the queue keeps its position and the event loop resumes it with the next EPOLLOUT,
+ * so a slow reader neither stalls the transfer nor makes the thread spin on a full socket.
+ *
+ */
+
+#include <errno.h>        // for errno
+#include <limits.h>       // for IOV_MAX
+#include <sys/sendfile.h> // for sendfile()
+#include <sys/socket.h>   // for sendmsg()
+#include <sys/uio.h>      // for struct iovec
+#include <unistd.h>       // for close()
+
+#include "output_queue.h"
+
+// drop the segments not sent, closing their files
+void clearOutputQueue(struct OutputQueueType *outputQueue) {
+    unsigned int i;
+    for (i = 0; i < outputQueue->count; i++) {
+        struct OutputSegmentType *segment = &outputQueue->segments[(outputQueue->head + i) % OUTPUT_QUEUE_SEGMENTS];
+        if (segment->kind == OUTPUT_SEGMENT_FILE) {
+            close(segment->fd);
+        }
+    }
+    outputQueue->head = 0;
+    outputQueue->count = 0;
+}
+
+bool isOutputQueueEmpty(struct OutputQueueType *outputQueue) { return outputQueue->count == 0; }
+
+unsigned int getOutputQueueRoom(struct OutputQueueType *outputQueue) {
+    return OUTPUT_QUEUE_SEGMENTS - outputQueue->count;
+}
+
+// bytes not sent yet
+size_t getOutputQueueLength(struct OutputQueueType *outputQueue) {
+    size_t length = 0;
+    unsigned int i;
+    for (i = 0; i < outputQueue->count; i++) {
+        length += outputQueue->segments[(outputQueue->head + i) % OUTPUT_QUEUE_SEGMENTS].length;
+    }
+    return length;
+}
+
+// the first file range not sent yet, NULL if there is none
+struct OutputSegmentType *getOutputQueueFile(struct OutputQueueType *outputQueue) {
+    unsigned int i;
+    for (i = 0; i < outputQueue->count; i++) {
+        struct OutputSegmentType *segment = &outputQueue->segments[(outputQueue->head + i) % OUTPUT_QUEUE_SEGMENTS];
+        if (segment->kind == OUTPUT_SEGMENT_FILE) {
+            return segment;
+        }
+    }
+    return NULL;
+}
+
+static struct OutputSegmentType *pushOutputSegment(struct OutputQueueType *outputQueue) {
+    if (outputQueue->count == OUTPUT_QUEUE_SEGMENTS) {
+        return NULL;
+    }
+    unsigned int index = (outputQueue->head + outputQueue->count) % OUTPUT_QUEUE_SEGMENTS;
+    outputQueue->count++;
+    return &outputQueue->segments[index];
+}
+
+bool pushOutputMemory(struct OutputQueueType *outputQueue, const char *data, size_t length) {
+    if (length == 0) {
+        return true;
+    }
+    struct OutputSegmentType *segment = pushOutputSegment(outputQueue);
+    if (segment == NULL) {
+        return false;
+    }
+    segment->kind = OUTPUT_SEGMENT_MEMORY;
+    segment->fd = -1;
+    segment->data = data;
+    segment->offset = 0;
+    segment->length = length;
+    return true;
+}
+
+// the queue owns the fd from now on, also if it fails
+bool pushOutputFile(struct OutputQueueType *outputQueue, int fd, off_t offset, size_t length) {
+    if (length == 0) {
+        close(fd);
+        return true;
+    }
+    struct OutputSegmentType *segment = pushOutputSegment(outputQueue);
+    if (segment == NULL) {
+        close(fd);
+        return false;
+    }
+    segment->kind = OUTPUT_SEGMENT_FILE;
+    segment->fd = fd;
+    segment->data = NULL;
+    segment->offset = offset;
+    segment->length = length;
+    return true;
+}
+
+// consume bytes from the head of the queue
+static void advanceOutputQueue(struct OutputQueueType *outputQueue, size_t bytes) {
+    while (bytes > 0 && outputQueue->count > 0) {
+        struct OutputSegmentType *segment = &outputQueue->segments[outputQueue->head];
+        size_t consumed = bytes < segment->length ? bytes : segment->length;
+        segment->offset += consumed;
+        segment->length -= consumed;
+        bytes -= consumed;
+        if (segment->length == 0) {
+            if (segment->kind == OUTPUT_SEGMENT_FILE) {
+                close(segment->fd);
+            }
+            outputQueue->head = (outputQueue->head + 1) % OUTPUT_QUEUE_SEGMENTS;
+            outputQueue->count--;
+        }
+    }
+}
+
+/**
+ * @brief Send the queue until it is empty, the socket is full or the quantum is used
+ *
+ * @param quantum max bytes of this call, so one large transfer does not monopolise the thread
+ * @param bytesSent bytes sent by this call, to reset the send stall deadline on progress
+ */
+enum OutputFlushResult flushOutputQueue(struct OutputQueueType *outputQueue, int fd, size_t quantum, size_t *bytesSent) {
+    *bytesSent = 0;
+    while (outputQueue->count > 0) {
+        if (*bytesSent >= quantum) {
+            return OUTPUT_FLUSH_QUANTUM;
+        }
+        size_t budget = quantum - *bytesSent;
+        struct OutputSegmentType *segment = &outputQueue->segments[outputQueue->head];
+        ssize_t sent;
+        if (segment->kind == OUTPUT_SEGMENT_FILE) {
+            // the file offset is not shared, sendfile updates segment->offset
+            sent = sendfile(fd, segment->fd, &segment->offset, segment->length < budget ? segment->length : budget);
+            if (sent > 0) {
+                segment->offset -= sent;
+            }
+        } else {
+            // gather the consecutive memory segments
+            struct iovec iov[OUTPUT_QUEUE_SEGMENTS];
+            int iovCount = 0;
+            unsigned int i;
+            for (i = 0; i < outputQueue->count && iovCount < IOV_MAX && budget > 0; i++) {
+                struct OutputSegmentType *next = &outputQueue->segments[(outputQueue->head + i) % OUTPUT_QUEUE_SEGMENTS];
+                if (next->kind != OUTPUT_SEGMENT_MEMORY) {
+                    break;
+                }
+                iov[iovCount].iov_base = (char *)next->data + next->offset;
+                iov[iovCount].iov_len = next->length < budget ? next->length : budget;
+                budget -= iov[iovCount].iov_len;
+                iovCount++;
+            }
+            struct msghdr message = {0};
+            message.msg_iov = iov;
+            message.msg_iovlen = iovCount;
+            int flags = MSG_NOSIGNAL;
+            // only when segments follow the gathered ones, the end of a response is never held by the cork timer
+            if (i < outputQueue->count) {
+                flags |= MSG_MORE;
+            }
+            sent = sendmsg(fd, &message, flags);
+        }
+
+        if (sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return OUTPUT_FLUSH_AGAIN;
+            }
+            return OUTPUT_FLUSH_ERROR;
+        }
+        if (sent == 0) {
+            // the file is shorter than expected or the client is gone, the response cannot be completed
+            return OUTPUT_FLUSH_ERROR;
+        }
+        *bytesSent += sent;
+        advanceOutputQueue(outputQueue, (size_t)sent);
+    }
+    return OUTPUT_FLUSH_DONE;
+}
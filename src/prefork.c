@@ -0,0 +1,278 @@
+/**
+ *
+ * @brief Prefork mode (--workers): a master process supervising N worker processes
+ *
+ * The master binds the listening socket and forks the workers, every worker runs the epoll/thread engine
+ * with its share of the threads (--threads, the CPUs by default) and of --max-connections, and nothing else is shared between them: the balancer,
+ * the client limits and the bandwidth schedules are per worker. The master does not serve any request,
+ * it only respawns the workers that exit (a die() or a crash takes down one worker, not the server), with
+ * a delay that grows while a worker keeps exiting just after it starts. With --worker-pinning the affinity
+ * of every worker is its own CPUs or the CPUs of one NUMA node, so the memory it allocates stays local.
+ *
+ */
+
+#include <errno.h>      // for errno
+#include <signal.h>     // for kill()
+#include <stdio.h>      // for snprintf() and fflush()
+#include <stdlib.h>     // for calloc()
+#include <string.h>     // for strsignal()
+#include <sys/prctl.h>  // for prctl() and PR_SET_PDEATHSIG
+#include <sys/wait.h>   // for waitpid()
+#include <unistd.h>     // for fork()
+
+#include "../lib/die/die.h"
+#include "../lib/logger/logger.h"
+#include "accept_client_thread_epoll.h"
+#include "cpu_placement.h"
+#include "helper.h"
+#include "options.h"
+#include "prefork.h"
+#include "server.h"
+#include "upgrade.h"
+
+#define PREFORK_PATH_MAX 64
+#define PREFORK_CPULIST_MAX 1024
+
+struct PreforkType PREFORK = {.index = PREFORK_MASTER};
+
+// it interrupts the sleep of the master, a worker is respawned without waiting for the next second
+static void preforkChildHandler(int signal) {
+}
+
+// the CPUs of the worker: its share of the CPUs, or the NUMA node of its turn; false if not pinned
+static bool getWorkerCpus(int worker, cpu_set_t *cpuSet) {
+    if (OPTIONS.workerPinning == WORKER_PINNING_CPU) {
+        cpu_set_t serverCpus;
+        getServerCpus(&serverCpus);
+        CPU_ZERO(cpuSet);
+        int i;
+        for (i = 0; i < PREFORK.threads; i++) {
+            CPU_SET(getCpuOfSet(&serverCpus, worker * PREFORK.threads + i), cpuSet);
+        }
+        return true;
+    }
+    if (OPTIONS.workerPinning == WORKER_PINNING_NUMA) {
+        char list[PREFORK_CPULIST_MAX];
+        cpu_set_t nodes; // the node numbers have the format of the CPU lists
+        if (!readFileString("/sys/devices/system/node/online", list, sizeof(list)) || parseCpuList(list, &nodes) <= 0) {
+            logWarning("NUMA nodes not found, worker %d not pinned", worker);
+            return false;
+        }
+        char path[PREFORK_PATH_MAX];
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", getCpuOfSet(&nodes, worker));
+        if (!readFileString(path, list, sizeof(list)) || parseCpuList(list, cpuSet) <= 0) {
+            logWarning("CPUs of %s not found, worker %d not pinned", path, worker);
+            return false;
+        }
+        return true;
+    }
+    return false;
+}
+
+// in the new worker process, it returns when the worker has to exit
+static void runWorker(int worker, int socketServerFd) {
+    // the workers of a master killed with SIGKILL do not keep serving without supervision
+    if (prctl(PR_SET_PDEATHSIG, SIGINT) == -1) {
+        logWarning("prctl PR_SET_PDEATHSIG failed");
+    }
+    signal(SIGCHLD, SIG_DFL);
+    // the master hands the listener over
+    if (UPGRADE.fd != -1) {
+        close(UPGRADE.fd);
+        UPGRADE.fd = -1;
+    }
+
+    PREFORK.index = worker;
+    PREFORK.firstCpu = worker * PREFORK.threads;
+    cpu_set_t cpuSet;
+    if (getWorkerCpus(worker, &cpuSet)) {
+        if (sched_setaffinity(0, sizeof(cpuSet), &cpuSet) == -1) {
+            logWarning("sched_setaffinity of the worker %d failed", worker);
+        } else {
+            PREFORK.pinned = true;
+        }
+    }
+    OPTIONS.maxConnections = (OPTIONS.maxConnections + PREFORK.count - 1) / PREFORK.count;
+
+    acceptClientsThreadEpoll(socketServerFd);
+}
+
+static void spawnWorker(int worker, int socketServerFd) {
+    struct PreforkWorkerType *process = &PREFORK.workers[worker];
+    fflush(NULL); // the buffered output of the master would be written again by the exit of the worker
+    pid_t pid = fork();
+    if (pid == -1) {
+        logError("fork of the worker %d failed", worker);
+        process->respawnAt = time(NULL) + 1;
+        return;
+    }
+    if (pid == 0) {
+        runWorker(worker, socketServerFd);
+        exit(EXIT_SUCCESS);
+    }
+    process->pid = pid;
+    process->startedAt = time(NULL);
+}
+
+// a worker that lived less than PREFORK_MIN_UPTIME waits 1, 2, 4... seconds before its respawn
+static void scheduleRespawn(struct PreforkWorkerType *process, time_t now) {
+    int delay = 0;
+    if (now - process->startedAt < PREFORK_MIN_UPTIME) {
+        delay = process->failures < 5 ? 1 << process->failures : PREFORK_MAX_RESPAWN_DELAY;
+        if (delay > PREFORK_MAX_RESPAWN_DELAY) {
+            delay = PREFORK_MAX_RESPAWN_DELAY;
+        }
+        process->failures++;
+    } else {
+        process->failures = 0;
+    }
+    process->pid = 0;
+    process->respawnAt = now + delay;
+}
+
+static void reapWorkers() {
+    int status;
+    pid_t pid;
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+        int worker;
+        for (worker = 0; worker < PREFORK.count && PREFORK.workers[worker].pid != pid; worker++) {
+        }
+        if (worker == PREFORK.count) {
+            continue;
+        }
+        errno = 0; // only the status of the worker
+        if (WIFSIGNALED(status)) {
+            logError("Worker %d (pid %d) killed by signal %s", worker, pid, strsignal(WTERMSIG(status)));
+        } else if (!sigquitReceived || WEXITSTATUS(status) != EXIT_SUCCESS) {
+            logError("Worker %d (pid %d) exited with status %d", worker, pid, WEXITSTATUS(status));
+        }
+        if (!sigintReceived && !sigquitReceived) {
+            scheduleRespawn(&PREFORK.workers[worker], time(NULL));
+        } else {
+            PREFORK.workers[worker].pid = 0;
+        }
+    }
+}
+
+// SIGINT to the workers (Ctrl+C already sent it to the whole process group), SIGKILL after PREFORK_STOP_TIMEOUT
+static void stopWorkers() {
+    int worker;
+    for (worker = 0; worker < PREFORK.count; worker++) {
+        if (PREFORK.workers[worker].pid > 0) {
+            kill(PREFORK.workers[worker].pid, SIGINT);
+        }
+    }
+    time_t deadline = time(NULL) + PREFORK_STOP_TIMEOUT;
+    while (true) {
+        int alive = 0;
+        int status;
+        for (worker = 0; worker < PREFORK.count; worker++) {
+            pid_t pid = PREFORK.workers[worker].pid;
+            if (pid > 0 && waitpid(pid, &status, WNOHANG) == 0) {
+                alive++;
+            } else {
+                PREFORK.workers[worker].pid = 0;
+            }
+        }
+        if (alive == 0) {
+            break;
+        }
+        if (time(NULL) >= deadline) {
+            for (worker = 0; worker < PREFORK.count; worker++) {
+                if (PREFORK.workers[worker].pid > 0) {
+                    logWarning("Worker %d (pid %d) did not stop, killed", worker, PREFORK.workers[worker].pid);
+                    kill(PREFORK.workers[worker].pid, SIGKILL);
+                    waitpid(PREFORK.workers[worker].pid, &status, 0);
+                    PREFORK.workers[worker].pid = 0;
+                }
+            }
+            break;
+        }
+        usleep(100000);
+    }
+}
+
+/**
+ * The master: fork the workers and respawn them until SIGINT or SIGQUIT. It has no threads,
+ * so the workers are forked from a process without locks held by other threads.
+ */
+void runPrefork(int socketServerFd) {
+    int nThreads = getServerThreads();
+    PREFORK.count = OPTIONS.workers;
+    PREFORK.threads = nThreads / PREFORK.count > 0 ? nThreads / PREFORK.count : 1;
+    PREFORK.workers = calloc(PREFORK.count, sizeof(struct PreforkWorkerType));
+    if (PREFORK.workers == NULL) {
+        die("Cannot allocate %d workers", PREFORK.count);
+    }
+    // the reuseport CBPF program indexes the listeners of all the workers as the CPUs of one process
+    if (OPTIONS.incomingCpu) {
+        logWarning("--incoming-cpu is not supported with --workers");
+        OPTIONS.incomingCpu = false;
+    }
+
+    struct sigaction action = {};
+    sigemptyset(&action.sa_mask);
+    action.sa_handler = preforkChildHandler;
+    action.sa_flags = SA_NOCLDSTOP;
+    if (sigaction(SIGCHLD, &action, NULL) == -1) {
+        die("sigaction SIGCHLD failed");
+    }
+
+    int worker;
+    for (worker = 0; worker < PREFORK.count; worker++) {
+        spawnWorker(worker, socketServerFd);
+    }
+
+    time_t drainDeadline = 0;
+    while (!sigintReceived) {
+        reapWorkers();
+        time_t now = time(NULL);
+        if (sigquitReceived) {
+            // SIGQUIT or upgrade: the workers drain their connections and exit, they are not respawned
+            if (drainDeadline == 0) {
+                drainDeadline = now + DRAIN_TIMEOUT;
+                for (worker = 0; worker < PREFORK.count; worker++) {
+                    if (PREFORK.workers[worker].pid > 0) {
+                        kill(PREFORK.workers[worker].pid, SIGQUIT);
+                    }
+                }
+            }
+            int alive = 0;
+            for (worker = 0; worker < PREFORK.count; worker++) {
+                alive += PREFORK.workers[worker].pid > 0;
+            }
+            if (alive == 0 || now >= drainDeadline) {
+                break;
+            }
+        }
+        for (worker = 0; worker < PREFORK.count && !sigintReceived && !sigquitReceived; worker++) {
+            if (PREFORK.workers[worker].pid == 0 && PREFORK.workers[worker].respawnAt <= now) {
+                logInfo("Respawn worker %d", worker);
+                spawnWorker(worker, socketServerFd);
+            }
+        }
+        if (dumpStatsReceived) {
+            dumpStatsReceived = 0;
+            for (worker = 0; worker < PREFORK.count; worker++) {
+                if (PREFORK.workers[worker].pid > 0) {
+                    kill(PREFORK.workers[worker].pid, SIGUSR1);
+                }
+            }
+        }
+        waitUpgrade(socketServerFd, 1000);
+    }
+
+    stopWorkers();
+    free(PREFORK.workers);
+    PREFORK.workers = NULL;
+}
+
+// the CPU of the thread of this process (--reuseport, --cpus): one of its own, in its worker CPUs when pinned
+int getThreadCpu(int thread) {
+    cpu_set_t cpuSet;
+    if (PREFORK.pinned && sched_getaffinity(0, sizeof(cpuSet), &cpuSet) == 0) {
+        return getCpuOfSet(&cpuSet, thread);
+    }
+    getServerCpus(&cpuSet);
+    return getCpuOfSet(&cpuSet, PREFORK.firstCpu + thread);
+}
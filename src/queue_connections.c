@@ -1,12 +1,21 @@
 /**
  *
- * @brief Persistent connections queue by time (HTTP/1.1 keep-alive)
+ * @brief Persistent connections (HTTP/1.1 keep-alive) and their deadlines
  *
- * Code to manage the queue of client connections through the min-heap data structure and an array
- * to store the index of the heap, in order to update the descriptor files, in case they need to update the time.
- * It may happen that they connect before they leave the queue and then the time needs to be updated.
+ * The connections are stored in a growable slab of chunks, allocated as the clients arrive, so a pointer
+ * to a connection is valid until it is dequeued and it is what epoll returns in data.ptr (no fd-indexed arrays).
+ * Every connection has one timer of the timing wheel, with the slot as handle, with its current deadline:
+ * header read after accept, send stall while the response is sent and idle keep-alive between requests.
+ * Changing the deadline is O(1) and only touches the 16 bytes timers, the connections are never moved.
  *
- * @version 0.2
+ * The connection is split in a hot part (fd, state, buffers, offsets) walked by the event loop and a cold
+ * part (request metadata and strings) in a parallel chunk, only used to parse, answer and log the request.
+ *
+ * The request and response buffers, the request parser and the output queue come from per-thread pools and
+ * are attached only while they are used, an idle keep-alive connection holds none of them and the steady state
+ * doesn't call the allocator for them.
+ *
+ * @version 0.5
  * @author chiqui3d
  * @date 2022-09-17
  *
@@ -22,273 +31,397 @@
 
 #include "../lib/die/die.h"
 #include "../lib/logger/logger.h"
+#include "client_limits.h"
 #include "header.h"
 #include "helper.h"
+#include "keep_alive.h"
+#include "options.h"
 #include "queue_connections.h"
 
-struct QueueConnectionsType createQueueConnections() {
-    struct QueueConnectionsType queueConnections;
-    memset(queueConnections.connections, 0, MAX_EPOLL_EVENTS * sizeof(struct QueueConnectionElementType));
-    queueConnections.currentSize = 0;
-    queueConnections.capacity = (int)MAX_EPOLL_EVENTS;
-    memset(queueConnections.indexQueue, -1, MAX_EPOLL_EVENTS * sizeof(int));
-    return queueConnections;
+void initQueueConnections(struct QueueConnectionsType *queueConnections, int capacity) {
+    queueConnections->currentSize = 0;
+    queueConnections->capacity = capacity;
+    queueConnections->chunks = NULL;
+    queueConnections->requestChunks = NULL;
+    queueConnections->chunksCount = 0;
+    queueConnections->freeSlots = NULL;
+    queueConnections->freeSlotsCount = 0;
+    queueConnections->worker = -1;
+    queueConnections->ioCompletions = NULL;
+    queueConnections->ioTickets = 0;
+    queueConnections->draining = false;
+    queueConnections->loopStats = NULL;
+    initCodel(&queueConnections->admission, (unsigned long long)OPTIONS.codelTarget * 1000, CODEL_INTERVAL * 1000);
+    initTransferScheduler(&queueConnections->transfers);
+    initTimingWheel(&queueConnections->timingWheel, monotonicMilliseconds());
+    poolInit(&queueConnections->requestBuffers, BUFFER_REQUEST_SIZE, BUFFER_POOL_CHUNK_SIZE);
+    poolInit(&queueConnections->responseBuffers, BUFFER_RESPONSE_SIZE, BUFFER_POOL_CHUNK_SIZE);
+    poolInit(&queueConnections->parsers, sizeof(struct RequestParserType), BUFFER_POOL_CHUNK_SIZE);
+    poolInit(&queueConnections->outputQueues, sizeof(struct OutputQueueType), BUFFER_POOL_CHUNK_SIZE);
 }
 
-void enqueueConnection(struct QueueConnectionsType *queueConnections, struct QueueConnectionElementType connection) {
-    if (queueConnections->currentSize == queueConnections->capacity) {
-        logWarning("Queue connection is full (max %d). The fd %d cannot be inserted\n", MAX_EPOLL_EVENTS, connection.clientFd);
-        return;
+void freeQueueConnections(struct QueueConnectionsType *queueConnections) {
+    int slot;
+    for (slot = 0; slot < queueConnections->chunksCount * QUEUE_CONNECTIONS_CHUNK_SIZE; slot++) {
+        struct QueueConnectionElementType *connection = getConnectionBySlot(queueConnections, slot);
+        if (connection != NULL) {
+            dequeueConnection(queueConnections, connection);
+        }
     }
-
-    // insert in the last position
-    queueConnections->connections[queueConnections->currentSize] = connection;
-    queueConnections->currentSize++;
-    int indexQueue = queueConnections->currentSize - 1; // last element
-    // loop until the element is minor than its parent or it is the root
-    // shiftUp
-    while (indexQueue != 0 && difftime(connection.priorityTime, queueConnections->connections[parentHeap(indexQueue)].priorityTime) < 0) {
-        swapConnectionElementHeap(&queueConnections->connections[indexQueue], &queueConnections->connections[parentHeap(indexQueue)]);
-        indexQueue = parentHeap(indexQueue);
+    int i;
+    for (i = 0; i < queueConnections->chunksCount; i++) {
+        free(queueConnections->chunks[i]);
+        free(queueConnections->requestChunks[i]);
     }
-    logDebug("Enqueue connection fd %d in the index %d", connection.clientFd, indexQueue);
-    // assign the index of the heap to the array
-    queueConnections->indexQueue[connection.clientFd] = indexQueue;
-}
-bool existsConnection(struct QueueConnectionsType *queueConnections, int clientFd) {
-    return queueConnections->indexQueue[clientFd] != -1;
+    free(queueConnections->chunks);
+    free(queueConnections->requestChunks);
+    free(queueConnections->freeSlots);
+    freeTimingWheel(&queueConnections->timingWheel);
+    freeTransferScheduler(&queueConnections->transfers);
+    queueConnections->chunks = NULL;
+    queueConnections->requestChunks = NULL;
+    queueConnections->freeSlots = NULL;
+    queueConnections->chunksCount = 0;
+    queueConnections->freeSlotsCount = 0;
+    poolDestroy(&queueConnections->requestBuffers);
+    poolDestroy(&queueConnections->responseBuffers);
+    poolDestroy(&queueConnections->parsers);
+    poolDestroy(&queueConnections->outputQueues);
 }
-struct QueueConnectionElementType *getConnectionOrCreateByFd(struct QueueConnectionsType *queueConnections, int fd) {
-
-    int index = queueConnections->indexQueue[fd];
-    if (index == -1) {
-        struct QueueConnectionElementType connection = emptyConnection();
-        connection.clientFd = fd;
-        connection.priorityTime = time(NULL);
-        connection.state = STATE_CONNECTION_RECV;
-        connection.requestBuffer = malloc(sizeof(char) * BUFFER_REQUEST_SIZE);
-        connection.requestBufferLength = BUFFER_REQUEST_SIZE;
-        enqueueConnection(queueConnections, connection);
-        index = queueConnections->indexQueue[fd];
-        if (index == -1) {
-            die("getConnectionByFd: bad queue index");
-        }
+
+// one more chunk of free slots, the previous chunks don't move
+static bool growQueueConnections(struct QueueConnectionsType *queueConnections) {
+    int chunksCount = queueConnections->chunksCount + 1;
+    int slotsCount = chunksCount * QUEUE_CONNECTIONS_CHUNK_SIZE;
+
+    struct QueueConnectionElementType *chunk = malloc(QUEUE_CONNECTIONS_CHUNK_SIZE * sizeof(struct QueueConnectionElementType));
+    struct ConnectionRequestType *requestChunk = calloc(QUEUE_CONNECTIONS_CHUNK_SIZE, sizeof(struct ConnectionRequestType));
+    struct QueueConnectionElementType **chunks = realloc(queueConnections->chunks, chunksCount * sizeof(struct QueueConnectionElementType *));
+    if (chunks != NULL) {
+        queueConnections->chunks = chunks;
+    }
+    struct ConnectionRequestType **requestChunks = realloc(queueConnections->requestChunks, chunksCount * sizeof(struct ConnectionRequestType *));
+    if (requestChunks != NULL) {
+        queueConnections->requestChunks = requestChunks;
+    }
+    int *freeSlots = realloc(queueConnections->freeSlots, slotsCount * sizeof(int));
+    if (freeSlots != NULL) {
+        queueConnections->freeSlots = freeSlots;
+    }
+    if (chunk == NULL || requestChunk == NULL || chunks == NULL || requestChunks == NULL || freeSlots == NULL
+        || !growTimingWheel(&queueConnections->timingWheel, (uint32_t)slotsCount)) {
+        free(chunk);
+        free(requestChunk);
+        logError("Cannot grow the connections queue to %d connections", slotsCount);
+        return false;
     }
 
-    return &queueConnections->connections[index];
+    queueConnections->chunks[queueConnections->chunksCount] = chunk;
+    queueConnections->requestChunks[queueConnections->chunksCount] = requestChunk;
+    int i;
+    for (i = QUEUE_CONNECTIONS_CHUNK_SIZE - 1; i >= 0; i--) {
+        memset(&chunk[i], 0, sizeof(struct QueueConnectionElementType));
+        chunk[i].request = &requestChunk[i];
+        requestChunk[i].requestFd = -1;
+        resetConnection(&chunk[i]);
+        chunk[i].clientFd = -1;
+        chunk[i].slot = queueConnections->chunksCount * QUEUE_CONNECTIONS_CHUNK_SIZE + i;
+        queueConnections->freeSlots[queueConnections->freeSlotsCount] = chunk[i].slot;
+        queueConnections->freeSlotsCount++;
+    }
+    queueConnections->chunksCount = chunksCount;
+    logDebug("Connections queue grown to %d connections", slotsCount);
+    return true;
 }
 
-struct QueueConnectionElementType *getConnectionByFd(struct QueueConnectionsType *queueConnections, int fd) {
-
-    int index = queueConnections->indexQueue[fd];
-    if (index == -1) {
+// create the connection of a new client with its address, NULL if there is no room for it
+struct QueueConnectionElementType *acceptConnection(struct QueueConnectionsType *queueConnections,
+                                                    int fd,
+                                                    struct sockaddr_in *peerAddress) {
+    if (queueConnections->currentSize >= queueConnections->capacity) {
+        logWarning("Queue connection is full (max %d). The fd %d cannot be inserted", queueConnections->capacity, fd);
+        return NULL;
+    }
+    if (queueConnections->freeSlotsCount == 0 && !growQueueConnections(queueConnections)) {
         return NULL;
     }
 
-    return &queueConnections->connections[index];
-}
+    queueConnections->freeSlotsCount--;
+    int slot = queueConnections->freeSlots[queueConnections->freeSlotsCount];
+    struct QueueConnectionElementType *connection = getConnectionBySlot(queueConnections, slot);
+    if (connection != NULL) {
+        die("acceptConnection: the slot %d is not free", slot);
+    }
+    connection = &queueConnections->chunks[slot >> QUEUE_CONNECTIONS_CHUNK_BITS][slot & (QUEUE_CONNECTIONS_CHUNK_SIZE - 1)];
+    connection->clientFd = fd;
+    connection->request->peerAddress = *peerAddress;
+    connection->request->acceptedUs = queueConnections->admission.target > 0 ? monotonicMicroseconds() : 0;
+    connection->request->clientCounted = false;
+    connection->request->paced = false;
+    connection->request->ioWarmed = false;
+    connection->request->clientAdmitted = false;
+    connection->request->requests = 0;
+    connection->state = STATE_CONNECTION_RECV;
+    queueConnections->currentSize++;
+    logDebug("Enqueue connection fd %d in the slot %d", fd, slot);
+
+    // a new client has to send the request headers in time
+    setConnectionDeadline(queueConnections, connection, TIMER_KIND_HEADER_READ);
 
-void updateConnectionByFd(struct QueueConnectionsType *queueConnections, struct QueueConnectionElementType connection) {
+    return connection;
+}
 
-    int index = queueConnections->indexQueue[connection.clientFd];
-    if (index == -1) {
-        die("updateConnectionByFd: bad queue index");
+// NULL if the slot is free or it doesn't exist
+struct QueueConnectionElementType *getConnectionBySlot(struct QueueConnectionsType *queueConnections, int slot) {
+    if (slot < 0 || slot >= queueConnections->chunksCount * QUEUE_CONNECTIONS_CHUNK_SIZE) {
+        return NULL;
+    }
+    struct QueueConnectionElementType *connection =
+        &queueConnections->chunks[slot >> QUEUE_CONNECTIONS_CHUNK_BITS][slot & (QUEUE_CONNECTIONS_CHUNK_SIZE - 1)];
+    if (connection->clientFd == -1) {
+        return NULL;
     }
-    // update the connection
-    queueConnections->connections[index] = connection;
+    return connection;
 }
 
-void updateQueueConnection(struct QueueConnectionsType *queueConnections, int fd) {
+// reset the connection for the next request of the keep-alive, without moving it
+void updateQueueConnection(struct QueueConnectionsType *queueConnections, struct QueueConnectionElementType *connection) {
 
-    logDebug("Update queue connection fd %d", fd);
+    logDebug("Update queue connection fd %d", connection->clientFd);
 
-    int index = queueConnections->indexQueue[fd];
-    time_t oldPriorityTime = queueConnections->connections[index].priorityTime;
-    time_t newPriorityTime = time(NULL);
+    // the responses are sent, the views of their requests are not used anymore
+    compactRequestBuffer(connection);
+    // the request buffer is kept if there are pipelined requests in it
+    if (connection->requestBufferOffset == 0) {
+        releaseRequestBuffer(queueConnections, connection);
+    }
+    releaseResponseBuffer(queueConnections, connection);
+    releaseOutputQueue(queueConnections, connection);
+    resetConnection(connection);
 
-    freeConnection(&queueConnections->connections[index]);
-    queueConnections->connections[index] = emptyConnection();
-    queueConnections->connections[index].clientFd = fd;
-    queueConnections->connections[index].priorityTime = newPriorityTime;
-    queueConnections->connections[index].state = STATE_CONNECTION_RECV;
-    queueConnections->connections[index].requestBuffer = malloc(sizeof(char) * BUFFER_REQUEST_SIZE);
-    queueConnections->connections[index].requestBufferLength = BUFFER_REQUEST_SIZE;
+    setConnectionDeadline(queueConnections, connection, TIMER_KIND_IDLE);
+}
 
-    if (difftime(newPriorityTime, oldPriorityTime) < 0) {
-        // shiftUp
-        while (index != 0 && difftime(newPriorityTime, queueConnections->connections[parentHeap(index)].priorityTime) < 0) {
-            swapConnectionElementHeap(&queueConnections->connections[index], &queueConnections->connections[parentHeap(index)]);
-            index = parentHeap(index);
-        }
-        queueConnections->indexQueue[fd] = index;
-    } else {
-        // shiftDown
-        heapify(queueConnections, index);
+// replace the current deadline of the connection, O(1)
+void setConnectionDeadline(struct QueueConnectionsType *queueConnections,
+                           struct QueueConnectionElementType *connection,
+                           enum TimerKind kind) {
+    unsigned long long timeout;
+    switch (kind) {
+        case TIMER_KIND_IDLE:
+            timeout = getKeepAliveTimeout(queueConnections);
+            break;
+        case TIMER_KIND_HEADER_READ:
+            timeout = HEADER_READ_TIMEOUT;
+            break;
+        case TIMER_KIND_SEND_STALL:
+            timeout = SEND_STALL_TIMEOUT;
+            break;
+        default:
+            removeTimer(&queueConnections->timingWheel, (uint32_t)connection->slot);
+            return;
     }
+    resetTimer(&queueConnections->timingWheel,
+               (uint32_t)connection->slot,
+               monotonicMilliseconds() + timeout * 1000,
+               kind);
 }
 
-void dequeueConnection(struct QueueConnectionsType *queueConnections) {
-    if (queueConnections->currentSize == 0) {
-        logDebug("Queue is empty");
-        return;
-    }
-    int fdFirst = queueConnections->connections[0].clientFd;
-    int fdLast = queueConnections->connections[queueConnections->currentSize - 1].clientFd;
-    logDebug("Dequeue connection fd %d", fdFirst);
+// the transfer is resumed by its timer when the bandwidth limits allow it, rounded up to the next tick
+void setConnectionPacing(struct QueueConnectionsType *queueConnections,
+                         struct QueueConnectionElementType *connection,
+                         unsigned long long waitUs) {
+    resetTimer(&queueConnections->timingWheel,
+               (uint32_t)connection->slot,
+               monotonicMilliseconds() + (waitUs + 999) / 1000,
+               TIMER_KIND_SEND_PACING);
+}
 
-    freeConnection(&queueConnections->connections[0]);
+enum TimerKind getConnectionDeadline(struct QueueConnectionsType *queueConnections,
+                                     struct QueueConnectionElementType *connection) {
+    return (enum TimerKind)queueConnections->timingWheel.timers[connection->slot].kind;
+}
 
-    if (fdFirst == fdLast) {
-        queueConnections->connections[0] = emptyConnection();
-        queueConnections->indexQueue[fdFirst] = -1;
-        queueConnections->currentSize--;
-        return;
+// true if the new connection has to be rejected by the admission controller
+bool shedConnection(struct QueueConnectionsType *queueConnections) {
+    if (queueConnections->admission.target == 0) {
+        return false;
     }
-    // swap the last element with the first
-    queueConnections->connections[0] = queueConnections->connections[queueConnections->currentSize - 1];
-    queueConnections->connections[queueConnections->currentSize - 1] = emptyConnection();
-    // remove the last element
-    queueConnections->currentSize--;
-    // remove the index of the heap from the array
-    queueConnections->indexQueue[fdFirst] = -1;
-    queueConnections->indexQueue[fdLast] = 0;
-    // shiftDown
-    heapify(queueConnections, 0);
+    return shedCodel(&queueConnections->admission, monotonicMicroseconds());
 }
 
-void dequeueConnectionByFd(struct QueueConnectionsType *queueConnections, int fd) {
-    if (queueConnections->currentSize == 0) {
-        logDebug("Queue is empty");
+// the queueing delay of the connection, from accept to the first byte of its first response
+void sampleAdmissionDelay(struct QueueConnectionsType *queueConnections, struct QueueConnectionElementType *connection) {
+    if (connection->request->acceptedUs == 0) {
         return;
     }
-    logDebug("Dequeue connection fd %d", fd);
-    int index = queueConnections->indexQueue[fd];
+    unsigned long long now = monotonicMicroseconds();
+    sampleCodel(&queueConnections->admission, now - connection->request->acceptedUs, now);
+    connection->request->acceptedUs = 0;
+}
 
-    if (index == -1) {
-        logDebug("The fd %d is not in the queue", fd);
+// free the connection and its slot, the caller closes the fd
+void dequeueConnection(struct QueueConnectionsType *queueConnections, struct QueueConnectionElementType *connection) {
+    logDebug("Dequeue connection fd %d", connection->clientFd);
+    if (connection->clientFd == -1) {
+        logDebug("The slot %d is not in the queue", connection->slot);
         return;
     }
-    freeConnection(&queueConnections->connections[index]);
-    int fdLast = queueConnections->connections[queueConnections->currentSize - 1].clientFd;
-    if (fdLast == fd) {
-        logDebug("The fd %d is the same that last fd", fd);
-        int indexLast = queueConnections->indexQueue[fdLast];
-        queueConnections->connections[queueConnections->currentSize - 1] = emptyConnection();
-        queueConnections->currentSize--;
-        queueConnections->indexQueue[fd] = -1;
-        return;
+    removeTimer(&queueConnections->timingWheel, (uint32_t)connection->slot);
+    if (connection->request->clientCounted) {
+        releaseClientConnection(connection->request->peerAddress.sin_addr.s_addr);
+        connection->request->clientCounted = false;
     }
-    // swap the last element with the first
-    swapConnectionElementHeap(&queueConnections->connections[index], &queueConnections->connections[queueConnections->currentSize - 1]);
-    queueConnections->connections[queueConnections->currentSize - 1] = emptyConnection();
-    // remove the last element
+    releaseRequestBuffer(queueConnections, connection);
+    releaseResponseBuffer(queueConnections, connection);
+    releaseOutputQueue(queueConnections, connection);
+    resetConnection(connection);
+    connection->clientFd = -1;
+    queueConnections->freeSlots[queueConnections->freeSlotsCount] = connection->slot;
+    queueConnections->freeSlotsCount++;
     queueConnections->currentSize--;
-    // remove the index of the heap from the array
-    queueConnections->indexQueue[fd] = -1;
-    queueConnections->indexQueue[fdLast] = index;
-    // shiftDown
-    heapify(queueConnections, index);
 }
 
-// Get the value of the front of the queue without removing it
-struct QueueConnectionElementType *peekQueueConnections(struct QueueConnectionsType *queueConnections) {
-    if (queueConnections->currentSize == 0) {
-        logDebug("Queue is empty");
-        return NULL;
+void attachRequestBuffer(struct QueueConnectionsType *queueConnections, struct QueueConnectionElementType *connection) {
+    if (connection->requestBuffer != NULL) {
+        return;
     }
-
-    return &queueConnections->connections[0];
+    connection->requestBuffer = poolAcquire(&queueConnections->requestBuffers);
+    connection->request->parser = poolAcquire(&queueConnections->parsers);
+    if (connection->requestBuffer == NULL || connection->request->parser == NULL) {
+        die("poolAcquire request buffer");
+    }
+    connection->requestBuffer[0] = '\0';
+    connection->requestBufferLength = BUFFER_REQUEST_SIZE;
+    connection->requestBufferOffset = 0;
+    connection->requestBufferStart = 0;
+    initRequestParser(connection->request->parser);
 }
 
-// shiftDown
-void heapify(struct QueueConnectionsType *queueConnections, int index) {
-    int left = leftChildHeap(index);
-    int right = rightChildHeap(index);
-    int smallest = index;
+// the request has been parsed (or nothing arrived), the buffer and its parser go back to the pools
+void releaseRequestBuffer(struct QueueConnectionsType *queueConnections, struct QueueConnectionElementType *connection) {
+    poolRelease(&queueConnections->requestBuffers, connection->requestBuffer);
+    poolRelease(&queueConnections->parsers, connection->request->parser);
+    connection->requestBuffer = NULL;
+    connection->request->parser = NULL;
+    connection->requestBufferLength = 0;
+    connection->requestBufferOffset = 0;
+    connection->requestBufferStart = 0;
+}
 
-    if (left < queueConnections->currentSize && difftime(queueConnections->connections[left].priorityTime, queueConnections->connections[smallest].priorityTime) < 0) {
-        smallest = left;
-    }
-    if (right < queueConnections->currentSize && difftime(queueConnections->connections[right].priorityTime, queueConnections->connections[smallest].priorityTime) < 0) {
-        smallest = right;
+void attachResponseBuffer(struct QueueConnectionsType *queueConnections, struct QueueConnectionElementType *connection) {
+    if (connection->responseBufferHeaders != NULL) {
+        return;
     }
-    if (smallest != index) { // if the smallest is not the current index, then swap
-        swapConnectionElementHeap(&queueConnections->connections[index], &queueConnections->connections[smallest]);
-        queueConnections->indexQueue[queueConnections->connections[index].clientFd] = index;
-        queueConnections->indexQueue[queueConnections->connections[smallest].clientFd] = smallest;
-        heapify(queueConnections, smallest);
+    connection->responseBufferHeaders = poolAcquire(&queueConnections->responseBuffers);
+    if (connection->responseBufferHeaders == NULL) {
+        die("poolAcquire response buffer");
     }
+    connection->responseBufferHeadersLength = 0;
+    connection->responseBufferHeadersOffset = 0;
 }
 
-int leftChildHeap(int element) {
-    return 2 * element + 1;
+void releaseResponseBuffer(struct QueueConnectionsType *queueConnections, struct QueueConnectionElementType *connection) {
+    poolRelease(&queueConnections->responseBuffers, connection->responseBufferHeaders);
+    connection->responseBufferHeaders = NULL;
+    connection->responseBufferHeadersLength = 0;
+    connection->responseBufferHeadersOffset = 0;
 }
 
-int rightChildHeap(int element) {
-    return 2 * element + 2;
+// the segments of the responses queued by the epoll backend
+void attachOutputQueue(struct QueueConnectionsType *queueConnections, struct QueueConnectionElementType *connection) {
+    if (connection->request->output != NULL) {
+        return;
+    }
+    connection->request->output = poolAcquire(&queueConnections->outputQueues);
+    if (connection->request->output == NULL) {
+        die("poolAcquire output queue");
+    }
+    connection->request->output->head = 0;
+    connection->request->output->count = 0;
 }
 
-int parentHeap(int element) {
-    return (element - 1) / 2;
+// the segments not sent are dropped and their files closed
+void releaseOutputQueue(struct QueueConnectionsType *queueConnections, struct QueueConnectionElementType *connection) {
+    if (connection->request->output == NULL) {
+        return;
+    }
+    clearOutputQueue(connection->request->output);
+    poolRelease(&queueConnections->outputQueues, connection->request->output);
+    connection->request->output = NULL;
 }
-void swapConnectionElementHeap(struct QueueConnectionElementType *a, struct QueueConnectionElementType *b) {
-    struct QueueConnectionElementType temp = *a;
-    *a = *b;
-    *b = temp;
+
+// only the request and response fields, the fd, slot, address and deadline of the connection are kept
+void resetConnection(struct QueueConnectionElementType *connection) {
+    freeConnection(connection);
+    connection->state = STATE_CONNECTION_RECV;
+    connection->transferScheduled = false;
+    connection->bodyFd = -1;
+    connection->bodyLength = 0;
+    connection->bodyOffset = 0;
 }
 
+// metadata of the current request, also between the pipelined requests of the same buffer
+void resetConnectionRequest(struct QueueConnectionElementType *connection) {
+    struct ConnectionRequestType *request = connection->request;
+    // views of the request buffer, the parser is reset when the request is consumed
+    request->requestData = NULL;
+    request->path = NULL;
+    request->requestBody = NULL;
+    request->requestBodyLength = 0;
+    if (request->absolutePath != NULL) {
+        free(request->absolutePath);
+        request->absolutePath = NULL;
+    }
+    if (request->requestFd != -1) {
+        close(request->requestFd);
+        request->requestFd = -1;
+    }
+    request->keepAlive = false;
+    request->keepAliveTimeout = 0;
+    request->contentEncoding = CONTENT_ENCODING_NONE;
+    request->scheme[0] = '\0';
+    request->protocolVersion[0] = '\0';
+    request->method = METHOD_GET;
+    request->responseStatusCode = HTTP_STATUS_OK;
+}
+
+// the heap allocations and files of the request and the response, the pooled buffers and the output queue
+// are released by the connections queue
 void freeConnection(struct QueueConnectionElementType *connection) {
 
     if (connection->bodyFd > 0) {
         close(connection->bodyFd);
+        connection->bodyFd = -1;
     }
-    if (connection->path != NULL) {
-        free(connection->path);
-    }
-    if (connection->absolutePath != NULL) {
-        free(connection->absolutePath);
-    }
-    if (connection->requestBuffer != NULL) {
-        free(connection->requestBuffer);
-    }
-    if (connection->responseBufferHeaders != NULL) {
-        free(connection->responseBufferHeaders);
-    }
-    if (connection->requestHeaders != NULL) {
-        freeHeader(connection->requestHeaders);
-    }
-    if (connection->requestBody != NULL) {
-        free(connection->requestBody);
-    }
+    resetConnectionRequest(connection);
 }
 
-struct QueueConnectionElementType emptyConnection() {
-    struct QueueConnectionElementType connection;
-    memset(&connection, 0, sizeof(struct QueueConnectionElementType));
-    connection.clientFd = 0;
-    connection.bodyFd = -1;
-    connection.requestBuffer = NULL;
-    connection.requestBufferLength = 0;
-    connection.requestBufferOffset = 0;
-    connection.state = STATE_CONNECTION_RECV;
-    connection.requestBody = NULL;
-    connection.requestHeaders = NULL;
-    connection.responseBufferHeaders = NULL;
-    connection.responseBufferHeadersLength = 0;
-    connection.responseBufferHeadersOffset = 0;
-    connection.path = NULL;
-    connection.absolutePath = NULL;
-    connection.keepAlive = false;
-    connection.method = METHOD_GET;
-    connection.responseStatusCode = HTTP_STATUS_OK;
+/**
+ * The first request not answered yet is answered, the parser goes on with the pipelined request after it.
+ * Its bytes stay in the buffer, the request views are used until its response is sent.
+ */
+void consumeRequestBuffer(struct QueueConnectionElementType *connection, size_t length) {
+    connection->requestBufferStart += length;
+    initRequestParser(connection->request->parser);
+    connection->request->clientAdmitted = false;
+}
 
-    return connection;
+// drop the answered requests, the parser offsets are from the start of its request so they are still valid
+void compactRequestBuffer(struct QueueConnectionElementType *connection) {
+    if (connection->requestBufferStart == 0) {
+        return;
+    }
+    size_t rest = connection->requestBufferOffset - connection->requestBufferStart;
+    memmove(connection->requestBuffer, connection->requestBuffer + connection->requestBufferStart, rest);
+    connection->requestBuffer[rest] = '\0';
+    connection->requestBufferOffset = rest;
+    connection->requestBufferStart = 0;
 }
 
-void printConnection(struct QueueConnectionElementType connection) {
+void printConnection(struct QueueConnectionsType *queueConnections, struct QueueConnectionElementType *connection) {
     errno = 0;
-    char date[20];
-    timeToDatetimeString(connection.priorityTime, date);
+    struct TimerType *timer = &queueConnections->timingWheel.timers[connection->slot];
 
     logDebug("Connection fd %d,"
              " bodyFd %d,"
@@ -296,38 +429,40 @@ void printConnection(struct QueueConnectionElementType connection) {
              " keepAlive %d,"
              " method %d,"
              " responseStatusCode %d,"
-             " Date %s",
-             connection.clientFd,
-             connection.bodyFd,
-             connection.state,
-             connection.keepAlive,
-             connection.method,
-             connection.responseStatusCode,
-             date);
+             " deadline %s at tick %llu",
+             connection->clientFd,
+             connection->bodyFd,
+             connection->state,
+             connection->request->keepAlive,
+             connection->request->method,
+             connection->request->responseStatusCode,
+             timerKindList[timer->kind],
+             (unsigned long long)timer->expires);
 }
 
 void printQueueConnections(struct QueueConnectionsType *queueConnections) {
     errno = 0;
-    logDebug("Current Size: %d, Capacity: %d", queueConnections->currentSize, queueConnections->capacity);
-    int i;
-    char date[20];
-    for (i = 0; i < queueConnections->currentSize; i++) {
-        int index = queueConnections->indexQueue[queueConnections->connections[i].clientFd];
-        if (index != -1) {
-            timeToDatetimeString(queueConnections->connections[i].priorityTime, date);
-            // We show both the queue data and the array that stores the queue indexes,
-            // to see if they match between updates and deletes.
-            logDebug("index: %d, fd: %d, time: %ld, date: %s | index: %d, fd: %d, time: %ld",
-                     i,
-                     queueConnections->connections[i].clientFd,
-                     queueConnections->connections[i].priorityTime,
-                     date,
-                     index,
-                     queueConnections->connections[index].clientFd,
-                     queueConnections->connections[index].priorityTime);
+    logDebug("Current Size: %d, Capacity: %d, Slots: %d, Timers: %lu, Tick: %llu",
+             queueConnections->currentSize,
+             queueConnections->capacity,
+             queueConnections->chunksCount * QUEUE_CONNECTIONS_CHUNK_SIZE,
+             queueConnections->timingWheel.count,
+             queueConnections->timingWheel.currentTick);
+    int slot;
+    for (slot = 0; slot < queueConnections->chunksCount * QUEUE_CONNECTIONS_CHUNK_SIZE; slot++) {
+        struct QueueConnectionElementType *connection = getConnectionBySlot(queueConnections, slot);
+        if (connection != NULL) {
+            // both the slot and the slot stored in the connection, to see if they match between updates and deletes
+            struct TimerType *timer = &queueConnections->timingWheel.timers[slot];
+            logDebug("slot: %d | slot: %d, fd: %d, deadline: %s, tick: %llu",
+                     slot,
+                     connection->slot,
+                     connection->clientFd,
+                     timerKindList[timer->kind],
+                     (unsigned long long)timer->expires);
         }
     }
     if (queueConnections->currentSize == 0) {
         logDebug("Empty queue");
     }
-}
\ No newline at end of file
+}
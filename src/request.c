@@ -2,6 +2,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 
 #include "../lib/color/color.h"
 #include "../lib/die/die.h"
@@ -11,18 +12,40 @@
 #include "request.h"
 #include "server.h"
 
-bool isRequestComplete(char *buffer) {
-    char *endOfRequest = strstr(buffer, "\r\n\r\n");
-    if (endOfRequest != NULL) {
-        return true;
+/**
+ * @brief Length of the first request of the buffer not answered yet: headers and the body of its content-length
+ *
+ * The parser goes on from where the previous call stopped, with the bytes received since then. There can be
+ * more pipelined requests after it, they are never read as its body. A request has the whole buffer once the
+ * answered ones before it are compacted, a longer one is a bad request (413, 414 or 431).
+ *
+ * @return 0 if the request is not complete yet, its length if it is complete or bad (answered with its errorStatus)
+ */
+size_t getRequestLength(struct QueueConnectionElementType *connection) {
+    struct RequestParserType *parser = connection->request->parser;
+    if (parser->state != REQUEST_PARSER_DONE && parser->state != REQUEST_PARSER_ERROR) {
+        char *data = connection->requestBuffer + connection->requestBufferStart;
+        size_t length = connection->requestBufferOffset - connection->requestBufferStart;
+        if (parseRequest(parser, data, length, connection->requestBufferLength - 1) == REQUEST_PARSE_INCOMPLETE) {
+            return 0;
+        }
     }
-    return false;
+    return getParsedRequestLength(parser);
 }
 
 void recvRequest(struct QueueConnectionElementType *connection) {
 
+    // read until EAGAIN (edge triggered), every complete request is processed in the next state
     while (1) {
-        ssize_t bytesRead = recv(connection->clientFd, connection->requestBuffer + connection->requestBufferOffset, connection->requestBufferLength - connection->requestBufferOffset, 0);
+        // the pooled buffer may hold pipelined requests, it is always NUL terminated after the received bytes
+        size_t available = connection->requestBufferLength - connection->requestBufferOffset - 1;
+        if (available == 0) {
+            // the buffer is compacted before the reads, so a full one ends its request: complete, or too large
+            // for the buffer and answered with 413, 414 or 431. The rest is read after answering the buffered requests
+            connection->state = STATE_CONNECTION_SEND_HEADERS;
+            break;
+        }
+        ssize_t bytesRead = recv(connection->clientFd, connection->requestBuffer + connection->requestBufferOffset, available, 0);
         if (bytesRead < 0) {
             if (errno == EINTR) {
                 // interrupted by a signal before any data was read
@@ -30,10 +53,8 @@ void recvRequest(struct QueueConnectionElementType *connection) {
             }
             // EWOULDBLOCK|EAGAIN, it not mean you're disconnected, it just means there's nothing to read now
             if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                if (isRequestComplete(connection->requestBuffer)) {
-                    connection->requestBuffer[connection->requestBufferOffset] = 0;
+                if (getRequestLength(connection) > 0) {
                     connection->state = STATE_CONNECTION_SEND_HEADERS;
-                    connection->requestBufferOffset = 0;
                     break;
                 }
                 logDebug("recvRequest EWOULDBLOCK|EAGAIN");
@@ -49,181 +70,114 @@ void recvRequest(struct QueueConnectionElementType *connection) {
             connection->state = STATE_CONNECTION_DONE_FOR_CLOSE;
             break;
         }
-        // TODO: 413 Entity too large
         connection->requestBufferOffset += bytesRead;
-        if (isRequestComplete(connection->requestBuffer)) {
-            connection->requestBuffer[connection->requestBufferOffset] = 0;
-            connection->state = STATE_CONNECTION_SEND_HEADERS;
-            connection->requestBufferOffset = 0;
-            break;
-        }
+        connection->requestBuffer[connection->requestBufferOffset] = '\0';
     }
 }
 
-// false: bad request
+// the request parsed by getRequestLength, its views are kept until the request is consumed. false: bad request
 bool processRequest(struct QueueConnectionElementType *connection) {
+    struct ConnectionRequestType *request = connection->request;
+    struct RequestParserType *parser = request->parser;
+    strCopySafe(request->scheme, "http");
 
-    char *buffer = connection->requestBuffer;
-    strCopySafe(connection->scheme, "http");
-
-    // get ip address from clientFd socket
-    struct sockaddr_in clientAddr;
-    socklen_t clientAddrLen = sizeof(clientAddr);
-    if (getpeername(connection->clientFd, (struct sockaddr *)&clientAddr, &clientAddrLen) < 0) {
-        logError("getpeername failed");
-        return false;
-    }
-
-    char *ip = inet_ntoa(clientAddr.sin_addr);
-    strCopySafe(connection->ip, ip);
-
-    char *firstLine = strstr(buffer, "\r\n"); // CRLF
-    if (NULL == firstLine) {
-        logError("firstLine is NULL, no CRLF found. Report bad request");
+    if (parser->state != REQUEST_PARSER_DONE) {
+        logError("Malformed request (%d), parser stopped at byte %zu. Report bad request", parser->errorStatus,
+                 getParsedRequestLength(parser));
         return false;
     }
 
-    size_t firstLineLength = firstLine - buffer;
-    char requestLine[firstLineLength + 1];
-
-    strncpy(requestLine, buffer, firstLineLength);
-    requestLine[firstLineLength] = '\0';
-    // printf("requestLine:\n%s\n", requestLine);
-
-    // buffer without first line and CRLF
-    buffer += firstLineLength + 2;
+    char *data = connection->requestBuffer + connection->requestBufferStart;
+    request->requestData = data;
+    request->path = data + parser->path.offset;
+    request->method = strToMethod(data + parser->method.offset);
+    size_t versionLength = parser->version.length < sizeof(request->protocolVersion) ? parser->version.length : sizeof(request->protocolVersion) - 1;
+    memcpy(request->protocolVersion, data + parser->version.offset, versionLength);
+    request->protocolVersion[versionLength] = '\0';
 
-    char method[10], path[REQUEST_PATH_MAX_SIZE], protocolVersion[9];
-    sscanf(requestLine, "%s %s %s", method, path, protocolVersion);
-
-    connection->path = strdup(path);
-    connection->method = strToMethod(method);
-    strCopySafe(connection->protocolVersion, protocolVersion);
-
-    if (connection->method == METHOD_UNSUPPORTED) {
-        logError("UNSUPPORTED method %s", method);
+    if (request->method == METHOD_UNSUPPORTED) {
+        logError("UNSUPPORTED method %s", data + parser->method.offset);
         return false;
     }
 
-    char realPath[REQUEST_PATH_MAX_SIZE];
-    strCopySafe(realPath, connection->path);
-    char *tmpQuery = strchr(realPath, '?');
-    if (tmpQuery != NULL) {
-        *tmpQuery = '\0';
-    }
-    // is Index
-    if (realPath[0] == '/' && realPath[1] == '\0') {
-        strncat(realPath, "index.html", 11);
-    }
-
-    size_t absolutePathSize = strlen(OPTIONS.htmlDir) + strlen(realPath) + 1;
-    char absolutePath[absolutePathSize];
-    snprintf(absolutePath, absolutePathSize, "%s%s", OPTIONS.htmlDir, realPath);
-    connection->absolutePath = strdup(absolutePath);
-
-    // printf("buffer:\n%s\n", buffer);
-
-    char *body = strstr(buffer, "\r\n\r\n"); // double CRLF pair to end of headers
-    if (NULL == body) {
-        logInfo("Request without headers");
-        return true;
-    }
-    body += 4; // remove double CRLF pair to end of headers and beginning of body
-    int bodyLength = strlen(body);
-    body[bodyLength] = '\0';
-    if (bodyLength > 0) {
-        connection->requestBody = strdup(body);
-    }
-
-    // printf("body:\n%s\n", body);
-
-    size_t headersSize = body - connection->requestBuffer - firstLineLength;
-    char headersString[headersSize + 1];
-    strncpy(headersString, connection->requestBuffer + firstLineLength, headersSize);
-    headersString[headersSize] = '\0';
-    // printf("headersString:\n%s\n", headersString);
-
-    char *header = strtok(headersString, "\r\n");
-    while (header != NULL) {
-
-        size_t nameLen = strcspn(header, ": ");
-        char *name = malloc((nameLen + 1) * sizeof(char));
-        if (NULL == name) {
-            die("malloc name");
+    // the only allocation of a request, the path without the query in the html directory
+    if (request->absolutePath == NULL) {
+        size_t pathLength = strcspn(request->path, "?");
+        const char *index = "";
+        if (pathLength == 1 && request->path[0] == '/') {
+            index = "index.html";
         }
-        memcpy(name, header, nameLen);
-        name[nameLen] = '\0';
-
-        size_t valueLen = strcspn(header + nameLen + 2, "\r\n");
-        char *value = malloc((valueLen + 1) * sizeof(char));
-        if (NULL == value) {
-            die("malloc value");
-        }
-        memcpy(value, header + nameLen + 2, valueLen);
-        value[valueLen] = '\0';
-
-        struct Header *headerNode = malloc(sizeof(struct Header));
-        if (NULL == headerNode) {
-            die("malloc header");
+        size_t htmlDirLength = strlen(OPTIONS.htmlDir);
+        size_t indexLength = strlen(index);
+        request->absolutePath = malloc(htmlDirLength + pathLength + indexLength + 1);
+        if (request->absolutePath == NULL) {
+            die("malloc absolutePath");
         }
+        memcpy(request->absolutePath, OPTIONS.htmlDir, htmlDirLength);
+        memcpy(request->absolutePath + htmlDirLength, request->path, pathLength);
+        memcpy(request->absolutePath + htmlDirLength + pathLength, index, indexLength + 1);
+    }
 
-        char *nameLower = toLower(name, strlen(name));
-        free(name);
-
-        headerNode->name = nameLower;
-        headerNode->value = value;
-        headerNode->next = connection->requestHeaders;
-        connection->requestHeaders = headerNode;
-        header = strtok(NULL, "\r\n");
+    if (parser->body.length > 0) {
+        request->requestBody = data + parser->body.offset;
+        request->requestBodyLength = parser->body.length;
     }
 
     return true;
 }
 
+// the value of a well-known request header, NULL if the request does not have it
+char *getRequestHeader(struct ConnectionRequestType *request, enum HeaderId id) {
+    if (request->requestData == NULL) {
+        return NULL;
+    }
+    return getHeaderById(&request->parser->headers, request->requestData, id);
+}
+
 void printRequest(struct QueueConnectionElementType connection) {
     printf(RED "Request: \n" RESET);
-    printf("Method: %s\n", methodToStr(connection.method));
-    printf("Path: %s\n", connection.path);
-    printf("Absolute path: %s\n", connection.absolutePath);
-    printf("Protocol Version: %s\n", connection.protocolVersion);
-    printf("IP: %s\n", connection.ip);
-    printf("Scheme: %s\n", connection.scheme);
+    printf("Method: %s\n", methodToStr(connection.request->method));
+    printf("Path: %s\n", connection.request->path);
+    printf("Absolute path: %s\n", connection.request->absolutePath);
+    printf("Protocol Version: %s\n", connection.request->protocolVersion);
+    char ip[INET_ADDRSTRLEN];
+    printf("IP: %s\n", peerAddressToString(&connection.request->peerAddress, ip));
+    printf("Scheme: %s\n", connection.request->scheme);
     printf("Headers:\n");
-    struct Header *header = connection.requestHeaders;
-    while (header != NULL) {
-        printf("%s: %s\n", header->name, header->value);
-        header = header->next;
+    if (connection.request->requestData != NULL) {
+        printHeaders(&connection.request->parser->headers, connection.request->requestData);
     }
-    if (connection.requestBody != NULL) {
-        printf("Body: %s\n", connection.requestBody);
+    if (connection.request->requestBody != NULL) {
+        printf("Body: %.*s\n", (int)connection.request->requestBodyLength, connection.request->requestBody);
     }
     printf("\n\n");
 }
 
 void logRequest(struct QueueConnectionElementType connection) {
 
-    size_t bodyLength = strlen(connection.requestBody == NULL ? "" : connection.requestBody);
-    char *userAgent = getHeader(connection.requestHeaders, "user-agent");
-    char *referer = getHeader(connection.requestHeaders, "referer");
-    char *host = getHeader(connection.requestHeaders, "host");
+    size_t bodyLength = connection.request->requestBodyLength;
+    char *userAgent = getRequestHeader(connection.request, HEADER_USER_AGENT);
+    char *referer = getRequestHeader(connection.request, HEADER_REFERER);
+    char *host = getRequestHeader(connection.request, HEADER_HOST);
+    const char *path = connection.request->path != NULL ? connection.request->path : "-";
     char URL[REQUEST_PATH_MAX_SIZE];
+    char ip[INET_ADDRSTRLEN];
 
     if (host != NULL) {
         // TODO: not use host header for URL
-        size_t URLLen = snprintf(NULL, 0, "%s%s%s%s", connection.scheme, "://", host, connection.path);
-        snprintf(URL, URLLen + 1, "%s%s%s%s", connection.scheme, "://", host, connection.path);
-    } else if (connection.path != NULL) {
-        strCopySafe(URL, connection.path);
+        snprintf(URL, sizeof(URL), "%s%s%s%s", connection.request->scheme, "://", host, path);
+    } else if (connection.request->path != NULL) {
+        strCopySafe(URL, connection.request->path);
     } else {
         strncpy(URL, "<URL>", 6);
     }
 
     logInfo("Request | \"%s %s %s\" - %lu - %s - %s - %s - \"%s\"",
-            methodToStr(connection.method),
-            connection.path,
-            connection.protocolVersion,
+            methodToStr(connection.request->method),
+            path,
+            connection.request->protocolVersion,
             bodyLength,
-            connection.ip,
+            peerAddressToString(&connection.request->peerAddress, ip),
             URL,
             (referer != NULL ? referer : ""),
             (userAgent != NULL ? userAgent : ""));
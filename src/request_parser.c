@@ -0,0 +1,286 @@
+/**
+ *
+ * @brief Incremental zero-copy parser of the HTTP/1.x requests
+ *
+ * The request grows in the buffer of the connection with every recv, and the parser goes on from the byte
+ * where it stopped, so a client that sends its request byte by byte costs one pass over it (instead of a
+ * search of the end of the headers from the start after every recv). The tokens are views into the buffer:
+ * offsets from the start of the request, terminated in place. The lines may end with CRLF or a bare LF.
+ * The runs of bytes of a token, target or value are scanned by the kernels of request_scan.c.
+ *
+ * https://www.rfc-editor.org/rfc/rfc9112#section-2.2
+ *
+ */
+
+#include <string.h> // for memset()
+
+#include "request_parser.h"
+#include "request_scan.h"
+
+void initRequestParser(struct RequestParserType *parser) {
+    parser->state = REQUEST_PARSER_METHOD_START;
+    parser->position = 0;
+    parser->tokenStart = 0;
+    parser->tokenEnd = 0;
+    parser->headersLength = 0;
+    parser->contentLength = 0;
+    parser->errorStatus = HTTP_STATUS_BAD_REQUEST;
+    memset(&parser->method, 0, sizeof(struct RequestViewType));
+    memset(&parser->path, 0, sizeof(struct RequestViewType));
+    memset(&parser->version, 0, sizeof(struct RequestViewType));
+    memset(&parser->body, 0, sizeof(struct RequestViewType));
+    memset(&parser->name, 0, sizeof(struct RequestViewType));
+    initHeaderTable(&parser->headers);
+}
+
+static struct RequestViewType endToken(struct RequestParserType *parser, char *data, uint16_t end) {
+    struct RequestViewType view = {.offset = parser->tokenStart, .length = end - parser->tokenStart};
+    data[end] = '\0';
+    return view;
+}
+
+// only digits, and the same value if it is repeated
+static bool parseContentLength(struct RequestParserType *parser, char *value, uint16_t length, bool repeated) {
+    if (length == 0) {
+        return false;
+    }
+    unsigned long contentLength = 0;
+    uint16_t i;
+    for (i = 0; i < length; i++) {
+        if (value[i] < '0' || value[i] > '9') {
+            return false;
+        }
+        contentLength = contentLength * 10 + (unsigned long)(value[i] - '0');
+        if (contentLength > REQUEST_CONTENT_LENGTH_MAX) {
+            return false;
+        }
+    }
+    if (repeated && contentLength != parser->contentLength) {
+        return false;
+    }
+    parser->contentLength = contentLength;
+    return true;
+}
+
+static bool endHeader(struct RequestParserType *parser, char *data) {
+    struct RequestViewType value = endToken(parser, data, parser->tokenEnd);
+    enum HeaderId id = getHeaderId(data + parser->name.offset, parser->name.length);
+    if (id == HEADER_CONTENT_LENGTH) {
+        bool repeated = parser->headers.known[HEADER_CONTENT_LENGTH] != 0;
+        if (!parseContentLength(parser, data + value.offset, value.length, repeated)) {
+            return false;
+        }
+    }
+    return addHeader(&parser->headers, parser->name, value, id);
+}
+
+// the run of value bytes from position, the value ends after its last byte that is not whitespace
+static uint16_t scanValue(struct RequestParserType *parser, char *data, uint16_t position, uint16_t end) {
+    uint16_t run = position + REQUEST_SCAN.valueLength(data + position, end - position);
+    uint16_t last = run;
+    while (last > position && (data[last - 1] == ' ' || data[last - 1] == '\t')) {
+        last--;
+    }
+    if (last > position) {
+        parser->tokenEnd = last;
+    }
+    return run;
+}
+
+/**
+ * @brief Parse the bytes of the request received since the previous call
+ *
+ * @param data the request, from its first byte (the same on every call)
+ * @param length bytes of the request received so far, the pipelined requests after it are not read
+ * @param maxLength room for the request in the buffer, a longer one is answered with 413, 414 or 431
+ */
+enum RequestParseResult parseRequest(struct RequestParserType *parser, char *data, size_t length, size_t maxLength) {
+    if (maxLength > REQUEST_PARSER_MAX_LENGTH) {
+        maxLength = REQUEST_PARSER_MAX_LENGTH;
+    }
+    if (length > maxLength) {
+        length = maxLength;
+    }
+    uint16_t end = (uint16_t)length;
+    uint16_t position = parser->position;
+
+    while (position < end && parser->state < REQUEST_PARSER_BODY) {
+        unsigned char c = (unsigned char)data[position];
+        switch (parser->state) {
+            case REQUEST_PARSER_METHOD_START:
+                if (c == '\r' || c == '\n') {
+                    break;
+                }
+                if (!isTokenChar(c)) {
+                    parser->state = REQUEST_PARSER_ERROR;
+                    break;
+                }
+                parser->tokenStart = position;
+                parser->state = REQUEST_PARSER_METHOD;
+                break;
+            case REQUEST_PARSER_METHOD:
+                position += REQUEST_SCAN.tokenLength(data + position, end - position);
+                if (position == end) {
+                    continue;
+                }
+                if (data[position] != ' ') {
+                    parser->state = REQUEST_PARSER_ERROR;
+                    break;
+                }
+                parser->method = endToken(parser, data, position);
+                parser->state = REQUEST_PARSER_PATH_START;
+                break;
+            case REQUEST_PARSER_PATH_START:
+            case REQUEST_PARSER_VERSION_START:
+                if (c == ' ') {
+                    break;
+                }
+                if (!isPathChar(c)) {
+                    parser->state = REQUEST_PARSER_ERROR;
+                    break;
+                }
+                parser->tokenStart = position;
+                parser->state = parser->state == REQUEST_PARSER_PATH_START ? REQUEST_PARSER_PATH : REQUEST_PARSER_VERSION;
+                break;
+            case REQUEST_PARSER_PATH:
+                position += REQUEST_SCAN.pathLength(data + position, end - position);
+                if (position == end) {
+                    continue;
+                }
+                if (data[position] != ' ') {
+                    // HTTP/0.9 requests have no version
+                    parser->state = REQUEST_PARSER_ERROR;
+                    break;
+                }
+                parser->path = endToken(parser, data, position);
+                parser->state = REQUEST_PARSER_VERSION_START;
+                break;
+            case REQUEST_PARSER_VERSION:
+                position += REQUEST_SCAN.pathLength(data + position, end - position);
+                if (position == end) {
+                    continue;
+                }
+                c = (unsigned char)data[position];
+                if (c != '\r' && c != '\n') {
+                    parser->state = REQUEST_PARSER_ERROR;
+                    break;
+                }
+                parser->version = endToken(parser, data, position);
+                parser->state = c == '\r' ? REQUEST_PARSER_LINE_LF : REQUEST_PARSER_HEADER_START;
+                break;
+            case REQUEST_PARSER_LINE_LF:
+                parser->state = c == '\n' ? REQUEST_PARSER_HEADER_START : REQUEST_PARSER_ERROR;
+                break;
+            case REQUEST_PARSER_HEADER_START:
+                if (c == '\r') {
+                    parser->state = REQUEST_PARSER_HEADERS_LF;
+                    break;
+                }
+                if (c == '\n') {
+                    parser->headersLength = position + 1;
+                    parser->state = REQUEST_PARSER_BODY;
+                    break;
+                }
+                // also the obsolete line folding, a header starting with whitespace
+                if (!isTokenChar(c)) {
+                    parser->state = REQUEST_PARSER_ERROR;
+                    break;
+                }
+                parser->tokenStart = position;
+                parser->state = REQUEST_PARSER_HEADER_NAME;
+                break;
+            case REQUEST_PARSER_HEADER_NAME:
+                position += REQUEST_SCAN.tokenLength(data + position, end - position);
+                if (position == end) {
+                    continue;
+                }
+                // no whitespace before the colon
+                if (data[position] != ':' || parser->headers.count == REQUEST_HEADERS_MAX) {
+                    parser->state = REQUEST_PARSER_ERROR;
+                    break;
+                }
+                // lower case in place, so the lookups hash and compare bytes
+                REQUEST_SCAN.lowerCase(data + parser->tokenStart, data + parser->tokenStart, position - parser->tokenStart);
+                parser->name = endToken(parser, data, position);
+                parser->state = REQUEST_PARSER_VALUE_START;
+                break;
+            case REQUEST_PARSER_VALUE_START:
+                if (c == ' ' || c == '\t') {
+                    break;
+                }
+                parser->tokenStart = position;
+                parser->tokenEnd = position;
+                parser->state = REQUEST_PARSER_VALUE;
+                continue;
+            case REQUEST_PARSER_VALUE:
+                position = scanValue(parser, data, position, end);
+                if (position == end) {
+                    continue;
+                }
+                c = (unsigned char)data[position];
+                if ((c != '\r' && c != '\n') || !endHeader(parser, data)) {
+                    parser->state = REQUEST_PARSER_ERROR;
+                    break;
+                }
+                parser->state = c == '\r' ? REQUEST_PARSER_LINE_LF : REQUEST_PARSER_HEADER_START;
+                break;
+            case REQUEST_PARSER_HEADERS_LF:
+                if (c != '\n') {
+                    parser->state = REQUEST_PARSER_ERROR;
+                    break;
+                }
+                parser->headersLength = position + 1;
+                parser->state = REQUEST_PARSER_BODY;
+                break;
+            default:
+                break;
+        }
+        if (parser->state == REQUEST_PARSER_ERROR) {
+            break;
+        }
+        position++;
+    }
+    parser->position = position;
+
+    if (parser->state < REQUEST_PARSER_BODY && position >= maxLength) {
+        // the buffer is full and the headers go on
+        parser->errorStatus =
+            parser->state < REQUEST_PARSER_LINE_LF ? HTTP_STATUS_URI_TOO_LONG : HTTP_STATUS_REQUEST_HEADER_FIELDS_TOO_LARGE;
+        parser->state = REQUEST_PARSER_ERROR;
+    }
+    if (parser->state == REQUEST_PARSER_ERROR) {
+        // at least one byte, the bad request is answered
+        if (parser->position == 0) {
+            parser->position = 1;
+        }
+        return REQUEST_PARSE_ERROR;
+    }
+    if (parser->state == REQUEST_PARSER_BODY) {
+        if (parser->headers.known[HEADER_TRANSFER_ENCODING] != 0) {
+            // no chunked bodies, their bytes would be read as the next pipelined request, and with a
+            // content-length too it is a request smuggling attempt (RFC 9112 section 6.1)
+            parser->errorStatus = parser->headers.known[HEADER_CONTENT_LENGTH] == 0 ? HTTP_STATUS_NOT_IMPLEMENTED
+                                                                                    : HTTP_STATUS_BAD_REQUEST;
+            parser->state = REQUEST_PARSER_ERROR;
+            return REQUEST_PARSE_ERROR;
+        }
+        if (parser->contentLength > maxLength - parser->headersLength) {
+            parser->errorStatus = HTTP_STATUS_CONTENT_TOO_LARGE;
+            parser->state = REQUEST_PARSER_ERROR;
+            return REQUEST_PARSE_ERROR;
+        }
+        if (length < parser->headersLength + parser->contentLength) {
+            return REQUEST_PARSE_INCOMPLETE;
+        }
+        parser->body.offset = parser->headersLength;
+        parser->body.length = (uint16_t)parser->contentLength;
+        parser->position = parser->headersLength + (uint16_t)parser->contentLength;
+        parser->state = REQUEST_PARSER_DONE;
+    }
+    return parser->state == REQUEST_PARSER_DONE ? REQUEST_PARSE_COMPLETE : REQUEST_PARSE_INCOMPLETE;
+}
+
+// bytes of the request, headers and body, once it is complete (or up to the error)
+size_t getParsedRequestLength(struct RequestParserType *parser) {
+    return parser->position;
+}
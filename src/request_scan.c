@@ -0,0 +1,225 @@
+/**
+ *
+ * @brief Vectorised byte scans of the request parser, selected at startup with CPUID
+ *
+ * The parser spends its time in the runs of bytes of the same class: the method and header names (tchar),
+ * the target and the version, and the header values up to their CR, which are most of a request with
+ * cookies. Every kernel returns the length of the leading run, 16 or 32 bytes per step:
+ *
+ * - SSE4.2: PCMPESTRI in ranges mode finds the first control byte of a target or value, and the tchar class,
+ *   too many ranges for it, is a PSHUFB lookup of a bitmap indexed by the low nibble (one bit per high nibble).
+ * - AVX2: the same lookup on 32 bytes, and unsigned comparisons for the targets and values.
+ *
+ * Only whole blocks are loaded, the tail goes through the scalar loop, so nothing is read past the length.
+ *
+ */
+
+#include "request_scan.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h> // for _mm_cmpestri() and _mm256_shuffle_epi8()
+#define REQUEST_SCAN_X86
+#endif
+
+static size_t tokenLengthScalar(const char *data, size_t length) {
+    size_t i = 0;
+    while (i < length && isTokenChar((unsigned char)data[i])) {
+        i++;
+    }
+    return i;
+}
+
+static size_t pathLengthScalar(const char *data, size_t length) {
+    size_t i = 0;
+    while (i < length && isPathChar((unsigned char)data[i])) {
+        i++;
+    }
+    return i;
+}
+
+static size_t valueLengthScalar(const char *data, size_t length) {
+    size_t i = 0;
+    while (i < length && isValueChar((unsigned char)data[i])) {
+        i++;
+    }
+    return i;
+}
+
+static void lowerCaseScalar(char *destination, const char *source, size_t length) {
+    size_t i;
+    for (i = 0; i < length; i++) {
+        char c = source[i];
+        destination[i] = c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c;
+    }
+}
+
+#ifdef REQUEST_SCAN_X86
+
+// bit h of the byte l is set if the byte h << 4 | l is a tchar, the bytes from 0x80 are not
+#define REQUEST_SCAN_TOKEN_ROWS 0xE8, 0xFC, 0xF8, 0xFC, 0xFC, 0xFC, 0xFC, 0xFC, 0xF8, 0xF8, 0xF4, 0x54, 0xD0, 0x54, 0xF4, 0x70
+#define REQUEST_SCAN_HIGH_BITS 0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0, 0, 0, 0, 0, 0, 0, 0
+
+// bytes that end a target (controls, space and DEL) and a value (controls but tab, and DEL), as PCMPESTRI ranges
+static const char pathRanges[16] = "\x00\x20\x7F\x7F";
+static const char valueRanges[16] = "\x00\x08\x0A\x1F\x7F\x7F";
+#define REQUEST_SCAN_RANGES (_SIDD_UBYTE_OPS | _SIDD_CMP_RANGES | _SIDD_LEAST_SIGNIFICANT)
+
+__attribute__((target("sse4.2"))) static size_t tokenLengthSse42(const char *data, size_t length) {
+    const __m128i rows = _mm_setr_epi8(REQUEST_SCAN_TOKEN_ROWS);
+    const __m128i highBits = _mm_setr_epi8(REQUEST_SCAN_HIGH_BITS);
+    const __m128i lowNibble = _mm_set1_epi8(0x0F);
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+        __m128i bytes = _mm_loadu_si128((const __m128i *)(data + i));
+        __m128i row = _mm_shuffle_epi8(rows, _mm_and_si128(bytes, lowNibble));
+        __m128i bit = _mm_shuffle_epi8(highBits, _mm_and_si128(_mm_srli_epi16(bytes, 4), lowNibble));
+        unsigned int other = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(row, bit), _mm_setzero_si128()));
+        if (other != 0) {
+            return i + __builtin_ctz(other);
+        }
+    }
+    return i + tokenLengthScalar(data + i, length - i);
+}
+
+__attribute__((target("sse4.2"))) static size_t pathLengthSse42(const char *data, size_t length) {
+    const __m128i ranges = _mm_loadu_si128((const __m128i *)pathRanges);
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+        int index = _mm_cmpestri(ranges, 4, _mm_loadu_si128((const __m128i *)(data + i)), 16, REQUEST_SCAN_RANGES);
+        if (index != 16) {
+            return i + index;
+        }
+    }
+    return i + pathLengthScalar(data + i, length - i);
+}
+
+__attribute__((target("sse4.2"))) static size_t valueLengthSse42(const char *data, size_t length) {
+    const __m128i ranges = _mm_loadu_si128((const __m128i *)valueRanges);
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+        int index = _mm_cmpestri(ranges, 6, _mm_loadu_si128((const __m128i *)(data + i)), 16, REQUEST_SCAN_RANGES);
+        if (index != 16) {
+            return i + index;
+        }
+    }
+    return i + valueLengthScalar(data + i, length - i);
+}
+
+// 'A' + 0x3F is -128 as a signed byte, so the upper case letters are the bytes below -128 + 26 after the add
+__attribute__((target("sse4.2"))) static void lowerCaseSse42(char *destination, const char *source, size_t length) {
+    const __m128i shift = _mm_set1_epi8(0x3F);
+    const __m128i limit = _mm_set1_epi8(-128 + 26);
+    const __m128i toLower = _mm_set1_epi8('a' - 'A');
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+        __m128i bytes = _mm_loadu_si128((const __m128i *)(source + i));
+        __m128i upper = _mm_cmplt_epi8(_mm_add_epi8(bytes, shift), limit);
+        _mm_storeu_si128((__m128i *)(destination + i), _mm_add_epi8(bytes, _mm_and_si128(upper, toLower)));
+    }
+    lowerCaseScalar(destination + i, source + i, length - i);
+}
+
+__attribute__((target("avx2"))) static size_t tokenLengthAvx2(const char *data, size_t length) {
+    const __m256i rows = _mm256_setr_epi8(REQUEST_SCAN_TOKEN_ROWS, REQUEST_SCAN_TOKEN_ROWS);
+    const __m256i highBits = _mm256_setr_epi8(REQUEST_SCAN_HIGH_BITS, REQUEST_SCAN_HIGH_BITS);
+    const __m256i lowNibble = _mm256_set1_epi8(0x0F);
+    size_t i = 0;
+    for (; i + 32 <= length; i += 32) {
+        __m256i bytes = _mm256_loadu_si256((const __m256i *)(data + i));
+        __m256i row = _mm256_shuffle_epi8(rows, _mm256_and_si256(bytes, lowNibble));
+        __m256i bit = _mm256_shuffle_epi8(highBits, _mm256_and_si256(_mm256_srli_epi16(bytes, 4), lowNibble));
+        unsigned int other = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_and_si256(row, bit), _mm256_setzero_si256()));
+        if (other != 0) {
+            return i + __builtin_ctz(other);
+        }
+    }
+    return i + tokenLengthScalar(data + i, length - i);
+}
+
+// the bytes from 0x21 (max_epu8 keeps them) but DEL
+__attribute__((target("avx2"))) static size_t pathLengthAvx2(const char *data, size_t length) {
+    const __m256i first = _mm256_set1_epi8(0x21);
+    const __m256i del = _mm256_set1_epi8(0x7F);
+    size_t i = 0;
+    for (; i + 32 <= length; i += 32) {
+        __m256i bytes = _mm256_loadu_si256((const __m256i *)(data + i));
+        __m256i visible = _mm256_cmpeq_epi8(_mm256_max_epu8(bytes, first), bytes);
+        __m256i path = _mm256_andnot_si256(_mm256_cmpeq_epi8(bytes, del), visible);
+        unsigned int other = ~(unsigned int)_mm256_movemask_epi8(path);
+        if (other != 0) {
+            return i + __builtin_ctz(other);
+        }
+    }
+    return i + pathLengthScalar(data + i, length - i);
+}
+
+// the bytes from the space and the tab, but DEL
+__attribute__((target("avx2"))) static size_t valueLengthAvx2(const char *data, size_t length) {
+    const __m256i space = _mm256_set1_epi8(' ');
+    const __m256i tab = _mm256_set1_epi8('\t');
+    const __m256i del = _mm256_set1_epi8(0x7F);
+    size_t i = 0;
+    for (; i + 32 <= length; i += 32) {
+        __m256i bytes = _mm256_loadu_si256((const __m256i *)(data + i));
+        __m256i visible = _mm256_or_si256(_mm256_cmpeq_epi8(_mm256_max_epu8(bytes, space), bytes),
+                                          _mm256_cmpeq_epi8(bytes, tab));
+        __m256i value = _mm256_andnot_si256(_mm256_cmpeq_epi8(bytes, del), visible);
+        unsigned int other = ~(unsigned int)_mm256_movemask_epi8(value);
+        if (other != 0) {
+            return i + __builtin_ctz(other);
+        }
+    }
+    return i + valueLengthScalar(data + i, length - i);
+}
+
+__attribute__((target("avx2"))) static void lowerCaseAvx2(char *destination, const char *source, size_t length) {
+    const __m256i shift = _mm256_set1_epi8(0x3F);
+    const __m256i limit = _mm256_set1_epi8(-128 + 26);
+    const __m256i toLower = _mm256_set1_epi8('a' - 'A');
+    size_t i = 0;
+    for (; i + 32 <= length; i += 32) {
+        __m256i bytes = _mm256_loadu_si256((const __m256i *)(source + i));
+        __m256i upper = _mm256_cmpgt_epi8(limit, _mm256_add_epi8(bytes, shift));
+        _mm256_storeu_si256((__m256i *)(destination + i), _mm256_add_epi8(bytes, _mm256_and_si256(upper, toLower)));
+    }
+    lowerCaseScalar(destination + i, source + i, length - i);
+}
+
+#endif // REQUEST_SCAN_X86
+
+static const struct RequestScanType requestScanKernels[REQUEST_SCAN_LEVELS] = {
+    [REQUEST_SCAN_SCALAR] = {"scalar", tokenLengthScalar, pathLengthScalar, valueLengthScalar, lowerCaseScalar},
+#ifdef REQUEST_SCAN_X86
+    [REQUEST_SCAN_SSE42] = {"sse4.2", tokenLengthSse42, pathLengthSse42, valueLengthSse42, lowerCaseSse42},
+    [REQUEST_SCAN_AVX2] = {"avx2", tokenLengthAvx2, pathLengthAvx2, valueLengthAvx2, lowerCaseAvx2},
+#endif
+};
+
+struct RequestScanType REQUEST_SCAN = {"scalar", tokenLengthScalar, pathLengthScalar, valueLengthScalar, lowerCaseScalar};
+
+// the kernels of the level, NULL if the CPU (or the build) does not have its instructions
+const struct RequestScanType *getRequestScanKernels(enum RequestScanLevel level) {
+    if (level < 0 || level >= REQUEST_SCAN_LEVELS || requestScanKernels[level].name == NULL) {
+        return NULL;
+    }
+#ifdef REQUEST_SCAN_X86
+    __builtin_cpu_init();
+    if ((level == REQUEST_SCAN_SSE42 && !__builtin_cpu_supports("sse4.2"))
+        || (level == REQUEST_SCAN_AVX2 && !__builtin_cpu_supports("avx2"))) {
+        return NULL;
+    }
+#endif
+    return &requestScanKernels[level];
+}
+
+// the widest kernels of the CPU, before the threads start
+void initRequestScan() {
+    int level;
+    for (level = REQUEST_SCAN_LEVELS - 1; level > REQUEST_SCAN_SCALAR; level--) {
+        const struct RequestScanType *kernels = getRequestScanKernels((enum RequestScanLevel)level);
+        if (kernels != NULL) {
+            REQUEST_SCAN = *kernels;
+            return;
+        }
+    }
+}
@@ -2,53 +2,114 @@
 #include <errno.h>        // for errno
 #include <fcntl.h>        // for open()
 #include <magic.h>        // for magic_open() mime type detection
+#include <pthread.h>      // for pthread_self()
 #include <stdbool.h>      // for bool()
 #include <stdio.h>        // for sprintf()
 #include <string.h>       // for strlen()
-#include <sys/sendfile.h> // for sendfile()
 #include <sys/socket.h>   // for send()
-#include <unistd.h>       // for close()
+#include <unistd.h>       // for close() and pread()
 
 #include "../lib/die/die.h"
 #include "../lib/logger/logger.h"
-#include "header.h"
 #include "helper.h"
+#include "io_pool.h"
 #include "options.h"
+#include "output_queue.h"
+#include "request.h"
 #include "response.h"
 #include "server.h"
 
-void unsupportedProtocolResponse(int clientFd, char *protocolVersion) {
-    char responseBuffer[1024];
-    snprintf(responseBuffer, 1024, versionNotSupportedResponseTemplate, protocolVersion);
-    sendAll(clientFd, responseBuffer, strlen(responseBuffer));
+// the response buffer of the connection has to be attached, the response is appended after the previous ones
+void unsupportedProtocolResponse(struct QueueConnectionElementType *connection, char *protocolVersion) {
+    char *response = connection->responseBufferHeaders + connection->responseBufferHeadersLength;
+    size_t responseSize = BUFFER_RESPONSE_SIZE - connection->responseBufferHeadersLength;
+    size_t length = snprintf(response, responseSize, versionNotSupportedResponseTemplate, protocolVersion);
+    connection->responseBufferHeadersLength += length < responseSize ? length : responseSize - 1;
+    queueCannedResponse(connection, response);
 }
 
-void tooManyRequestResponse(int clientFd) {
-    sendAll(clientFd, tooManyRequestResponseTemplate, strlen(tooManyRequestResponseTemplate));
+void tooManyRequestResponse(struct QueueConnectionElementType *connection) {
+    connection->request->responseStatusCode = HTTP_STATUS_TOO_MANY_REQUESTS;
+    queueCannedResponse(connection, tooManyRequestResponseTemplate);
 }
 
-void badRequestResponse(int clientFd) {
-    sendAll(clientFd, badRequestResponseTemplate, strlen(badRequestResponseTemplate));
+void serviceUnavailableResponse(struct QueueConnectionElementType *connection) {
+    connection->request->responseStatusCode = HTTP_STATUS_SERVICE_UNAVAILABLE;
+    queueCannedResponse(connection, serviceUnavailableResponseTemplate);
 }
 
-void helloResponse(int clientFd) { sendAll(clientFd, helloResponseTemplate, strlen(helloResponseTemplate)); }
+/**
+ * Drop the request bytes already received without copying them (MSG_TRUNC), a close with unread data
+ * resets the connection and the client could lose the rejection
+ */
+void discardRequest(int clientFd) {
+    while (recv(clientFd, NULL, BUFFER_REQUEST_SIZE, MSG_DONTWAIT | MSG_TRUNC) > 0) {
+    }
+}
+
+// the connection cannot be queued: best effort canned response (503, 429) without waiting for the socket, and close
+void rejectConnection(int clientFd, const char *response) {
+    discardRequest(clientFd);
+    if (send(clientFd, response, strlen(response), MSG_DONTWAIT | MSG_NOSIGNAL) == -1) {
+        logDebug("Cannot send the rejection to the fd %d", clientFd);
+    }
+    close(clientFd);
+}
+
+// the canned response of a request rejected by the parser, by the status of its error
+char *getBadRequestTemplate(enum HTTP_STATUS_CODE status) {
+    switch (status) {
+        case HTTP_STATUS_CONTENT_TOO_LARGE:
+            return contentTooLargeResponseTemplate;
+        case HTTP_STATUS_URI_TOO_LONG:
+            return uriTooLongResponseTemplate;
+        case HTTP_STATUS_REQUEST_HEADER_FIELDS_TOO_LARGE:
+            return headerFieldsTooLargeResponseTemplate;
+        case HTTP_STATUS_NOT_IMPLEMENTED:
+            return notImplementedResponseTemplate;
+        default:
+            return badRequestResponseTemplate;
+    }
+}
+
+// the connection is closed after the response, the bytes not read yet (of a request too large) would reset it
+void badRequestResponse(struct QueueConnectionElementType *connection) {
+    discardRequest(connection->clientFd);
+    connection->request->responseStatusCode = connection->request->parser->errorStatus;
+    queueCannedResponse(connection, getBadRequestTemplate(connection->request->parser->errorStatus));
+}
+
+void helloResponse(struct QueueConnectionElementType *connection) {
+    queueCannedResponse(connection, helloResponseTemplate);
+}
+
+// the canned responses are queued without copying and close the connection once sent
+void queueCannedResponse(struct QueueConnectionElementType *connection, const char *response) {
+    connection->request->keepAlive = false;
+    pushOutputMemory(connection->request->output, response, strlen(response));
+}
 
 void makeResponse(struct QueueConnectionElementType *connection) {
 
     /******* 1. Get file fd (bodyFd) *******/
     struct stat statResponseBodyFd;
-    int bodyFd = open(connection->absolutePath, O_RDONLY);
+    // already opened by the probe of the I/O threads
+    int bodyFd = connection->request->requestFd;
+    connection->request->requestFd = -1;
+    if (bodyFd == -1) {
+        bodyFd = open(connection->request->absolutePath, O_RDONLY);
+    }
     if (bodyFd == -1) {
-        logError("Absolute path file %s not found", connection->absolutePath);
+        logError("Absolute path file %s not found", connection->request->absolutePath);
         // read html template for errors
         size_t errorPathSize = strlen(OPTIONS.htmlDir) + strlen("/error/error.html") + 1;
         char errorPath[errorPathSize];
         // TODO: switch for errno with HTTP_STATUS_CODE and save message in Response ?
         if (errno == ENOENT) {
-            connection->responseStatusCode = HTTP_STATUS_NOT_FOUND;
+            connection->request->responseStatusCode = HTTP_STATUS_NOT_FOUND;
             snprintf(errorPath, errorPathSize, "%s%s", OPTIONS.htmlDir, "/error/404.html");
         } else {
-            connection->responseStatusCode = HTTP_STATUS_INTERNAL_SERVER_ERROR;
+            connection->request->responseStatusCode = HTTP_STATUS_INTERNAL_SERVER_ERROR;
             snprintf(errorPath, errorPathSize, "%s%s", OPTIONS.htmlDir, "/error/error.html");
         }
         bodyFd = open(errorPath, O_RDONLY);
@@ -60,7 +121,7 @@ void makeResponse(struct QueueConnectionElementType *connection) {
     } else {
         /* Stat the input file to obtain its size. */
         fstat(bodyFd, &statResponseBodyFd);
-        connection->responseStatusCode = HTTP_STATUS_OK;
+        connection->request->responseStatusCode = HTTP_STATUS_OK;
     }
 
     connection->bodyFd = bodyFd;
@@ -72,17 +133,19 @@ void makeResponse(struct QueueConnectionElementType *connection) {
     getMimeType(connection, mimeType);
 
     /** Generate gzip encoding **/
-    char *acceptEncodingHeader = getHeader(connection->requestHeaders, "accept-encoding");
+    char *acceptEncodingHeader = getRequestHeader(connection->request, HEADER_ACCEPT_ENCODING);
     if (acceptEncodingHeader != NULL && strstr(acceptEncodingHeader, "gzip") != NULL) {
         makeContentEncoding(connection, statResponseBodyFd, mimeType);
     }
 
     /******* 2. make response headers *******/
-    size_t responseHeaderSize = 1024;
-    char responseHeader[responseHeaderSize];
+    // pooled buffer attached by the caller (attachResponseBuffer), after the headers of the previous pipelined
+    // responses
+    size_t responseHeaderSize = BUFFER_RESPONSE_SIZE - connection->responseBufferHeadersLength;
+    char *responseHeader = connection->responseBufferHeaders + connection->responseBufferHeadersLength;
 
     char statusCodeReason[33];
-    strCopySafe(statusCodeReason, (char *)HTTP_STATUS_REASON(connection->responseStatusCode));
+    strCopySafe(statusCodeReason, (char *)HTTP_STATUS_REASON(connection->request->responseStatusCode));
 
     char lastModifiedDate[100];
     struct tm *tm = localtime(&statResponseBodyFd.st_mtime);
@@ -96,31 +159,33 @@ void makeResponse(struct QueueConnectionElementType *connection) {
     size_t offset = snprintf(responseHeader,
                              responseHeaderSize,
                              "%s %u %s\n",
-                             connection->protocolVersion,
-                             connection->responseStatusCode,
+                             connection->request->protocolVersion,
+                             connection->request->responseStatusCode,
                              statusCodeReason);
 
     // TODO: handle Content-Encoding, hardcode for now
-    if (connection->contentEncoding == CONTENT_ENCODING_GZIP) {
+    if (connection->request->contentEncoding == CONTENT_ENCODING_GZIP) {
         offset += snprintf(responseHeader + offset, responseHeaderSize - offset, "content-encoding: gzip\n");
     }
 
-    // get connection header request
-    char *connectionHeader = getHeader(connection->requestHeaders, "connection");
-
-    // add keep-alive header
-    if (connectionHeader != NULL && *connectionHeader == 'k') {
-        connection->keepAlive = true;
-        size_t lenHeaderKeepAlive = snprintf(NULL, 0, "timeout=%i", KEEP_ALIVE_TIMEOUT);
-        char headerKeepAliveValue[lenHeaderKeepAlive + 1];
-        snprintf(headerKeepAliveValue, lenHeaderKeepAlive + 1, "timeout=%i", KEEP_ALIVE_TIMEOUT);
-
+    // keep-alive decided by applyKeepAlivePolicy, the header advertises the timeout and requests left
+    if (connection->request->keepAliveTimeout > 0) {
+        connection->request->keepAlive = true;
         offset += snprintf(responseHeader + offset, responseHeaderSize - offset, "connection: %s\n", "keep-alive");
-        offset +=
-            snprintf(responseHeader + offset, responseHeaderSize - offset, "keep-alive: %s\n", headerKeepAliveValue);
+        offset += snprintf(responseHeader + offset,
+                           responseHeaderSize - offset,
+                           "keep-alive: timeout=%d",
+                           connection->request->keepAliveTimeout);
+        if (OPTIONS.keepAliveRequests > 0) {
+            offset += snprintf(responseHeader + offset,
+                               responseHeaderSize - offset,
+                               ", max=%u",
+                               OPTIONS.keepAliveRequests - connection->request->requests);
+        }
+        offset += snprintf(responseHeader + offset, responseHeaderSize - offset, "\n");
     } else {
 
-        connection->keepAlive = false;
+        connection->request->keepAlive = false;
         offset += snprintf(responseHeader + offset, responseHeaderSize - offset, "connection: close\n");
     }
 
@@ -138,98 +203,85 @@ void makeResponse(struct QueueConnectionElementType *connection) {
                        "cache-control: %s\n\n",
                        "private, no-cache, no-store, must-revalidate");
 
-    // save headers in the buffer
-    connection->responseBufferHeadersOffset = 0;
-    connection->responseBufferHeadersLength = offset;
-    connection->responseBufferHeaders = strdup(responseHeader);
+    connection->responseBufferHeadersLength += offset < responseHeaderSize ? offset : responseHeaderSize - 1;
+
+    inlineResponseBody(connection);
 }
 
-void sendResponseHeaders(struct QueueConnectionElementType *connection) {
-    while (1) {
-        ssize_t bytesSend = send(connection->clientFd,
-                                 connection->responseBufferHeaders + connection->responseBufferHeadersOffset,
-                                 connection->responseBufferHeadersLength - connection->responseBufferHeadersOffset,
-                                 0);
-        if (bytesSend < 0) {
-            if (errno == EINTR) {
-                continue;
-            }
-            if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                if (connection->responseBufferHeadersOffset == connection->responseBufferHeadersLength) {
-                    connection->state = STATE_CONNECTION_SEND_BODY;
-                    connection->responseBufferHeadersOffset = 0;
-                    return;
-                }
-                logDebug("sendResponseHeaders EWOULDBLOCK|EAGAIN");
-                return;
-            }
-            logError("send() response failed. DoneForClose");
-            connection->state = STATE_CONNECTION_DONE_FOR_CLOSE;
-            return;
-        }
-        connection->responseBufferHeadersOffset += bytesSend;
-        if (bytesSend == 0) {
-            logDebug("0 bytes send, client disconnected");
-            connection->state = STATE_CONNECTION_DONE_FOR_CLOSE;
-            return;
-        }
-        if (connection->responseBufferHeadersOffset == connection->responseBufferHeadersLength) {
-            connection->state = STATE_CONNECTION_SEND_BODY;
-            connection->responseBufferHeadersOffset = 0;
-            return;
-        }
+// a small body goes after the headers in the same buffer: one send, one packet, and the file is closed now
+void inlineResponseBody(struct QueueConnectionElementType *connection) {
+    size_t room = BUFFER_RESPONSE_SIZE - connection->responseBufferHeadersLength - 1;
+    if (connection->bodyFd == -1 || connection->bodyLength > RESPONSE_INLINE_BODY_MAX_SIZE || connection->bodyLength > room) {
+        return;
     }
+    ssize_t bytesRead = pread(connection->bodyFd,
+                              connection->responseBufferHeaders + connection->responseBufferHeadersLength,
+                              connection->bodyLength,
+                              connection->bodyOffset);
+    if (bytesRead != (ssize_t)connection->bodyLength) {
+        // sent from the file as usual
+        return;
+    }
+    connection->responseBufferHeadersLength += bytesRead;
+    close(connection->bodyFd);
+    connection->bodyFd = -1;
 }
 
-void sendResponseFile(struct QueueConnectionElementType *connection) {
-
-    if (connection->bodyFd == -1) {
-        connection->state = STATE_CONNECTION_DONE;
-        connection->bodyOffset = 0;
-        return;
+/**
+ * @brief Queue the response made by makeResponse: its headers in the pooled buffer and the body as a file range
+ *
+ * @param headersOffset where makeResponse started the headers in the response buffer
+ */
+void queueResponse(struct QueueConnectionElementType *connection, size_t headersOffset) {
+    struct OutputQueueType *output = connection->request->output;
+    pushOutputMemory(output,
+                     connection->responseBufferHeaders + headersOffset,
+                     connection->responseBufferHeadersLength - headersOffset);
+    if (connection->bodyFd != -1) {
+        // the output queue closes the file once sent
+        pushOutputFile(output, connection->bodyFd, connection->bodyOffset, connection->bodyLength);
+        connection->bodyFd = -1;
     }
-    while (1) {
-        ssize_t bytesSend = sendfile(connection->clientFd,
-                                     connection->bodyFd,
-                                     &connection->bodyOffset,
-                                     connection->bodyLength - connection->bodyOffset);
-        if (bytesSend < 0) {
-            if (errno == EINTR) {
-                continue;
-            }
-            if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                if (connection->bodyOffset == connection->bodyLength) {
-                    connection->state = STATE_CONNECTION_DONE;
-                    connection->bodyOffset = 0;
-                    close(connection->bodyFd);
-                    connection->bodyFd = -1;
-                    return;
-                }
-                logDebug("sendResponseFile EWOULDBLOCK|EAGAIN");
-                return;
-            }
-            logError("sendfile() response failed. DoneForClose");
-            connection->state = STATE_CONNECTION_DONE_FOR_CLOSE;
-            return;
-        }
-        if (bytesSend == 0) {
-            logDebug("0 bytes send with sendfile, client disconnected");
-            connection->state = STATE_CONNECTION_DONE_FOR_CLOSE;
-            return;
-        }
-        if (connection->bodyOffset == connection->bodyLength) {
+}
+
+/**
+ * @brief Send at most quantum bytes of the output queue
+ *
+ * STATE_CONNECTION_DONE when everything is sent, the state is kept if the socket is full (EPOLLOUT resumes it)
+ * or the quantum is used (the caller schedules it)
+ *
+ * @param bytesSent bytes sent, to reset the send stall deadline
+ */
+enum OutputFlushResult sendResponse(struct QueueConnectionElementType *connection, size_t quantum, size_t *bytesSent) {
+    enum OutputFlushResult result = flushOutputQueue(connection->request->output, connection->clientFd, quantum, bytesSent);
+    switch (result) {
+        case OUTPUT_FLUSH_DONE:
             connection->state = STATE_CONNECTION_DONE;
-            connection->bodyOffset = 0;
-            close(connection->bodyFd);
-            connection->bodyFd = -1;
-            return;
-        }
+            break;
+        case OUTPUT_FLUSH_AGAIN:
+            logDebug("sendResponse EWOULDBLOCK|EAGAIN");
+            break;
+        case OUTPUT_FLUSH_QUANTUM:
+            break;
+        case OUTPUT_FLUSH_ERROR:
+            logError("send() response failed. DoneForClose");
+            connection->state = STATE_CONNECTION_DONE_FOR_CLOSE;
+            break;
     }
+    return result;
 }
 
-void getMimeType(struct QueueConnectionElementType *connection, char *mimeType) {
+// the magic database of the event loop thread, loaded by its first response
+static _Thread_local magic_t mimeMagic;
 
-    magic_t magic = magic_open(MAGIC_MIME_TYPE | MAGIC_PRESERVE_ATIME | MAGIC_SYMLINK);
+static magic_t loadMimeMagic() {
+    if (mimeMagic != NULL) {
+        return mimeMagic;
+    }
+    mimeMagic = magic_open(MAGIC_MIME_TYPE | MAGIC_PRESERVE_ATIME | MAGIC_SYMLINK);
+    if (mimeMagic == NULL) {
+        die("magic_open() error");
+    }
     // get current directory path
     char cwd[1024];
     if (getcwd(cwd, sizeof(cwd)) == NULL) {
@@ -243,26 +295,36 @@ void getMimeType(struct QueueConnectionElementType *connection, char *mimeType)
      *  /usr/share/misc/magic.mgc
      **/
     strncat(cwd, "/include/web.magic.mgc:/usr/share/misc/magic.mgc", 49);
-    if (magic_load(magic, cwd) != 0) {
-        magic_close(magic);
-        die("magic_load() error");
+    if (magic_load(mimeMagic, cwd) != 0) {
+        die("magic_load() error: %s", magic_error(mimeMagic));
+    }
+    return mimeMagic;
+}
+
+// at the end of the event loop thread
+void closeMimeMagic() {
+    if (mimeMagic != NULL) {
+        magic_close(mimeMagic);
+        mimeMagic = NULL;
     }
-    const char *magicMimeType = magic_descriptor(magic, connection->bodyFd);
-    strCopySafe(mimeType, (char *)magicMimeType);
+}
+
+void getMimeType(struct QueueConnectionElementType *connection, char *mimeType) {
+    const char *magicMimeType = magic_descriptor(loadMimeMagic(), connection->bodyFd);
+    strCopySafe(mimeType, (char *)(magicMimeType != NULL ? magicMimeType : "application/octet-stream"));
 
     if (strcmp(mimeType, "text/") > 0) {
         strncat(mimeType, "; charset=UTF-8", 16);
     }
-    magic_close(magic);
 }
 
 void makeContentEncoding(struct QueueConnectionElementType *connection, struct stat statResponseBodyFd,
                          char *mimeType) {
     // get file name from absolute path
-    char *fileName = strrchr(connection->absolutePath, '/');
+    char *fileName = strrchr(connection->request->absolutePath, '/');
     if (fileName == NULL) {
         // TODO: Support for directory listing or index.html
-        die("File name not found in absolute path %s, possibly a directory", connection->absolutePath);
+        die("File name not found in absolute path %s, possibly a directory", connection->request->absolutePath);
     }
     fileName++;
 
@@ -271,8 +333,8 @@ void makeContentEncoding(struct QueueConnectionElementType *connection, struct s
         die("getcwd() error");
     }
 
-    char relativePathFile[strlen(connection->absolutePath)];
-    strCopySafe(relativePathFile, connection->absolutePath + strlen(OPTIONS.htmlDir));
+    char relativePathFile[strlen(connection->request->absolutePath)];
+    strCopySafe(relativePathFile, connection->request->absolutePath + strlen(OPTIONS.htmlDir));
 
     size_t relativePathLength = strlen(relativePathFile) - strlen(fileName);
     char relativePath[relativePathLength + 1];
@@ -284,46 +346,91 @@ void makeContentEncoding(struct QueueConnectionElementType *connection, struct s
     char pathGzipCache[pathGzipCacheLen];
 
     snprintf(pathGzipCache, pathGzipCacheLen, "%s/cache/gzip%s", cwd, relativePath);
-    if (makeDirectory(pathGzipCache, 755) == -1) {
-        die("Error creating directory: %s", pathGzipCache);
-    }
 
     size_t gzipPathLen = snprintf(NULL, 0, "%s%ld-%s.gz", pathGzipCache, statResponseBodyFd.st_atime, fileName);
     gzipPathLen++; // for null terminator
     char gzipPath[gzipPathLen];
     snprintf(gzipPath, gzipPathLen, "%s%ld-%s.gz", pathGzipCache, statResponseBodyFd.st_atime, fileName);
 
-    // open gzip file
-    if (access(gzipPath, F_OK) != 0) {
-        logDebug("Gzip file %s not found. Create .gz file", gzipPath);
-        gzFile gzFd = gzopen(gzipPath, "wb");
-        if (gzFd == NULL) {
-            die("Error opening gzip file %s", gzipPath);
+    int gzipFd;
+    if (IO_POOL.count > 0) {
+        // the loop does not wait for the disk: identity encoding until an I/O thread has written the .gz
+        if (!probeFileOpen(gzipPath, &gzipFd) || gzipFd == -1 || !probeFileRange(gzipFd, 0)) {
+            if (gzipFd != -1) {
+                close(gzipFd);
+            }
+            submitIoGzip(connection->request->absolutePath, gzipPath);
+            return;
         }
-        // level 1-9, 1 is fastest, 9 is best compression
-        if(gzsetparams(gzFd, 6, Z_DEFAULT_STRATEGY) != Z_OK) {
-            die("Error setting gzip parameters");
+    } else {
+        if (access(gzipPath, F_OK) != 0) {
+            logDebug("Gzip file %s not found. Create .gz file", gzipPath);
+            if (!makeGzipCache(connection->request->absolutePath, gzipPath)) {
+                return;
+            }
         }
-
-        // copy bodyFd to gzFd
-        char bufferEncoding[1024];
-        ssize_t bytesRead;
-        while ((bytesRead = read(connection->bodyFd, bufferEncoding, 1024)) > 0) {
-            gzwrite(gzFd, bufferEncoding, bytesRead);
+        gzipFd = open(gzipPath, O_RDONLY | O_CLOEXEC);
+        if (gzipFd == -1) {
+            logError("Error opening gzip file %s", gzipPath);
+            return;
         }
-        gzclose(gzFd);
     }
     close(connection->bodyFd);
-    // open gzip file
-    int gzipFd = open(gzipPath, O_RDONLY);
-    if (gzipFd == -1) {
-        die("Error opening gzip file %s", gzipPath);
-    }
     struct stat statResponseGzBodyFd;
     // Stat the input file to obtain its size.
     fstat(gzipFd, &statResponseGzBodyFd);
     // set gzip header
     connection->bodyFd = gzipFd;
     connection->bodyLength = statResponseGzBodyFd.st_size;
-    connection->contentEncoding = CONTENT_ENCODING_GZIP;
-}
\ No newline at end of file
+    connection->request->contentEncoding = CONTENT_ENCODING_GZIP;
+}
+
+/**
+ * Compress the file to the gzip cache, false on error. The .gz is written under a temporary name and renamed:
+ * a response never sends a partial file, and two writers of the same file do not mix their output.
+ */
+bool makeGzipCache(const char *path, const char *gzipPath) {
+    char pathGzipCache[strlen(gzipPath) + 1];
+    strCopySafe(pathGzipCache, (char *)gzipPath);
+    *strrchr(pathGzipCache, '/') = '\0';
+    if (makeDirectory(pathGzipCache, 0755) == -1) {
+        logError("Error creating directory: %s", pathGzipCache);
+        return false;
+    }
+    int bodyFd = open(path, O_RDONLY | O_CLOEXEC);
+    if (bodyFd == -1) {
+        logError("Error opening %s to compress it", path);
+        return false;
+    }
+
+    size_t temporaryPathLen = snprintf(NULL, 0, "%s.%lx.tmp", gzipPath, (unsigned long)pthread_self());
+    temporaryPathLen++; // for null terminator
+    char temporaryPath[temporaryPathLen];
+    snprintf(temporaryPath, temporaryPathLen, "%s.%lx.tmp", gzipPath, (unsigned long)pthread_self());
+
+    gzFile gzFd = gzopen(temporaryPath, "wb");
+    if (gzFd == NULL) {
+        logError("Error opening gzip file %s", temporaryPath);
+        close(bodyFd);
+        return false;
+    }
+    // level 1-9, 1 is fastest, 9 is best compression
+    bool written = gzsetparams(gzFd, 6, Z_DEFAULT_STRATEGY) == Z_OK;
+
+    // copy bodyFd to gzFd
+    char bufferEncoding[1024];
+    ssize_t bytesRead = 0;
+    while (written && (bytesRead = read(bodyFd, bufferEncoding, sizeof(bufferEncoding))) > 0) {
+        written = gzwrite(gzFd, bufferEncoding, bytesRead) == bytesRead;
+    }
+    written = written && bytesRead == 0;
+    written = gzclose(gzFd) == Z_OK && written;
+    close(bodyFd);
+
+    if (!written || rename(temporaryPath, gzipPath) == -1) {
+        logError("Error writing gzip file %s", gzipPath);
+        unlink(temporaryPath);
+        return false;
+    }
+    return true;
+}
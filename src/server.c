@@ -4,22 +4,115 @@
 #include <unistd.h>     // for close()
 #include <netinet/tcp.h> // for TCP_NODELAY
 #include <time.h>        // for time()
+#include <linux/filter.h> // for struct sock_filter (SO_ATTACH_REUSEPORT_CBPF)
+#include <sys/resource.h> // for setrlimit()
 
 #include "../lib/color/color.h"
 #include "../lib/die/die.h"
 #include "../lib/logger/logger.h"
 //#include "accept_client_epoll.h"
-//#include "accept_client_fork.h"
 //#include "accept_client_thread.h"
 #include "accept_client_thread_epoll.h"
+#include "bandwidth.h"
+#include "busy_poll.h"
+#include "client_limits.h"
 #include "helper.h"
+#include "prefork.h"
+#include "request_scan.h"
 #include "server.h"
+#include "upgrade.h"
 
 volatile sig_atomic_t sigintReceived;
+volatile sig_atomic_t sigquitReceived;
+volatile sig_atomic_t dumpStatsReceived;
 bool *sigIntReceived; 
 
 void serverRun(struct Options options) {
 
+    raiseFileDescriptorsLimit(options.maxConnections);
+
+    // the listener of systemd, or of the server being upgraded: it is already listening, nothing is refused
+    const char *inherited = "activation";
+    int socketServerFd = getActivationListener();
+    if (socketServerFd == -1 && options.upgradeSocket[0] != '\0') {
+        inherited = "upgrade";
+        socketServerFd = receiveUpgradeListener(options.upgradeSocket);
+    }
+    if (socketServerFd == -1) {
+        inherited = NULL;
+        socketServerFd = createServerSocket(options);
+    } else {
+        prepareInheritedSocket(socketServerFd);
+        options.reusePort = OPTIONS.reusePort;
+    }
+    if (options.upgradeSocket[0] != '\0') {
+        openUpgradeSocket(options.upgradeSocket);
+    }
+
+    printf("\n" GREEN "Server listening on http://%s:%d%s%s%s ..." RESET "\n\n",
+           options.address,
+           options.port,
+           options.reusePort ? " (SO_REUSEPORT sharded)" : "",
+           inherited != NULL ? " inherited by " : "",
+           inherited != NULL ? inherited : "");
+
+    initClientLimits(options.clientRate, options.clientConnections, CLIENT_LIMITS_ENTRIES);
+    initBandwidthLimits(options.limitRate, options.limitRateAfter, options.limitRateTotal);
+    initRequestScan();
+    logInfo("Request scanning with the %s kernels", REQUEST_SCAN.name);
+
+    if (options.workers > 0) {
+        runPrefork(socketServerFd);
+    } else {
+        acceptClientsThreadEpoll(socketServerFd);
+    }
+    //acceptClientsThread(socketServerFd);
+    //acceptClientsEpoll(socketServerFd);
+
+    closeUpgradeSocket(options.upgradeSocket);
+    freeClientLimits();
+    close(socketServerFd);
+}
+
+// a listener not created by this process: non-blocking, and the sharded mode only if it has SO_REUSEPORT
+void prepareInheritedSocket(int socketServerFd) {
+    makeSocketNonBlocking(socketServerFd);
+    int reusePort = 0;
+    socklen_t length = sizeof(reusePort);
+    if (OPTIONS.reusePort
+        && (getsockopt(socketServerFd, SOL_SOCKET, SO_REUSEPORT, &reusePort, &length) == -1 || !reusePort)) {
+        logWarning("The inherited listener has no SO_REUSEPORT, --reuseport disabled");
+        OPTIONS.reusePort = false;
+    }
+    setBusyPollSocket(socketServerFd);
+}
+
+// one descriptor per connection (and the body file while it is sent), the default soft limit is usually 1024
+void raiseFileDescriptorsLimit(int maxConnections) {
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == -1) {
+        logWarning("getrlimit RLIMIT_NOFILE failed");
+        return;
+    }
+    rlim_t wanted = (rlim_t)maxConnections * 2 + RESERVED_FDS;
+    if (limit.rlim_cur >= wanted) {
+        return;
+    }
+    limit.rlim_cur = wanted < limit.rlim_max ? wanted : limit.rlim_max;
+    if (setrlimit(RLIMIT_NOFILE, &limit) == -1) {
+        logWarning("setrlimit RLIMIT_NOFILE %lu failed", (unsigned long)limit.rlim_cur);
+        return;
+    }
+    if (limit.rlim_cur < wanted) {
+        logWarning("RLIMIT_NOFILE hard limit %lu is lower than the %lu descriptors for %d connections",
+                   (unsigned long)limit.rlim_max,
+                   (unsigned long)wanted,
+                   maxConnections);
+    }
+}
+
+int createServerSocket(struct Options options) {
+
     int socketServerFd = socket(PF_INET, SOCK_STREAM, 0);
 
     if (socketServerFd == -1) {
@@ -32,21 +125,50 @@ void serverRun(struct Options options) {
         die("setsockopt SO_REUSEADDR");
     }
 
+    // sharded mode: every worker binds its own listening socket to the same address,
+    // and the kernel balances the new connections between them
+    if (options.reusePort) {
+        if (setsockopt(socketServerFd, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof enable) == -1) {
+            die("setsockopt SO_REUSEPORT");
+        }
+    }
+
    /*  if (OPTIONS.TCPKeepAlive) {
         makeTCPKeepAlive(socketServerFd);
     } */
 
     // https://baus.net/on-tcp_cork/
+    // no TCP_CORK on the accepted sockets (they inherit the options of the listener): every response is
+    // coalesced by the output queue, with MSG_MORE only while the body follows, so the last segment of a
+    // response is never held back waiting for the cork timer
     int enableTCP_NO_DELAY = 1;
     if (setsockopt(socketServerFd, IPPROTO_TCP, TCP_NODELAY, &enableTCP_NO_DELAY, sizeof(enableTCP_NO_DELAY)) == -1) {
         die("setsockopt TCP_NODELAY");
     }
 
-    int enableTCP_CORK = 1;
-    if (setsockopt(socketServerFd, IPPROTO_TCP, TCP_CORK, &enableTCP_CORK, sizeof(enableTCP_CORK)) == -1) {
-        die("setsockopt TCP_CORK");
+    // EPOLLOUT only when the unsent bytes go below the mark, a large file does not fill the socket buffer
+    if (options.notSentLowat > 0) {
+        if (setsockopt(socketServerFd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &options.notSentLowat, sizeof(int)) == -1) {
+            die("setsockopt TCP_NOTSENT_LOWAT");
+        }
+    }
+
+    // the listener wakes up accept only when the first data (the request) arrives, or after the seconds
+    if (options.deferAcceptSeconds > 0) {
+        if (setsockopt(socketServerFd, IPPROTO_TCP, TCP_DEFER_ACCEPT, &options.deferAcceptSeconds, sizeof(int)) == -1) {
+            die("setsockopt TCP_DEFER_ACCEPT");
+        }
+    }
+
+    // the request of a returning client can arrive with the SYN (net.ipv4.tcp_fastopen must include 2)
+    if (options.fastOpenQueue > 0) {
+        if (setsockopt(socketServerFd, IPPROTO_TCP, TCP_FASTOPEN, &options.fastOpenQueue, sizeof(int)) == -1) {
+            die("setsockopt TCP_FASTOPEN");
+        }
     }
 
+    setBusyPollSocket(socketServerFd);
+
     struct hostent *localHostName = gethostbyname(options.address);
     if (localHostName == NULL) {
         die("gethostbyname %s failed", options.address);
@@ -75,14 +197,52 @@ void serverRun(struct Options options) {
         die("listen");
     }
 
-    printf("\n"GREEN"Server listening on http://%s:%d ..."RESET"\n\n", inet_ntoa(socketAddress.sin_addr), htons(socketAddress.sin_port));
+    return socketServerFd;
+}
 
-    acceptClientsThreadEpoll(socketServerFd);
-    //acceptClientsThread(socketServerFd);
-    //acceptClientsEpoll(socketServerFd);
-    //acceptClientsFork(socketServerFd);
+// SO_INCOMING_CPU, a hint for kernels that prefer the socket of a reuseport group matching the receiving CPU
+void steerServerSocketToCpu(int socketServerFd, int cpu) {
+    if (setsockopt(socketServerFd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, sizeof(cpu)) == -1) {
+        logWarning("setsockopt SO_INCOMING_CPU %d failed", cpu);
+    }
+}
 
-    close(socketServerFd);
+/**
+ * @brief Steer the connections of a SO_REUSEPORT group to the listener of the thread pinned to the CPU that received them
+ *
+ * The classic BPF program returns the index of the socket inside the reuseport group (the order in which
+ * they were bound, the thread index), so it maps the receiving CPU to the thread pinned to it with a chain
+ * of compares: with --cpus 0,2,4,6 the CPU 4 is the thread 2, not 4 % 4. The CPUs without a thread fall back
+ * to cpu % nSockets.
+ *
+ * https://man7.org/linux/man-pages/man7/socket.7.html
+ */
+void steerReuseportGroup(int socketServerFd, const int *threadCpus, int nSockets) {
+    // A = cpu id; (if A == cpu of i: return i)...; A = A % nSockets; return A
+    int length = 2 * nSockets + 3;
+    if (length > BPF_MAXINSNS) {
+        logWarning("--incoming-cpu: too many threads for the reuseport CBPF program, not steered");
+        return;
+    }
+    struct sock_filter code[length];
+    int n = 0;
+    code[n++] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_AD_OFF + SKF_AD_CPU);
+    int i;
+    for (i = 0; i < nSockets; i++) {
+        // the first thread of a CPU wins
+        code[n++] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, (uint32_t)threadCpus[i], 0, 1);
+        code[n++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, (uint32_t)i);
+    }
+    code[n++] = (struct sock_filter)BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, (uint32_t)nSockets);
+    code[n++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_A, 0);
+    struct sock_fprog program = {
+        .len = (unsigned short)n,
+        .filter = code,
+    };
+    // attach to one socket of the group is enough for all of them
+    if (setsockopt(socketServerFd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &program, sizeof(program)) == -1) {
+        logWarning("setsockopt SO_ATTACH_REUSEPORT_CBPF failed");
+    }
 }
 
 void makeTCPKeepAlive(int socketServerFd) {
@@ -0,0 +1,211 @@
+/**
+ *
+ * @brief Hierarchical timing wheel for the connection deadlines
+ *
+ * Based on "Hashed and Hierarchical Timing Wheels" (Varghese & Lauck) and the cascade of the classic
+ * Linux kernel timers. The clock is CLOCK_MONOTONIC_COARSE, it doesn't jump with the wall clock and
+ * it is read without a system call (vDSO).
+ *
+ */
+
+#include <stdlib.h> // for realloc()
+#include <string.h> // for memset()
+#include <time.h>   // for clock_gettime()
+
+#include "timing_wheel.h"
+
+unsigned long long monotonicMilliseconds() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+    return (unsigned long long)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+void initTimingWheel(struct TimingWheelType *timingWheel, unsigned long long nowMs) {
+    int level, slot;
+    for (level = 0; level < TIMING_WHEEL_LEVELS; level++) {
+        for (slot = 0; slot < TIMING_WHEEL_SLOTS; slot++) {
+            timingWheel->slots[level][slot] = TIMER_HANDLE_NONE;
+        }
+    }
+    timingWheel->currentTick = nowMs / TIMING_WHEEL_TICK_MS;
+    timingWheel->count = 0;
+    timingWheel->timers = NULL;
+    timingWheel->timersCount = 0;
+}
+
+void freeTimingWheel(struct TimingWheelType *timingWheel) {
+    free(timingWheel->timers);
+    timingWheel->timers = NULL;
+    timingWheel->timersCount = 0;
+    timingWheel->count = 0;
+}
+
+// room for the handles [0, timersCount), the timers are linked by handle so they can move
+bool growTimingWheel(struct TimingWheelType *timingWheel, uint32_t timersCount) {
+    if (timersCount <= timingWheel->timersCount) {
+        return true;
+    }
+    struct TimerType *timers = realloc(timingWheel->timers, (size_t)timersCount * sizeof(struct TimerType));
+    if (timers == NULL) {
+        return false;
+    }
+    memset(timers + timingWheel->timersCount, 0,
+           (size_t)(timersCount - timingWheel->timersCount) * sizeof(struct TimerType));
+    timingWheel->timers = timers;
+    timingWheel->timersCount = timersCount;
+    return true;
+}
+
+// base: first tick not processed yet
+static void placeTimer(struct TimingWheelType *timingWheel, uint32_t handle, unsigned long long base) {
+    struct TimerType *timer = &timingWheel->timers[handle];
+    // expires is modulo 2^32 ticks (~497 days), the deadlines are always much closer
+    long long signedDelta = (int32_t)(timer->expires - (uint32_t)base);
+    unsigned long long delta = signedDelta < 0 ? 0 : (unsigned long long)signedDelta;
+    unsigned long long maxDelta = (1ULL << (TIMING_WHEEL_BITS * TIMING_WHEEL_LEVELS)) - 1;
+    if (delta > maxDelta) {
+        // beyond the last level, it is placed again by the cascade
+        delta = maxDelta;
+    }
+    unsigned long long expires = base + delta;
+
+    int level = 0;
+    while (level < TIMING_WHEEL_LEVELS - 1 && delta >= (1ULL << (TIMING_WHEEL_BITS * (level + 1)))) {
+        level++;
+    }
+    int slot = (int)((expires >> (TIMING_WHEEL_BITS * level)) & TIMING_WHEEL_MASK);
+
+    timer->level = (uint8_t)level;
+    timer->slot = (uint8_t)slot;
+    timer->prev = TIMER_HANDLE_NONE;
+    timer->next = timingWheel->slots[level][slot];
+    if (timer->next != TIMER_HANDLE_NONE) {
+        timingWheel->timers[timer->next].prev = handle;
+    }
+    timingWheel->slots[level][slot] = handle;
+}
+
+static void unlinkTimer(struct TimingWheelType *timingWheel, uint32_t handle) {
+    struct TimerType *timer = &timingWheel->timers[handle];
+    if (timer->prev != TIMER_HANDLE_NONE) {
+        timingWheel->timers[timer->prev].next = timer->next;
+    } else {
+        timingWheel->slots[timer->level][timer->slot] = timer->next;
+    }
+    if (timer->next != TIMER_HANDLE_NONE) {
+        timingWheel->timers[timer->next].prev = timer->prev;
+    }
+    timer->next = TIMER_HANDLE_NONE;
+    timer->prev = TIMER_HANDLE_NONE;
+}
+
+void addTimer(struct TimingWheelType *timingWheel, uint32_t handle, unsigned long long expiresMs, enum TimerKind kind) {
+    struct TimerType *timer = &timingWheel->timers[handle];
+    if (timer->active) {
+        unlinkTimer(timingWheel, handle);
+        timingWheel->count--;
+    }
+    // round up, a deadline never expires before its time
+    timer->expires = (uint32_t)((expiresMs + TIMING_WHEEL_TICK_MS - 1) / TIMING_WHEEL_TICK_MS);
+    timer->kind = (uint8_t)kind;
+    timer->active = true;
+    placeTimer(timingWheel, handle, timingWheel->currentTick + 1);
+    timingWheel->count++;
+}
+
+void removeTimer(struct TimingWheelType *timingWheel, uint32_t handle) {
+    struct TimerType *timer = &timingWheel->timers[handle];
+    if (!timer->active) {
+        return;
+    }
+    unlinkTimer(timingWheel, handle);
+    timer->active = false;
+    timer->kind = TIMER_KIND_NONE;
+    timingWheel->count--;
+}
+
+void resetTimer(struct TimingWheelType *timingWheel, uint32_t handle, unsigned long long expiresMs, enum TimerKind kind) {
+    addTimer(timingWheel, handle, expiresMs, kind);
+}
+
+/**
+ * @brief Advance the wheel until nowMs
+ *
+ * @return handle of the first expired timer, the rest linked by next (TIMER_HANDLE_NONE at the end),
+ *         already removed from the wheel
+ */
+uint32_t expireTimers(struct TimingWheelType *timingWheel, unsigned long long nowMs) {
+    unsigned long long nowTick = nowMs / TIMING_WHEEL_TICK_MS;
+    uint32_t expired = TIMER_HANDLE_NONE;
+
+    if (timingWheel->count == 0) {
+        if (nowTick > timingWheel->currentTick) {
+            timingWheel->currentTick = nowTick;
+        }
+        return TIMER_HANDLE_NONE;
+    }
+
+    while (timingWheel->currentTick < nowTick && timingWheel->count > 0) {
+        timingWheel->currentTick++;
+        unsigned long long tick = timingWheel->currentTick;
+
+        // cascade the slots of the upper levels that start at this tick
+        int level;
+        for (level = 1; level < TIMING_WHEEL_LEVELS; level++) {
+            if ((tick & ((1ULL << (TIMING_WHEEL_BITS * level)) - 1)) != 0) {
+                break;
+            }
+            int slot = (int)((tick >> (TIMING_WHEEL_BITS * level)) & TIMING_WHEEL_MASK);
+            uint32_t handle = timingWheel->slots[level][slot];
+            timingWheel->slots[level][slot] = TIMER_HANDLE_NONE;
+            while (handle != TIMER_HANDLE_NONE) {
+                uint32_t next = timingWheel->timers[handle].next;
+                placeTimer(timingWheel, handle, tick);
+                handle = next;
+            }
+        }
+
+        int slot = (int)(tick & TIMING_WHEEL_MASK);
+        uint32_t handle = timingWheel->slots[0][slot];
+        timingWheel->slots[0][slot] = TIMER_HANDLE_NONE;
+        while (handle != TIMER_HANDLE_NONE) {
+            struct TimerType *timer = &timingWheel->timers[handle];
+            uint32_t next = timer->next;
+            timer->active = false;
+            timer->prev = TIMER_HANDLE_NONE;
+            timer->next = expired;
+            expired = handle;
+            timingWheel->count--;
+            handle = next;
+        }
+    }
+    if (timingWheel->currentTick < nowTick) {
+        timingWheel->currentTick = nowTick;
+    }
+
+    return expired;
+}
+
+/**
+ * @brief Milliseconds until the next tick with timers (or the next cascade), for epoll_wait
+ *
+ * @return -1 if there are no timers
+ */
+int nextTimerTimeout(struct TimingWheelType *timingWheel, unsigned long long nowMs) {
+    if (timingWheel->count == 0) {
+        return -1;
+    }
+    unsigned long long tick = timingWheel->currentTick;
+    int i;
+    for (i = 1; i <= TIMING_WHEEL_SLOTS; i++) {
+        tick = timingWheel->currentTick + i;
+        if (timingWheel->slots[0][tick & TIMING_WHEEL_MASK] != TIMER_HANDLE_NONE || (tick & TIMING_WHEEL_MASK) == 0) {
+            break;
+        }
+    }
+    unsigned long long deadlineMs = tick * TIMING_WHEEL_TICK_MS;
+    if (deadlineMs <= nowMs) {
+        return 0;
+    }
+    return (int)(deadlineMs - nowMs);
+}
@@ -0,0 +1,88 @@
+/**
+ *
+ * @brief Shortest remaining first scheduler of the pending transfers of a thread
+ *
+ * Every turn a transfer sends at most SEND_QUANTUM_SIZE bytes, so a large download shares the thread
+ * with the small responses instead of looping sendfile until EAGAIN, and the transfers with fewer bytes
+ * left go first (SRPT), which keeps the page loads fast next to the big files.
+ *
+ */
+
+#include <stdlib.h> // for realloc()
+
+#include "../lib/logger/logger.h"
+#include "transfer_scheduler.h"
+
+#define TRANSFER_SCHEDULER_MIN_CAPACITY 64
+
+void initTransferScheduler(struct TransferSchedulerType *scheduler) {
+    scheduler->heap = NULL;
+    scheduler->count = 0;
+    scheduler->capacity = 0;
+}
+
+void freeTransferScheduler(struct TransferSchedulerType *scheduler) {
+    free(scheduler->heap);
+    initTransferScheduler(scheduler);
+}
+
+static void swapTransfers(struct TransferType *a, struct TransferType *b) {
+    struct TransferType tmp = *a;
+    *a = *b;
+    *b = tmp;
+}
+
+bool scheduleTransfer(struct TransferSchedulerType *scheduler, int slot, size_t remaining) {
+    if (scheduler->count == scheduler->capacity) {
+        int capacity = scheduler->capacity == 0 ? TRANSFER_SCHEDULER_MIN_CAPACITY : scheduler->capacity * 2;
+        struct TransferType *heap = realloc(scheduler->heap, capacity * sizeof(struct TransferType));
+        if (heap == NULL) {
+            logError("Cannot grow the transfer scheduler to %d transfers", capacity);
+            return false;
+        }
+        scheduler->heap = heap;
+        scheduler->capacity = capacity;
+    }
+
+    int i = scheduler->count++;
+    scheduler->heap[i].remaining = remaining;
+    scheduler->heap[i].slot = slot;
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (scheduler->heap[parent].remaining <= scheduler->heap[i].remaining) {
+            break;
+        }
+        swapTransfers(&scheduler->heap[parent], &scheduler->heap[i]);
+        i = parent;
+    }
+    return true;
+}
+
+// the slot of the transfer with fewer bytes left, false if there is none
+bool nextTransfer(struct TransferSchedulerType *scheduler, int *slot) {
+    if (scheduler->count == 0) {
+        return false;
+    }
+    *slot = scheduler->heap[0].slot;
+    scheduler->count--;
+    scheduler->heap[0] = scheduler->heap[scheduler->count];
+
+    int i = 0;
+    while (1) {
+        int left = 2 * i + 1;
+        int right = left + 1;
+        int smallest = i;
+        if (left < scheduler->count && scheduler->heap[left].remaining < scheduler->heap[smallest].remaining) {
+            smallest = left;
+        }
+        if (right < scheduler->count && scheduler->heap[right].remaining < scheduler->heap[smallest].remaining) {
+            smallest = right;
+        }
+        if (smallest == i) {
+            break;
+        }
+        swapTransfers(&scheduler->heap[i], &scheduler->heap[smallest]);
+        i = smallest;
+    }
+    return true;
+}
@@ -0,0 +1,188 @@
+/**
+ *
+ * @brief Restart without closing the listening socket: socket activation and binary upgrade
+ *
+ * With socket activation (systemd, LISTEN_FDS) the listener is inherited, already bound and listening.
+ * With --upgrade-socket the running server waits on a unix socket for its successor: a new binary started
+ * with the same option connects to it and receives the listener with SCM_RIGHTS, then the old server stops
+ * accepting and drains its connections (SIGQUIT). Both processes share the same listening socket meanwhile,
+ * so the connections that arrive during the upgrade wait in its queue instead of being refused.
+ *
+ */
+
+#include <errno.h>      // for errno
+#include <poll.h>       // for poll()
+#include <stdio.h>      // for snprintf()
+#include <stdlib.h>     // for getenv()
+#include <string.h>     // for memcpy()
+#include <sys/socket.h> // for sendmsg() and SCM_RIGHTS
+#include <sys/stat.h>   // for chmod()
+#include <sys/time.h>   // for struct timeval
+#include <sys/un.h>     // for struct sockaddr_un
+#include <unistd.h>     // for getpid()
+
+#include "../lib/die/die.h"
+#include "../lib/logger/logger.h"
+#include "helper.h"
+#include "server.h"
+#include "upgrade.h"
+
+struct UpgradeType UPGRADE = {.fd = -1};
+
+// the listener of the socket activation, -1 if the process was not activated
+int getActivationListener() {
+    const char *listenPid = getenv("LISTEN_PID");
+    const char *listenFds = getenv("LISTEN_FDS");
+    if (listenPid == NULL || listenFds == NULL || atoi(listenPid) != getpid()) {
+        return -1;
+    }
+    // the workers and the next binaries are not activated
+    unsetenv("LISTEN_PID");
+    unsetenv("LISTEN_FDS");
+    unsetenv("LISTEN_FDNAMES");
+    int count = atoi(listenFds);
+    if (count <= 0) {
+        return -1;
+    }
+    if (count > 1) {
+        logWarning("Socket activation with %d sockets, only the first one is used", count);
+    }
+    return UPGRADE_LISTEN_FDS_START;
+}
+
+static void getUpgradeAddress(const char *path, struct sockaddr_un *address) {
+    memset(address, 0, sizeof(struct sockaddr_un));
+    address->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address->sun_path)) {
+        die("--upgrade-socket path %s is too long", path);
+    }
+    memcpy(address->sun_path, path, strlen(path) + 1);
+}
+
+// the listener of the server running on the upgrade socket, -1 if there is none
+int receiveUpgradeListener(const char *path) {
+    struct sockaddr_un address;
+    getUpgradeAddress(path, &address);
+    int upgradeFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (upgradeFd == -1) {
+        die("socket AF_UNIX");
+    }
+    if (connect(upgradeFd, (struct sockaddr *)&address, sizeof(address)) == -1) {
+        // first start: nobody listens there
+        close(upgradeFd);
+        return -1;
+    }
+    struct timeval timeout = {.tv_sec = UPGRADE_RECEIVE_TIMEOUT};
+    setsockopt(upgradeFd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    char byte;
+    struct iovec iov = {.iov_base = &byte, .iov_len = 1};
+    union {
+        char buffer[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    struct msghdr message = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control.buffer,
+        .msg_controllen = sizeof(control.buffer),
+    };
+    int listenerFd = -1;
+    if (recvmsg(upgradeFd, &message, MSG_CMSG_CLOEXEC) == 1) {
+        struct cmsghdr *header = CMSG_FIRSTHDR(&message);
+        if (header != NULL && header->cmsg_level == SOL_SOCKET && header->cmsg_type == SCM_RIGHTS) {
+            memcpy(&listenerFd, CMSG_DATA(header), sizeof(int));
+        }
+    }
+    close(upgradeFd);
+    if (listenerFd == -1) {
+        die("The server of %s did not send its listener", path);
+    }
+    return listenerFd;
+}
+
+// after the listener is created or received: from now on this process is the one to upgrade
+void openUpgradeSocket(const char *path) {
+    struct sockaddr_un address;
+    getUpgradeAddress(path, &address);
+    UPGRADE.fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (UPGRADE.fd == -1) {
+        die("socket AF_UNIX");
+    }
+    // a stale one of a server that did not exit cleanly, or the one of the server just upgraded
+    unlink(path);
+    if (bind(UPGRADE.fd, (struct sockaddr *)&address, sizeof(address)) == -1) {
+        die("bind %s", path);
+    }
+    // the listener is given to any process that connects, only to the same user
+    if (chmod(path, S_IRUSR | S_IWUSR) == -1) {
+        die("chmod %s", path);
+    }
+    if (listen(UPGRADE.fd, 1) == -1) {
+        die("listen %s", path);
+    }
+}
+
+void closeUpgradeSocket(const char *path) {
+    if (UPGRADE.fd == -1) {
+        return;
+    }
+    close(UPGRADE.fd);
+    UPGRADE.fd = -1;
+    // after a handover the path belongs to the new server
+    if (!UPGRADE.handedOver) {
+        unlink(path);
+    }
+}
+
+static bool sendUpgradeListener(int clientFd, int socketServerFd) {
+    char byte = 'U';
+    struct iovec iov = {.iov_base = &byte, .iov_len = 1};
+    union {
+        char buffer[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    memset(&control, 0, sizeof(control));
+    struct msghdr message = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control.buffer,
+        .msg_controllen = sizeof(control.buffer),
+    };
+    struct cmsghdr *header = CMSG_FIRSTHDR(&message);
+    header->cmsg_level = SOL_SOCKET;
+    header->cmsg_type = SCM_RIGHTS;
+    header->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(header), &socketServerFd, sizeof(int));
+    return sendmsg(clientFd, &message, MSG_NOSIGNAL) == 1;
+}
+
+/**
+ * The sleep of the main loop, milliseconds: it wakes up when a new binary connects to the upgrade socket,
+ * gives it the listener and starts the drain of this process.
+ */
+void waitUpgrade(int socketServerFd, int timeout) {
+    if (UPGRADE.fd == -1 || UPGRADE.handedOver) {
+        usleep(timeout * 1000);
+        return;
+    }
+    struct pollfd pollFd = {.fd = UPGRADE.fd, .events = POLLIN};
+    if (poll(&pollFd, 1, timeout) <= 0) {
+        return;
+    }
+    int clientFd = accept4(UPGRADE.fd, NULL, NULL, SOCK_CLOEXEC);
+    if (clientFd == -1) {
+        return;
+    }
+    if (!sendUpgradeListener(clientFd, socketServerFd)) {
+        logWarning("sendmsg of the listener to the new binary failed");
+        close(clientFd);
+        return;
+    }
+    close(clientFd);
+    UPGRADE.handedOver = true;
+    close(UPGRADE.fd);
+    UPGRADE.fd = -1;
+    logInfo("Listener handed over to the new binary, draining the connections");
+    sigquitReceived = 1;
+}
@@ -0,0 +1,215 @@
+/**
+ * @brief Microbenchmark of the connection layout: hot/cold split against one record per connection
+ *
+ * Simulates the event loop of one thread with N connections: every event reads the hot fields of a
+ * random connection and moves its deadline, and the clock advances one tick every 64 events expiring
+ * the timers of that tick. The sweep walks all the connections reading the state, like the debug dump.
+ * The cache misses come from perf_event_open (n/a if perf is not allowed, see perf_event_paranoid).
+ *
+ * make bench-connections && ./bin/bench-connections
+ */
+
+#include <linux/perf_event.h> // for perf_event_attr
+#include <stdint.h>           // for uint64_t
+#include <stdio.h>            // for printf()
+#include <stdlib.h>           // for calloc()
+#include <string.h>           // for memset()
+#include <sys/ioctl.h>        // for ioctl()
+#include <sys/syscall.h>      // for __NR_perf_event_open
+#include <time.h>             // for clock_gettime()
+#include <unistd.h>           // for syscall()
+
+#include "queue_connections.h"
+#include "timing_wheel.h"
+
+#define BENCHMARK_EVENTS 4000000
+#define BENCHMARK_EVENTS_PER_TICK 64
+#define BENCHMARK_SWEEPS 50
+
+// the layout before the split: the request metadata inline with the hot fields
+struct UnsplitConnectionType {
+    struct QueueConnectionElementType hot;
+    struct ConnectionRequestType cold;
+};
+
+struct LayoutType {
+    const char *name;
+    char *records;
+    size_t stride;
+};
+
+static uint64_t randomState = 88172645463325252ULL;
+
+static uint64_t nextRandom() {
+    randomState ^= randomState << 13;
+    randomState ^= randomState >> 7;
+    randomState ^= randomState << 17;
+    return randomState;
+}
+
+static double nowNanoseconds() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec * 1e9 + (double)now.tv_nsec;
+}
+
+static int openCacheMissesCounter() {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static void startCounter(int counterFd) {
+    if (counterFd != -1) {
+        ioctl(counterFd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(counterFd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+}
+
+static long long stopCounter(int counterFd) {
+    long long value = -1;
+    if (counterFd != -1) {
+        ioctl(counterFd, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(counterFd, &value, sizeof(value)) != sizeof(value)) {
+            value = -1;
+        }
+    }
+    return value;
+}
+
+static struct QueueConnectionElementType *layoutConnection(struct LayoutType *layout, uint32_t slot) {
+    return (struct QueueConnectionElementType *)(layout->records + (size_t)slot * layout->stride);
+}
+
+static void printResult(const char *layout, const char *workload, size_t operations, double elapsed,
+                        long long misses) {
+    if (misses < 0) {
+        printf("  %-8s %-7s %8.1f ns/op  cache misses n/a\n", layout, workload, elapsed / operations);
+    } else {
+        printf("  %-8s %-7s %8.1f ns/op  %8.3f cache misses/op\n", layout, workload, elapsed / operations,
+               (double)misses / operations);
+    }
+}
+
+static unsigned long long runEvents(struct LayoutType *layout, uint32_t connections, int counterFd) {
+    struct TimingWheelType wheel;
+    unsigned long long nowMs = 1000000;
+    unsigned long long checksum = 0;
+    initTimingWheel(&wheel, nowMs);
+    growTimingWheel(&wheel, connections);
+    uint32_t slot;
+    for (slot = 0; slot < connections; slot++) {
+        addTimer(&wheel, slot, nowMs + KEEP_ALIVE_TIMEOUT * 1000, TIMER_KIND_IDLE);
+    }
+
+    randomState = 88172645463325252ULL;
+    startCounter(counterFd);
+    double start = nowNanoseconds();
+    int event;
+    for (event = 0; event < BENCHMARK_EVENTS; event++) {
+        slot = (uint32_t)(nextRandom() % connections);
+        struct QueueConnectionElementType *connection = layoutConnection(layout, slot);
+        checksum += (unsigned long long)connection->clientFd + connection->state + connection->requestBufferOffset;
+        connection->requestBufferOffset++;
+        resetTimer(&wheel, slot, nowMs + 1000 + nextRandom() % (HEADER_READ_TIMEOUT * 1000), TIMER_KIND_HEADER_READ);
+
+        if (event % BENCHMARK_EVENTS_PER_TICK == 0) {
+            nowMs += TIMING_WHEEL_TICK_MS;
+            uint32_t handle = expireTimers(&wheel, nowMs);
+            while (handle != TIMER_HANDLE_NONE) {
+                uint32_t next = wheel.timers[handle].next;
+                connection = layoutConnection(layout, handle);
+                checksum += (unsigned long long)connection->clientFd;
+                addTimer(&wheel, handle, nowMs + KEEP_ALIVE_TIMEOUT * 1000, TIMER_KIND_IDLE);
+                handle = next;
+            }
+        }
+    }
+    double elapsed = nowNanoseconds() - start;
+    printResult(layout->name, "events", BENCHMARK_EVENTS, elapsed, stopCounter(counterFd));
+
+    freeTimingWheel(&wheel);
+    return checksum;
+}
+
+static unsigned long long runSweeps(struct LayoutType *layout, uint32_t connections, int counterFd) {
+    unsigned long long checksum = 0;
+    startCounter(counterFd);
+    double start = nowNanoseconds();
+    int sweep;
+    for (sweep = 0; sweep < BENCHMARK_SWEEPS; sweep++) {
+        uint32_t slot;
+        for (slot = 0; slot < connections; slot++) {
+            struct QueueConnectionElementType *connection = layoutConnection(layout, slot);
+            if (connection->state == STATE_CONNECTION_SEND_HEADERS) {
+                checksum += (unsigned long long)connection->clientFd;
+            }
+        }
+    }
+    double elapsed = nowNanoseconds() - start;
+    printResult(layout->name, "sweep", (size_t)BENCHMARK_SWEEPS * connections, elapsed, stopCounter(counterFd));
+    return checksum;
+}
+
+int main() {
+    uint32_t connectionsList[] = {10000, 100000};
+    int counterFd = openCacheMissesCounter();
+    unsigned long long checksum = 0;
+
+    printf("hot record %zu bytes, cold record %zu bytes, timer %zu bytes, unsplit record %zu bytes\n",
+           sizeof(struct QueueConnectionElementType),
+           sizeof(struct ConnectionRequestType),
+           sizeof(struct TimerType),
+           sizeof(struct UnsplitConnectionType));
+    // what a slot of the queue costs while idle, the pooled objects are only attached to a request in progress
+    printf("idle connection %zu bytes (hot, cold, timer and free slot entry)\n",
+           sizeof(struct QueueConnectionElementType) + sizeof(struct ConnectionRequestType) + sizeof(struct TimerType)
+               + sizeof(int));
+    printf("active request + %zu bytes (request buffer %d, parser %zu, response buffer %d, output queue %zu)\n",
+           BUFFER_REQUEST_SIZE + sizeof(struct RequestParserType) + BUFFER_RESPONSE_SIZE + sizeof(struct OutputQueueType),
+           BUFFER_REQUEST_SIZE,
+           sizeof(struct RequestParserType),
+           BUFFER_RESPONSE_SIZE,
+           sizeof(struct OutputQueueType));
+
+    size_t i;
+    for (i = 0; i < sizeof(connectionsList) / sizeof(connectionsList[0]); i++) {
+        uint32_t connections = connectionsList[i];
+        struct LayoutType layouts[] = {
+            {"split", calloc(connections, sizeof(struct QueueConnectionElementType)),
+             sizeof(struct QueueConnectionElementType)},
+            {"unsplit", calloc(connections, sizeof(struct UnsplitConnectionType)), sizeof(struct UnsplitConnectionType)},
+        };
+
+        printf("%u connections per thread\n", connections);
+        size_t j;
+        for (j = 0; j < sizeof(layouts) / sizeof(layouts[0]); j++) {
+            if (layouts[j].records == NULL) {
+                printf("  %-8s out of memory\n", layouts[j].name);
+                continue;
+            }
+            uint32_t slot;
+            for (slot = 0; slot < connections; slot++) {
+                struct QueueConnectionElementType *connection = layoutConnection(&layouts[j], slot);
+                connection->clientFd = (int)slot + 5;
+                connection->slot = (int)slot;
+                connection->state = STATE_CONNECTION_RECV;
+            }
+            checksum += runEvents(&layouts[j], connections, counterFd);
+            checksum += runSweeps(&layouts[j], connections, counterFd);
+            free(layouts[j].records);
+        }
+    }
+
+    if (counterFd != -1) {
+        close(counterFd);
+    }
+    // keep the loads alive
+    return checksum == 42 ? 1 : 0;
+}
@@ -0,0 +1,149 @@
+/**
+ * @brief Loopback benchmark of the request latency, to compare the server with and without --busy-poll
+ *
+ * A connection sends a request and waits for the whole response before the next one, with a pause between
+ * them so the thread of the server runs out of events and goes to sleep (or spins) every time. The default
+ * path is /hello, answered without touching the disk nor libmagic, so the round trip is mostly the wakeup
+ * and the loopback; its response closes the connection, which is opened again out of the measure (as for
+ * a file at the end of --keep-alive-requests). The round trips are sorted and printed as percentiles.
+ * Pin the client to a CPU other than the ones of the server (taskset), as the server threads with
+ * --busy-poll keep their cores busy.
+ *
+ * make bench-latency && ./bin/bench-latency [address] [port] [requests] [pause in microseconds] [path]
+ * ./bin/ubserver --reuseport --threads 1 --busy-poll 200 & ./bin/bench-latency 127.0.0.1 3001 20000 50
+ */
+
+#include <arpa/inet.h>   // for inet_pton()
+#include <netinet/in.h>  // for struct sockaddr_in
+#include <netinet/tcp.h> // for TCP_NODELAY
+#include <stdio.h>       // for printf()
+#include <stdlib.h>      // for atoi() and exit()
+#include <string.h>      // for strstr()
+#include <sys/socket.h>  // for socket()
+#include <time.h>        // for clock_gettime()
+#include <unistd.h>      // for usleep()
+
+#define BENCHMARK_BUFFER_SIZE 4096
+#define BENCHMARK_WARMUP 1000
+
+static double nowMicroseconds() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec * 1e6 + (double)now.tv_nsec / 1e3;
+}
+
+static int compareDoubles(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static int connectServer(struct sockaddr_in *server) {
+    int socketFd = socket(AF_INET, SOCK_STREAM, 0);
+    if (socketFd == -1 || connect(socketFd, (struct sockaddr *)server, sizeof(*server)) == -1) {
+        perror("connect()");
+        exit(1);
+    }
+    int enable = 1;
+    setsockopt(socketFd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+    return socketFd;
+}
+
+// one request and its whole response (headers and content-length bytes): 1 if the server closes, -1 on error
+static int roundTrip(int socketFd, const char *request, size_t requestLength) {
+    if (send(socketFd, request, requestLength, 0) != (ssize_t)requestLength) {
+        return -1;
+    }
+    char buffer[BENCHMARK_BUFFER_SIZE];
+    size_t length = 0;
+    size_t expected = 0; // headers and body, 0 until the headers are complete
+    while (expected == 0 || length < expected) {
+        ssize_t received = recv(socketFd, buffer + length, sizeof(buffer) - 1 - length, 0);
+        if (received <= 0) {
+            return -1;
+        }
+        length += (size_t)received;
+        buffer[length] = '\0';
+        // the server ends the lines with \n
+        char *end = strstr(buffer, "\n\n");
+        if (expected == 0 && end != NULL) {
+            char *contentLength = strcasestr(buffer, "content-length:");
+            expected = (size_t)(end + 2 - buffer) + (contentLength != NULL ? (size_t)atol(contentLength + 15) : 0);
+            if (expected >= sizeof(buffer)) {
+                return -1;
+            }
+        }
+        if (length >= sizeof(buffer) - 1) {
+            return -1;
+        }
+    }
+    return strcasestr(buffer, "connection: close") != NULL ? 1 : 0;
+}
+
+int main(int argc, char *argv[]) {
+    const char *address = argc > 1 ? argv[1] : "127.0.0.1";
+    int port = argc > 2 ? atoi(argv[2]) : 3001;
+    int requests = argc > 3 ? atoi(argv[3]) : 20000;
+    int pause = argc > 4 ? atoi(argv[4]) : 50;
+    const char *path = argc > 5 ? argv[5] : "/hello";
+    if (requests <= 0) {
+        fprintf(stderr, "Invalid number of requests\n");
+        return 1;
+    }
+
+    struct sockaddr_in server = {.sin_family = AF_INET, .sin_port = htons(port)};
+    if (inet_pton(AF_INET, address, &server.sin_addr) != 1) {
+        fprintf(stderr, "Invalid address %s\n", address);
+        return 1;
+    }
+    char request[BENCHMARK_BUFFER_SIZE];
+    int requestLength = snprintf(request, sizeof(request), "GET %s HTTP/1.1\r\nHost: localhost\r\n\r\n", path);
+    if (requestLength < 0 || requestLength >= (int)sizeof(request)) {
+        fprintf(stderr, "Invalid path\n");
+        return 1;
+    }
+    int socketFd = connectServer(&server);
+
+    double *latencies = malloc(sizeof(double) * requests);
+    if (latencies == NULL) {
+        perror("malloc()");
+        return 1;
+    }
+    int i;
+    for (i = -BENCHMARK_WARMUP; i < requests; i++) {
+        if (pause > 0) {
+            usleep(pause);
+        }
+        double start = nowMicroseconds();
+        int result = roundTrip(socketFd, request, (size_t)requestLength);
+        if (result == -1) {
+            fprintf(stderr, "Request %d failed, is the server running on %s:%d?\n", i, address, port);
+            return 1;
+        }
+        if (i >= 0) {
+            latencies[i] = nowMicroseconds() - start;
+        }
+        if (result == 1) {
+            close(socketFd);
+            socketFd = connectServer(&server);
+        }
+    }
+    close(socketFd);
+
+    qsort(latencies, requests, sizeof(double), compareDoubles);
+    double sum = 0;
+    for (i = 0; i < requests; i++) {
+        sum += latencies[i];
+    }
+    printf("%d requests of %s, pause %d us: avg %.1f us, p50 %.1f us, p99 %.1f us, p99.9 %.1f us, max %.1f us\n",
+           requests,
+           path,
+           pause,
+           sum / requests,
+           latencies[requests / 2],
+           latencies[(int)(requests * 0.99)],
+           latencies[(int)(requests * 0.999)],
+           latencies[requests - 1]);
+    free(latencies);
+    return 0;
+}
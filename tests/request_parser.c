@@ -0,0 +1,102 @@
+/**
+ * @brief Requests rejected by the parser, and the status of their error
+ *
+ * The server has no chunked decoder, so a request with a transfer coding is answered with 501, or with 400
+ * when it also has a Content-Length (RFC 9112 section 6.1), and never read as a request of Content-Length
+ * bytes followed by the next pipelined one. A request longer than the room of the buffer is answered with
+ * 413 (body), 414 (request line) or 431 (headers). Every request is parsed whole and one byte at a time.
+ *
+ * make test-request-parser && ./bin/test-request-parser
+ */
+
+#include <stdio.h>   // for printf()
+#include <string.h>  // for strlen() and memcpy()
+
+#include "request_parser.h"
+
+#define PARSER_TEST_MAX_LENGTH 128 // room of the buffer
+
+struct ParserTestType {
+    const char *name;
+    const char *request;
+    enum RequestParseResult result;
+    enum HTTP_STATUS_CODE errorStatus;
+};
+
+static const struct ParserTestType parserTests[] = {
+    {"get", "GET / HTTP/1.1\r\nHost: localhost\r\n\r\n", REQUEST_PARSE_COMPLETE, 0},
+    {"content-length", "POST / HTTP/1.1\r\nContent-Length: 4\r\n\r\nbody", REQUEST_PARSE_COMPLETE, 0},
+    {"chunked", "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n4\r\nbody\r\n0\r\n\r\n", REQUEST_PARSE_ERROR,
+     HTTP_STATUS_NOT_IMPLEMENTED},
+    {"gzip without a body", "GET / HTTP/1.1\r\ntransfer-encoding: gzip\r\n\r\n", REQUEST_PARSE_ERROR,
+     HTTP_STATUS_NOT_IMPLEMENTED},
+    {"transfer-encoding before content-length",
+     "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\nContent-Length: 4\r\n\r\n0\r\n\r\n", REQUEST_PARSE_ERROR,
+     HTTP_STATUS_BAD_REQUEST},
+    {"content-length before transfer-encoding",
+     "POST / HTTP/1.1\r\nContent-Length: 4\r\nTRANSFER-ENCODING: chunked\r\n\r\n0\r\n\r\n", REQUEST_PARSE_ERROR,
+     HTTP_STATUS_BAD_REQUEST},
+    {"chunked smuggling a request",
+     "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n0\r\n\r\nGET /admin HTTP/1.1\r\n\r\n", REQUEST_PARSE_ERROR,
+     HTTP_STATUS_NOT_IMPLEMENTED},
+    {"body filling the buffer", "POST / HTTP/1.1\r\nContent-Length: 89\r\n\r\n"
+     "01234567890123456789012345678901234567890123456789012345678901234567890123456789012345678",
+     REQUEST_PARSE_COMPLETE, 0},
+    {"body larger than the buffer", "POST / HTTP/1.1\r\nContent-Length: 90\r\n\r\n", REQUEST_PARSE_ERROR,
+     HTTP_STATUS_CONTENT_TOO_LARGE},
+    {"target longer than the buffer",
+     "GET /0123456789012345678901234567890123456789012345678901234567890123456789012345678901234567890123456789"
+     "0123456789012345678901234567890123456789 HTTP/1.1\r\n\r\n",
+     REQUEST_PARSE_ERROR, HTTP_STATUS_URI_TOO_LONG},
+    {"headers longer than the buffer",
+     "GET / HTTP/1.1\r\nCookie: 0123456789012345678901234567890123456789012345678901234567890123456789"
+     "0123456789012345678901234567890123456789012345678901234567890123456789\r\n\r\n",
+     REQUEST_PARSE_ERROR, HTTP_STATUS_REQUEST_HEADER_FIELDS_TOO_LARGE},
+};
+
+static enum RequestParseResult parseWhole(struct RequestParserType *parser, char *data, size_t length) {
+    initRequestParser(parser);
+    return parseRequest(parser, data, length, PARSER_TEST_MAX_LENGTH);
+}
+
+// as the bytes arrive one by one, until the parser is done with the request
+static enum RequestParseResult parseTrickled(struct RequestParserType *parser, char *data, size_t length) {
+    enum RequestParseResult result = REQUEST_PARSE_INCOMPLETE;
+    size_t received;
+    initRequestParser(parser);
+    for (received = 1; received <= length && result == REQUEST_PARSE_INCOMPLETE; received++) {
+        result = parseRequest(parser, data, received, PARSER_TEST_MAX_LENGTH);
+    }
+    return result;
+}
+
+static int checkResult(const struct ParserTestType *test, const char *how, struct RequestParserType *parser,
+                       enum RequestParseResult result) {
+    if (result != test->result || (result == REQUEST_PARSE_ERROR && parser->errorStatus != test->errorStatus)) {
+        printf("%s (%s): result %d status %d instead of %d and %d\n", test->name, how, result, parser->errorStatus,
+               test->result, test->errorStatus);
+        return 1;
+    }
+    return 0;
+}
+
+int main() {
+    struct RequestParserType parser;
+    char data[512];
+    int failures = 0;
+
+    size_t i;
+    for (i = 0; i < sizeof(parserTests) / sizeof(parserTests[0]); i++) {
+        const struct ParserTestType *test = &parserTests[i];
+        size_t length = strlen(test->request);
+
+        // the parser writes the NUL delimiters and the lower case names in the request
+        memcpy(data, test->request, length + 1);
+        failures += checkResult(test, "whole", &parser, parseWhole(&parser, data, length));
+        memcpy(data, test->request, length + 1);
+        failures += checkResult(test, "trickled", &parser, parseTrickled(&parser, data, length));
+    }
+
+    printf("%s\n", failures == 0 ? "request parser: all tests passed" : "request parser: FAILED");
+    return failures == 0 ? 0 : 1;
+}
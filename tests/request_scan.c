@@ -0,0 +1,113 @@
+/**
+ * @brief Equivalence of the vectorised request scans with the scalar ones
+ *
+ * Every kernel the CPU supports is run on random buffers at every length up to 160 bytes (the tails after
+ * the 16 and 32 byte blocks) and every alignment, against the scalar kernel. The bytes are drawn mostly from
+ * the class being scanned, with the delimiters, controls, DEL and bytes from 0x80 in between, so the runs
+ * end at every position of a block; the bytes after the length are poisoned to catch an over-read that
+ * changes a result. Also every single byte value, and the lower case writes nothing past the length.
+ *
+ * make test-request-scan && ./bin/test-request-scan [rounds]
+ */
+
+#include <stdio.h>  // for printf()
+#include <stdlib.h> // for atoi() and rand()
+#include <string.h> // for memcmp()
+
+#include "request_scan.h"
+
+#define SCAN_TEST_LENGTH_MAX 160
+#define SCAN_TEST_ALIGNMENTS 32
+#define SCAN_TEST_BUFFER_SIZE (SCAN_TEST_LENGTH_MAX + SCAN_TEST_ALIGNMENTS + 64)
+
+static const char tokenAlphabet[] = "GETPOSabcxyz019!#$%&'*+-.^_`|~";
+static const char otherBytes[] = " :\t\r\n\"(),/;<=>?@[\\]{}\x7F\x80\xC3\xFF\x01\x00";
+
+static void fillBuffer(char *buffer, size_t length) {
+    size_t i;
+    for (i = 0; i < length; i++) {
+        int draw = rand() % 64;
+        if (draw == 0) {
+            buffer[i] = (char)(rand() % 256);
+        } else if (draw < 4) {
+            buffer[i] = otherBytes[rand() % (sizeof(otherBytes) - 1)];
+        } else {
+            buffer[i] = tokenAlphabet[rand() % (sizeof(tokenAlphabet) - 1)];
+        }
+    }
+}
+
+static int compareKernels(const struct RequestScanType *scalar, const struct RequestScanType *kernels, const char *data,
+                          size_t length) {
+    int failures = 0;
+    size_t expected, got;
+    if ((expected = scalar->tokenLength(data, length)) != (got = kernels->tokenLength(data, length))) {
+        printf("%s tokenLength of %zu bytes: %zu instead of %zu\n", kernels->name, length, got, expected);
+        failures++;
+    }
+    if ((expected = scalar->pathLength(data, length)) != (got = kernels->pathLength(data, length))) {
+        printf("%s pathLength of %zu bytes: %zu instead of %zu\n", kernels->name, length, got, expected);
+        failures++;
+    }
+    if ((expected = scalar->valueLength(data, length)) != (got = kernels->valueLength(data, length))) {
+        printf("%s valueLength of %zu bytes: %zu instead of %zu\n", kernels->name, length, got, expected);
+        failures++;
+    }
+
+    char expectedLower[SCAN_TEST_BUFFER_SIZE];
+    char gotLower[SCAN_TEST_BUFFER_SIZE];
+    memset(expectedLower, '#', sizeof(expectedLower));
+    memset(gotLower, '#', sizeof(gotLower));
+    scalar->lowerCase(expectedLower, data, length);
+    kernels->lowerCase(gotLower, data, length);
+    if (memcmp(expectedLower, gotLower, sizeof(gotLower)) != 0) {
+        printf("%s lowerCase of %zu bytes differs\n", kernels->name, length);
+        failures++;
+    }
+    return failures;
+}
+
+int main(int argc, char *argv[]) {
+    int rounds = argc > 1 ? atoi(argv[1]) : 200;
+    const struct RequestScanType *scalar = getRequestScanKernels(REQUEST_SCAN_SCALAR);
+    char buffer[SCAN_TEST_BUFFER_SIZE];
+    int failures = 0;
+    srand(42);
+
+    int level;
+    for (level = REQUEST_SCAN_SCALAR + 1; level < REQUEST_SCAN_LEVELS; level++) {
+        const struct RequestScanType *kernels = getRequestScanKernels((enum RequestScanLevel)level);
+        if (kernels == NULL) {
+            printf("level %d: not supported by this CPU, skipped\n", level);
+            continue;
+        }
+        int failuresBefore = failures;
+
+        int byte;
+        for (byte = 0; byte < 256; byte++) {
+            // one byte of the value at every position of two blocks
+            size_t position;
+            for (position = 0; position < 64; position++) {
+                memset(buffer, 'a', 64);
+                buffer[position] = (char)byte;
+                failures += compareKernels(scalar, kernels, buffer, 64);
+            }
+        }
+
+        int round;
+        for (round = 0; round < rounds; round++) {
+            size_t alignment, length;
+            for (alignment = 0; alignment < SCAN_TEST_ALIGNMENTS; alignment++) {
+                for (length = 0; length <= SCAN_TEST_LENGTH_MAX; length++) {
+                    fillBuffer(buffer + alignment, length);
+                    // a run of the class after the length, an over-read would go on with it
+                    memset(buffer + alignment + length, 'a', SCAN_TEST_BUFFER_SIZE - alignment - length);
+                    failures += compareKernels(scalar, kernels, buffer + alignment, length);
+                }
+            }
+        }
+        printf("%s: %s\n", kernels->name, failures == failuresBefore ? "same results as the scalar kernels" : "FAILED");
+    }
+
+    return failures == 0 ? 0 : 1;
+}